@@ -57,4 +57,46 @@ SELECT
     COUNT(DISTINCT ip_address) as unique_ips
 FROM bot_requests
 GROUP BY matched_pattern
-ORDER BY violation_count DESC; 
\ No newline at end of file
+ORDER BY violation_count DESC; 
+
+-- Request counters written with "robonope_log_format aggregate", one row
+-- per fingerprint, matched pattern and time bucket
+CREATE TABLE IF NOT EXISTS request_counts (
+    fingerprint TEXT NOT NULL,
+    matched_pattern TEXT NOT NULL,
+    bucket DATETIME NOT NULL,
+    ip TEXT,
+    user_agent TEXT,
+    url TEXT,
+    hits INTEGER NOT NULL,
+    first_seen DATETIME,
+    last_seen DATETIME,
+    PRIMARY KEY (fingerprint, matched_pattern, bucket)
+);
+
+-- Create index on bucket for time range queries
+CREATE INDEX IF NOT EXISTS idx_request_counts_bucket ON request_counts(bucket);
+
+-- Offender Statistics View, from the counters
+CREATE VIEW IF NOT EXISTS offender_statistics AS
+SELECT
+    user_agent,
+    SUM(hits) as total_requests,
+    COUNT(DISTINCT ip) as unique_ips,
+    COUNT(DISTINCT matched_pattern) as unique_patterns,
+    MIN(first_seen) as first_seen,
+    MAX(last_seen) as last_seen
+FROM request_counts
+GROUP BY user_agent
+ORDER BY total_requests DESC;
+
+-- Pattern Counts View, from the counters
+CREATE VIEW IF NOT EXISTS pattern_counts AS
+SELECT
+    matched_pattern,
+    SUM(hits) as violation_count,
+    COUNT(DISTINCT user_agent) as unique_bots,
+    COUNT(DISTINCT ip) as unique_ips
+FROM request_counts
+GROUP BY matched_pattern
+ORDER BY violation_count DESC;
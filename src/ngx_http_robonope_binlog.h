@@ -0,0 +1,53 @@
+#ifndef _NGX_HTTP_ROBONOPE_BINLOG_H_INCLUDED_
+#define _NGX_HTTP_ROBONOPE_BINLOG_H_INCLUDED_
+
+/*
+ * Layout of the binary request log, "robonope_log_format binary".  Shared
+ * by the module and tools/robonope_binlog.c, so it only uses stdint types.
+ *
+ * A segment file is a header followed by 8-byte aligned records in the
+ * byte order of the host that wrote it.  Strings are interned per segment:
+ * the first use of a User-Agent, URL or pattern writes a string record
+ * with a new id, later hits refer to the id.  A segment is complete when
+ * its writer has moved on to the next one, a reader of a segment still
+ * being written stops at the last whole record.
+ */
+
+#include <stdint.h>
+
+#define NGX_HTTP_ROBONOPE_BINLOG_MAGIC    "RNBLOG\r\n"
+#define NGX_HTTP_ROBONOPE_BINLOG_VERSION  1
+
+#define NGX_HTTP_ROBONOPE_BINLOG_STRING   1
+#define NGX_HTTP_ROBONOPE_BINLOG_HIT      2
+
+#define ngx_http_robonope_binlog_align(n)  (((n) + 7) & ~((size_t) 7))
+
+typedef struct {
+    uint8_t      magic[8];
+    uint32_t     version;
+    uint32_t     pid;          /* Worker that wrote the segment */
+    uint64_t     created;      /* Unix time in milliseconds */
+} ngx_http_robonope_binlog_header_t;
+
+/* Followed by len bytes of the string, padded to 8 bytes */
+typedef struct {
+    uint8_t      type;         /* NGX_HTTP_ROBONOPE_BINLOG_STRING */
+    uint8_t      reserved;
+    uint16_t     len;
+    uint32_t     id;           /* From 1, 0 means no string */
+} ngx_http_robonope_binlog_string_t;
+
+typedef struct {
+    uint8_t      type;         /* NGX_HTTP_ROBONOPE_BINLOG_HIT */
+    uint8_t      family;       /* 4, 6 or 0 if the client address is neither */
+    uint16_t     reserved;
+    uint32_t     user_agent;   /* String ids */
+    uint32_t     url;
+    uint32_t     pattern;
+    uint64_t     time;         /* Unix time in milliseconds */
+    uint8_t      addr[16];     /* Network byte order, IPv4 in the first 4 */
+    uint8_t      fingerprint[16];
+} ngx_http_robonope_binlog_hit_t;
+
+#endif /* _NGX_HTTP_ROBONOPE_BINLOG_H_INCLUDED_ */
@@ -0,0 +1,443 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * Honeypot content: the class name, body text, honeypot link and maze
+ * links of a page, and the page itself rendered from the template.  These
+ * run for every page that is not served from the page pool, and only
+ * depend on the configuration, the rules and a random stream, so they can
+ * be built and measured without the rest of the module.
+ */
+
+/* Helper function to generate a random CSS class name */
+u_char *
+ngx_http_robonope_generate_class_name(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng)
+{
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const size_t charset_size = sizeof(charset) - 1;
+    static const size_t class_length = 12; // Random length between 8-16 chars
+    
+    u_char *class_name = ngx_pcalloc(pool, class_length + 1);
+    if (class_name == NULL) {
+        return NULL;
+    }
+    
+    // First character must be a letter
+    class_name[0] = charset[ngx_http_robonope_random(rng) % 52];
+    
+    // Rest can be any character from charset
+    for (size_t i = 1; i < class_length; i++) {
+        class_name[i] = charset[ngx_http_robonope_random(rng) % charset_size];
+    }
+    
+    return class_name;
+}
+
+ngx_int_t
+ngx_http_robonope_generate_random_text(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_uint_t words, ngx_str_t *text)
+{
+    static const char *subjects[] = {
+        "the system", "our network", "the server", "this page", "the website",
+        "the database", "the service", "the platform", "the application", "the interface"
+    };
+    
+    static const char *verbs[] = {
+        "processes", "manages", "handles", "analyzes", "monitors",
+        "validates", "updates", "maintains", "controls", "optimizes"
+    };
+    
+    static const char *objects[] = {
+        "data requests", "user sessions", "network traffic", "system resources",
+        "security protocols", "access permissions", "configuration settings",
+        "database connections", "cache entries", "service endpoints"
+    };
+    
+    static const char *adjectives[] = {
+        "secure", "efficient", "reliable", "dynamic", "automated",
+        "integrated", "optimized", "scalable", "robust", "advanced"
+    };
+    
+    static const char *adverbs[] = {
+        "automatically", "efficiently", "securely", "dynamically", "continuously",
+        "reliably", "seamlessly", "actively", "intelligently", "effectively"
+    };
+    
+    static const char *conjunctions[] = {
+        "while", "and", "as", "because", "although",
+        "however", "therefore", "moreover", "furthermore", "additionally"
+    };
+
+    static const size_t num_subjects = sizeof(subjects) / sizeof(subjects[0]);
+    static const size_t num_verbs = sizeof(verbs) / sizeof(verbs[0]);
+    static const size_t num_objects = sizeof(objects) / sizeof(objects[0]);
+    static const size_t num_adjectives = sizeof(adjectives) / sizeof(adjectives[0]);
+    static const size_t num_adverbs = sizeof(adverbs) / sizeof(adverbs[0]);
+    static const size_t num_conjunctions = sizeof(conjunctions) / sizeof(conjunctions[0]);
+
+    size_t total_len = words * 20; // Average word length + space + punctuation
+    u_char *content, *p;
+    ngx_uint_t i, sentences;
+    
+    content = ngx_pcalloc(pool, total_len + 1);
+    if (content == NULL) {
+        return NGX_ERROR;
+    }
+    
+    p = content;
+    sentences = words / 10 + 1; // Create a new sentence every ~10 words
+    
+    for (i = 0; i < sentences; i++) {
+        // Basic sentence patterns
+        switch (ngx_http_robonope_random(rng) % 3) {
+            case 0: // Pattern: Subject + Verb + Object
+                p = ngx_sprintf(p, "%s %s %s. ",
+                    subjects[ngx_http_robonope_random(rng) % num_subjects],
+                    verbs[ngx_http_robonope_random(rng) % num_verbs],
+                    objects[ngx_http_robonope_random(rng) % num_objects]);
+                break;
+                
+            case 1: // Pattern: Subject + Adverb + Verb + Adjective + Object
+                p = ngx_sprintf(p, "%s %s %s %s %s. ",
+                    subjects[ngx_http_robonope_random(rng) % num_subjects],
+                    adverbs[ngx_http_robonope_random(rng) % num_adverbs],
+                    verbs[ngx_http_robonope_random(rng) % num_verbs],
+                    adjectives[ngx_http_robonope_random(rng) % num_adjectives],
+                    objects[ngx_http_robonope_random(rng) % num_objects]);
+                break;
+                
+            case 2: // Pattern: Conjunction + Subject + Verb + Object
+                p = ngx_sprintf(p, "%s %s %s %s. ",
+                    conjunctions[ngx_http_robonope_random(rng) % num_conjunctions],
+                    subjects[ngx_http_robonope_random(rng) % num_subjects],
+                    verbs[ngx_http_robonope_random(rng) % num_verbs],
+                    objects[ngx_http_robonope_random(rng) % num_objects]);
+                break;
+        }
+    }
+    
+    text->data = content;
+    text->len = p - content;
+
+    return NGX_OK;
+}
+
+/* File names appended to Disallow prefixes in honeypot links */
+static ngx_str_t ngx_http_robonope_link_files[] = {
+    ngx_string("index.html"), ngx_string("login.php"), ngx_string("data.json"),
+    ngx_string("config.xml"), ngx_string("settings.html")
+};
+
+ngx_str_t *
+ngx_http_robonope_generate_honeypot_link(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_str_t *base_url, ngx_http_robonope_ruleset_t *rs, ngx_http_robonope_loc_conf_t *lcf)
+{
+    ngx_str_t *link, *file;
+    u_char *p, *pattern;
+    size_t len;
+    ngx_http_robonope_rule_t *rule = NULL;
+    
+    // Check if we should use the instructions URL for the honeypot link
+    if (lcf != NULL && lcf->instructions_url.data != NULL && lcf->instructions_url.len > 0) {
+        // Use the configured instructions URL as the honeypot link
+        len = lcf->instructions_url.len;
+        
+        link = ngx_palloc(pool, sizeof(ngx_str_t));
+        if (link == NULL) {
+            return NULL;
+        }
+        
+        p = ngx_palloc(pool, len + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+        
+        link->data = p;
+        p = ngx_cpymem(p, lcf->instructions_url.data, len);
+        *p = '\0';
+        link->len = len;
+        
+        return link;
+    }
+    
+    // Select a random pattern from the disallow rules
+    if (rs != NULL && rs->nrules > 0) {
+        rule = ngx_http_robonope_pick_disallow(rs, ngx_http_robonope_random(rng));
+    }
+
+    if (rule == NULL) {
+        // Fallback to default honeypot link if no disallow patterns are available
+        len = sizeof("/admin/index.html") - 1;
+        
+        link = ngx_palloc(pool, sizeof(ngx_str_t));
+        if (link == NULL) {
+            return NULL;
+        }
+        
+        p = ngx_palloc(pool, len + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+        
+        link->data = p;
+        p = ngx_cpymem(p, "/admin/index.html", len);
+        *p = '\0';
+        link->len = len;
+        
+        return link;
+    }
+    
+    pattern = ngx_http_robonope_rule_pattern(rs, rule);
+    
+    // Create a link based on the literal part of the selected pattern
+    len = ngx_http_robonope_rule_prefix(rs, rule);
+    
+    // Add some randomness to the path
+    file = &ngx_http_robonope_link_files[ngx_http_robonope_random(rng)
+                                         % (sizeof(ngx_http_robonope_link_files) / sizeof(ngx_str_t))];
+    
+    link = ngx_palloc(pool, sizeof(ngx_str_t));
+    if (link == NULL) {
+        return NULL;
+    }
+    
+    // Allocate memory for pattern + "/" + file name + null terminator
+    p = ngx_palloc(pool, len + 1 + file->len + 1);
+    if (p == NULL) {
+        return NULL;
+    }
+    
+    link->data = p;
+    
+    // Copy pattern
+    p = ngx_cpymem(p, pattern, len);
+    
+    // Add slash if the pattern doesn't end with one
+    if (p > link->data && *(p-1) != '/') {
+        *p++ = '/';
+    }
+    
+    // Add random file name
+    p = ngx_cpymem(p, file->data, file->len);
+    
+    *p = '\0';
+    link->len = p - link->data;
+    
+    return link;
+}
+
+/* First Disallow rule at or after "start", wrapping around, NULL if none */
+ngx_http_robonope_rule_t *
+ngx_http_robonope_pick_disallow(ngx_http_robonope_ruleset_t *rs, ngx_uint_t start)
+{
+    ngx_http_robonope_rule_t *rules;
+    ngx_uint_t i;
+
+    rules = ngx_http_robonope_ruleset_rules(rs);
+    start %= rs->nrules;
+
+    for (i = 0; i < rs->nrules; i++) {
+        if (!rules[(start + i) % rs->nrules].allow) {
+            return &rules[(start + i) % rs->nrules];
+        }
+    }
+
+    return NULL;
+}
+
+/* Length of the literal part of a pattern, before any "*" or "$" */
+size_t
+ngx_http_robonope_rule_prefix(ngx_http_robonope_ruleset_t *rs, ngx_http_robonope_rule_t *rule)
+{
+    u_char *pattern;
+    size_t len;
+
+    pattern = ngx_http_robonope_rule_pattern(rs, rule);
+
+    for (len = 0; len < rule->len && pattern[len] != '*'; len++) {
+        /* void */
+    }
+
+    if (len == rule->len && len > 0 && pattern[len - 1] == '$') {
+        len--;
+    }
+
+    return len;
+}
+
+/*
+ * Hidden links of the maze.  Each page links to "links" more pages under
+ * Disallow prefixes, and the targets are drawn from a stream seeded with
+ * the content key and the URI, so following a link always leads to the
+ * same next page while the link graph itself is never stored.  All links
+ * are written into one buffer sized up front, whatever the depth.
+ */
+ngx_int_t
+ngx_http_robonope_generate_maze(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_rng_t *rng, ngx_uint_t links, ngx_str_t *uri, ngx_str_t *class_name, ngx_str_t *maze)
+{
+    static ngx_str_t anchors[] = {
+        ngx_string("Archive"), ngx_string("Next page"), ngx_string("Details"),
+        ngx_string("Documents"), ngx_string("Index"), ngx_string("More information")
+    };
+
+    ngx_http_robonope_rng_t stream;
+    ngx_http_robonope_rule_t *rule;
+    ngx_str_t *file, *anchor;
+    ngx_md5_t md5;
+    ngx_uint_t i, n;
+    u_char key[16], id[6], *p;
+    size_t len;
+
+    if (links == 0) {
+        ngx_str_null(maze);
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(pool, links * (mcf->maze_prefix + class_name->len + NGX_HTTP_ROBONOPE_MAZE_LINK));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    maze->data = p;
+
+    // Pages rendered ahead of time have no URI, they get a random key
+    md5 = mcf->content_key;
+
+    if (uri != NULL) {
+        ngx_md5_update(&md5, uri->data, uri->len);
+
+    } else {
+        for (i = 0; i < 4; i++) {
+            n = ngx_http_robonope_random(rng);
+            ngx_md5_update(&md5, &n, sizeof(ngx_uint_t));
+        }
+    }
+
+    ngx_md5_final(key, &md5);
+    ngx_http_robonope_rng_seed(&stream, key);
+
+    for (i = 0; i < links; i++) {
+        rule = NULL;
+        n = ngx_http_robonope_random(&stream);
+
+        if (mcf->rules->nrules > 0) {
+            rule = ngx_http_robonope_pick_disallow(mcf->rules, n);
+        }
+
+        p = ngx_cpymem(p, "<a href=\"", sizeof("<a href=\"") - 1);
+
+        if (rule != NULL) {
+            len = ngx_http_robonope_rule_prefix(mcf->rules, rule);
+            p = ngx_cpymem(p, ngx_http_robonope_rule_pattern(mcf->rules, rule), len);
+
+        } else {
+            p = ngx_cpymem(p, "/admin", sizeof("/admin") - 1);
+        }
+
+        if (p[-1] != '/') {
+            *p++ = '/';
+        }
+
+        for (n = 0; n < sizeof(id); n++) {
+            id[n] = (u_char) ngx_http_robonope_random(&stream);
+        }
+
+        p = ngx_hex_dump(p, id, sizeof(id));
+        *p++ = '/';
+
+        file = &ngx_http_robonope_link_files[ngx_http_robonope_random(&stream)
+                                             % (sizeof(ngx_http_robonope_link_files) / sizeof(ngx_str_t))];
+        anchor = &anchors[ngx_http_robonope_random(&stream) % (sizeof(anchors) / sizeof(ngx_str_t))];
+
+        p = ngx_cpymem(p, file->data, file->len);
+        p = ngx_cpymem(p, "\" class=\"", sizeof("\" class=\"") - 1);
+        p = ngx_cpymem(p, class_name->data, class_name->len);
+        *p++ = '"';
+        *p++ = '>';
+        p = ngx_cpymem(p, anchor->data, anchor->len);
+        p = ngx_cpymem(p, "</a>\n", sizeof("</a>\n") - 1);
+    }
+
+    maze->len = p - maze->data;
+
+    return NGX_OK;
+}
+
+/* Generate the values of one page, indexed by segment type */
+ngx_int_t
+ngx_http_robonope_honeypot_values(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_http_robonope_rng_t *rng, ngx_str_t *uri, ngx_str_t *honeypot_link, ngx_str_t *values)
+{
+    u_char *random_class;
+
+    // Generate random class name
+    random_class = ngx_http_robonope_generate_class_name(pool, rng);
+    if (random_class == NULL) {
+        return NGX_ERROR;
+    }
+
+    values[NGX_HTTP_ROBONOPE_SEGMENT_CLASS].data = random_class;
+    values[NGX_HTTP_ROBONOPE_SEGMENT_CLASS].len = ngx_strlen(random_class);
+
+    // Generate body content from the text model if there is one
+    if (mcf->markov) {
+        if (ngx_http_robonope_markov_generate(mcf->markov, pool, rng, 50, &values[NGX_HTTP_ROBONOPE_SEGMENT_TEXT]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else if (ngx_http_robonope_generate_random_text(pool, rng, 50, &values[NGX_HTTP_ROBONOPE_SEGMENT_TEXT]) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    values[NGX_HTTP_ROBONOPE_SEGMENT_LINK] = *honeypot_link;
+
+    if (ngx_http_robonope_generate_maze(pool, mcf, rng, lcf->maze, uri,
+                                        &values[NGX_HTTP_ROBONOPE_SEGMENT_CLASS],
+                                        &values[NGX_HTTP_ROBONOPE_SEGMENT_MAZE])
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+/* Render a whole page into one buffer, used for pages that are kept */
+ngx_int_t
+ngx_http_robonope_render_honeypot(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link, ngx_str_t *page)
+{
+    ngx_array_t *template = mcf->template;
+    ngx_str_t values[NGX_HTTP_ROBONOPE_SEGMENTS], *v;
+    ngx_http_robonope_segment_t *seg;
+    ngx_uint_t i;
+    u_char *p;
+    size_t len;
+
+    if (ngx_http_robonope_honeypot_values(pool, mcf, lcf, NULL, NULL, honeypot_link, values) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    seg = template->elts;
+    len = 0;
+
+    for (i = 0; i < template->nelts; i++) {
+        v = (seg[i].type == NGX_HTTP_ROBONOPE_SEGMENT_STATIC) ? &seg[i].text : &values[seg[i].type];
+        len += v->len;
+    }
+
+    page->data = ngx_pnalloc(pool, len);
+    if (page->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = page->data;
+
+    for (i = 0; i < template->nelts; i++) {
+        v = (seg[i].type == NGX_HTTP_ROBONOPE_SEGMENT_STATIC) ? &seg[i].text : &values[seg[i].type];
+        p = ngx_cpymem(p, v->data, v->len);
+    }
+
+    page->len = len;
+
+    return NGX_OK;
+}
@@ -0,0 +1,369 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * Request log records.  A blocked request is copied into the worker's
+ * pending batch here, truncating each field to its slot, so the writer
+ * never touches request memory.  Scheduling the writer is left to the
+ * caller.  The binary log writer is here too, the database one lives with
+ * the connection in the module.
+ */
+
+static ngx_int_t ngx_http_robonope_binlog_open(ngx_http_robonope_binlog_t *bl, uint64_t created, ngx_log_t *log);
+static ngx_int_t ngx_http_robonope_binlog_flush(ngx_http_robonope_binlog_t *bl, ngx_log_t *log);
+static uint32_t ngx_http_robonope_binlog_intern(ngx_http_robonope_binlog_t *bl, u_char *data, size_t len);
+
+/* MD5 of client address and User-Agent, the offender cache and log key */
+void
+ngx_http_robonope_fingerprint(ngx_http_request_t *r, u_char *fingerprint)
+{
+    ngx_md5_t md5;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, r->connection->addr_text.data, r->connection->addr_text.len);
+
+    if (r->headers_in.user_agent != NULL) {
+        ngx_md5_update(&md5, r->headers_in.user_agent->value.data, r->headers_in.user_agent->value.len);
+    }
+
+    ngx_md5_final(fingerprint, &md5);
+}
+
+/* Append a record to the pending batch, NULL if the batch is full */
+ngx_http_robonope_log_record_t *
+ngx_http_robonope_log_push(ngx_http_robonope_log_queue_t *q, ngx_http_request_t *r, ngx_str_t *matched_pattern, u_char *fingerprint)
+{
+    ngx_time_t *tp;
+    struct sockaddr *sa;
+    ngx_http_robonope_log_record_t *rec;
+
+    if (q->npending == q->size) {
+        q->dropped++;
+        return NULL;
+    }
+
+    rec = &q->pending[q->npending++];
+
+    tp = ngx_timeofday();
+    rec->time = (uint64_t) tp->sec * 1000 + tp->msec;
+    rec->last = rec->time;
+    rec->hits = 1;
+
+    ngx_memcpy(rec->fingerprint, fingerprint, 16);
+
+    rec->family = 0;
+    sa = r->connection->sockaddr;
+
+    if (sa != NULL) {
+        switch (sa->sa_family) {
+
+        case AF_INET:
+            ngx_memcpy(rec->addr, &((struct sockaddr_in *) sa)->sin_addr, 4);
+            rec->family = 4;
+            break;
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            ngx_memcpy(rec->addr, &((struct sockaddr_in6 *) sa)->sin6_addr, 16);
+            rec->family = 6;
+            break;
+#endif
+        }
+    }
+
+    rec->ip_len = ngx_min(r->connection->addr_text.len, NGX_HTTP_ROBONOPE_LOG_IP_LEN);
+    ngx_memcpy(rec->ip, r->connection->addr_text.data, rec->ip_len);
+
+    rec->user_agent_len = 0;
+    if (r->headers_in.user_agent != NULL) {
+        rec->user_agent_len = ngx_min(r->headers_in.user_agent->value.len, NGX_HTTP_ROBONOPE_LOG_UA_LEN);
+        ngx_memcpy(rec->user_agent, r->headers_in.user_agent->value.data, rec->user_agent_len);
+    }
+
+    rec->url_len = ngx_min(r->uri.len, NGX_HTTP_ROBONOPE_LOG_URL_LEN);
+    ngx_memcpy(rec->url, r->uri.data, rec->url_len);
+
+    rec->pattern_len = ngx_min(matched_pattern->len, NGX_HTTP_ROBONOPE_LOG_PATTERN_LEN);
+    ngx_memcpy(rec->pattern, matched_pattern->data, rec->pattern_len);
+
+    return rec;
+}
+
+/*
+ * Count a request against its fingerprint, pattern and time bucket.  A
+ * record is added only for the first request of a key in the batch, later
+ * ones bump its count, so the batch grows with distinct offenders rather
+ * than with requests.  NULL if a new key finds the batch full.
+ */
+ngx_http_robonope_log_record_t *
+ngx_http_robonope_log_count(ngx_http_robonope_log_queue_t *q, ngx_http_request_t *r, ngx_str_t *matched_pattern, u_char *fingerprint)
+{
+    size_t len;
+    uint32_t hash;
+    uint64_t now, bucket;
+    ngx_uint_t i;
+    ngx_time_t *tp;
+    ngx_http_robonope_log_record_t *rec;
+
+    tp = ngx_timeofday();
+    now = (uint64_t) tp->sec * 1000 + tp->msec;
+    bucket = now / q->bucket;
+
+    len = ngx_min(matched_pattern->len, NGX_HTTP_ROBONOPE_LOG_PATTERN_LEN);
+
+    // The fingerprint is an MD5 digest, any four of its bytes hash well
+    ngx_memcpy(&hash, fingerprint, sizeof(uint32_t));
+    hash ^= (uint32_t) bucket ^ ngx_murmur_hash2(matched_pattern->data, len);
+
+    for (i = hash & q->index_mask; q->index[i] != 0; i = (i + 1) & q->index_mask) {
+        rec = &q->pending[q->index[i] - 1];
+
+        if (rec->time / q->bucket == bucket
+            && rec->pattern_len == len
+            && ngx_memcmp(rec->fingerprint, fingerprint, 16) == 0
+            && ngx_memcmp(rec->pattern, matched_pattern->data, len) == 0)
+        {
+            rec->hits++;
+            rec->last = now;
+            return rec;
+        }
+    }
+
+    rec = ngx_http_robonope_log_push(q, r, matched_pattern, fingerprint);
+    if (rec == NULL) {
+        return NULL;
+    }
+
+    q->index[i] = (uint32_t) q->npending;
+
+    return rec;
+}
+
+/* Allocate the writer state, the first segment is opened by the first batch */
+ngx_int_t
+ngx_http_robonope_binlog_init(ngx_http_robonope_binlog_t *bl, ngx_pool_t *pool)
+{
+    bl->fd = NGX_INVALID_FILE;
+
+    bl->name = ngx_pnalloc(pool, bl->path.len + sizeof("/robonope--.seg") - 1
+                                 + NGX_INT64_LEN + 2 * NGX_INT_T_LEN + 1);
+    bl->buf = ngx_palloc(pool, NGX_HTTP_ROBONOPE_BINLOG_BUFFER);
+    bl->strings = ngx_palloc(pool, 2 * NGX_HTTP_ROBONOPE_BINLOG_STRINGS
+                                   * sizeof(ngx_http_robonope_binlog_intern_t));
+    bl->arena = ngx_palloc(pool, NGX_HTTP_ROBONOPE_BINLOG_ARENA);
+
+    if (bl->name == NULL || bl->buf == NULL || bl->strings == NULL || bl->arena == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Append a batch to the current segment, rotating as needed.  Runs on the
+ * log writer, in the thread pool if there is one.  A failed write closes
+ * the segment so a torn record never has more records after it.
+ */
+ngx_int_t
+ngx_http_robonope_binlog_write(ngx_http_robonope_binlog_t *bl, ngx_http_robonope_log_record_t *rec, ngx_uint_t n, ngx_log_t *log)
+{
+    size_t need;
+    uint32_t user_agent, url, pattern;
+    ngx_uint_t i;
+    ngx_http_robonope_binlog_hit_t *hit;
+
+    for (i = 0; i < n; i++, rec++) {
+        // Worst case: all three strings are new to the segment
+        need = sizeof(ngx_http_robonope_binlog_hit_t)
+               + 3 * sizeof(ngx_http_robonope_binlog_string_t)
+               + ngx_http_robonope_binlog_align(rec->user_agent_len)
+               + ngx_http_robonope_binlog_align(rec->url_len)
+               + ngx_http_robonope_binlog_align(rec->pattern_len);
+
+        if (bl->fd != NGX_INVALID_FILE
+            && (bl->size + need > bl->max_size
+                || bl->nstrings + 3 > NGX_HTTP_ROBONOPE_BINLOG_STRINGS
+                || bl->arena_used + rec->user_agent_len + rec->url_len
+                   + rec->pattern_len > NGX_HTTP_ROBONOPE_BINLOG_ARENA))
+        {
+            if (ngx_http_robonope_binlog_flush(bl, log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_http_robonope_binlog_close(bl, log);
+        }
+
+        if (bl->fd == NGX_INVALID_FILE
+            && ngx_http_robonope_binlog_open(bl, rec->time, log) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (bl->used + need > NGX_HTTP_ROBONOPE_BINLOG_BUFFER
+            && ngx_http_robonope_binlog_flush(bl, log) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        // New strings go first, so a reader has seen every id a hit refers to
+        user_agent = ngx_http_robonope_binlog_intern(bl, rec->user_agent, rec->user_agent_len);
+        url = ngx_http_robonope_binlog_intern(bl, rec->url, rec->url_len);
+        pattern = ngx_http_robonope_binlog_intern(bl, rec->pattern, rec->pattern_len);
+
+        hit = (ngx_http_robonope_binlog_hit_t *) (bl->buf + bl->used);
+        bl->used += sizeof(ngx_http_robonope_binlog_hit_t);
+        bl->size += sizeof(ngx_http_robonope_binlog_hit_t);
+
+        hit->type = NGX_HTTP_ROBONOPE_BINLOG_HIT;
+        hit->family = rec->family;
+        hit->reserved = 0;
+        hit->user_agent = user_agent;
+        hit->url = url;
+        hit->pattern = pattern;
+        hit->time = rec->time;
+
+        ngx_memzero(hit->addr, sizeof(hit->addr));
+        ngx_memcpy(hit->addr, rec->addr, (rec->family == 6) ? 16 : (rec->family == 4) ? 4 : 0);
+        ngx_memcpy(hit->fingerprint, rec->fingerprint, 16);
+    }
+
+    return ngx_http_robonope_binlog_flush(bl, log);
+}
+
+/* Write out the buffered records */
+static ngx_int_t
+ngx_http_robonope_binlog_flush(ngx_http_robonope_binlog_t *bl, ngx_log_t *log)
+{
+    u_char *p;
+    ssize_t n;
+
+    p = bl->buf;
+
+    while (p < bl->buf + bl->used) {
+        n = ngx_write_fd(bl->fd, p, bl->buf + bl->used - p);
+
+        if (n == -1) {
+            if (ngx_errno == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_write_fd_n " \"%s\" failed", bl->name);
+            bl->used = 0;
+            ngx_http_robonope_binlog_close(bl, log);
+            return NGX_ERROR;
+        }
+
+        p += n;
+    }
+
+    bl->used = 0;
+
+    return NGX_OK;
+}
+
+/* Start a new segment named after its first record, its pid and a sequence */
+static ngx_int_t
+ngx_http_robonope_binlog_open(ngx_http_robonope_binlog_t *bl, uint64_t created, ngx_log_t *log)
+{
+    ngx_http_robonope_binlog_header_t *header;
+
+    ngx_sprintf(bl->name, "%V/robonope-%uL-%P-%ui.seg%Z",
+                &bl->path, created, ngx_pid, bl->seq++);
+
+    bl->fd = ngx_open_file(bl->name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                           NGX_FILE_DEFAULT_ACCESS);
+
+    if (bl->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", bl->name);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(bl->strings, 2 * NGX_HTTP_ROBONOPE_BINLOG_STRINGS
+                             * sizeof(ngx_http_robonope_binlog_intern_t));
+    bl->nstrings = 0;
+    bl->arena_used = 0;
+
+    header = (ngx_http_robonope_binlog_header_t *) bl->buf;
+    ngx_memcpy(header->magic, NGX_HTTP_ROBONOPE_BINLOG_MAGIC, sizeof(header->magic));
+    header->version = NGX_HTTP_ROBONOPE_BINLOG_VERSION;
+    header->pid = (uint32_t) ngx_pid;
+    header->created = created;
+
+    bl->used = sizeof(ngx_http_robonope_binlog_header_t);
+    bl->size = bl->used;
+
+    return NGX_OK;
+}
+
+void
+ngx_http_robonope_binlog_close(ngx_http_robonope_binlog_t *bl, ngx_log_t *log)
+{
+    if (bl->fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    if (ngx_close_file(bl->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", bl->name);
+    }
+
+    bl->fd = NGX_INVALID_FILE;
+}
+
+/* Id of a string in the current segment, writing a string record if it is new */
+static uint32_t
+ngx_http_robonope_binlog_intern(ngx_http_robonope_binlog_t *bl, u_char *data, size_t len)
+{
+    uint32_t hash, mask, i;
+    ngx_http_robonope_binlog_intern_t *s;
+    ngx_http_robonope_binlog_string_t *str;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    hash = ngx_murmur_hash2(data, len);
+    mask = 2 * NGX_HTTP_ROBONOPE_BINLOG_STRINGS - 1;
+
+    for (i = hash & mask; /* void */; i = (i + 1) & mask) {
+        s = &bl->strings[i];
+
+        if (s->id == 0) {
+            break;
+        }
+
+        if (s->hash == hash && s->len == len
+            && ngx_memcmp(bl->arena + s->off, data, len) == 0)
+        {
+            return s->id;
+        }
+    }
+
+    s->hash = hash;
+    s->id = ++bl->nstrings;
+    s->off = bl->arena_used;
+    s->len = len;
+
+    ngx_memcpy(bl->arena + bl->arena_used, data, len);
+    bl->arena_used += len;
+
+    str = (ngx_http_robonope_binlog_string_t *) (bl->buf + bl->used);
+    str->type = NGX_HTTP_ROBONOPE_BINLOG_STRING;
+    str->reserved = 0;
+    str->len = (uint16_t) len;
+    str->id = s->id;
+
+    ngx_memcpy((u_char *) (str + 1), data, len);
+    ngx_memzero((u_char *) (str + 1) + len, ngx_http_robonope_binlog_align(len) - len);
+
+    len = sizeof(ngx_http_robonope_binlog_string_t) + ngx_http_robonope_binlog_align(len);
+    bl->used += len;
+    bl->size += len;
+
+    return s->id;
+}
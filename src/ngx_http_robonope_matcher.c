@@ -0,0 +1,1091 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * robots.txt rule compiler and matcher.
+ *
+ * The parsed robots.txt entries are compiled into one contiguous block:
+ *
+ *     ruleset header | rule array | radix tree nodes | pattern bytes
+ *
+ * The radix tree is a path-compressed trie over the patterns.  Edge labels
+ * are not stored separately, they point into the pattern bytes of a rule
+ * that passes through the edge.  The children of a node are stored next to
+ * each other and sorted by the first byte of their label, so following a
+ * literal byte is a binary search at every branching point.
+ *
+ * RFC 9309 wildcards are part of the same tree.  Labels never span a "*" or
+ * a trailing "$": a "*" becomes a separate star node that loops on any byte,
+ * and a trailing "$" marks its rule as anchored to the end of the URI.  The
+ * tree is then run as an NFA: all rules, with and without wildcards, are
+ * matched together in a single pass over the URI, keeping a small set of
+ * active positions in a scratch buffer sized at compile time.  Without
+ * wildcards the set never holds more than one position, which is the plain
+ * radix tree walk.
+ */
+
+typedef struct {
+    u_char *data;
+    uint32_t len;
+    uint32_t rule;
+} ngx_http_robonope_sort_t;
+
+typedef struct {
+    ngx_array_t *nodes;
+    ngx_http_robonope_rule_t *rules;
+    ngx_http_robonope_sort_t *sorted;
+    u_char *strings;
+    uint32_t nstates;
+    uint32_t nstars;
+} ngx_http_robonope_build_t;
+
+/* product token characters, RFC 9309 allows letters, "_" and "-" */
+#define ngx_http_robonope_agent_char(c)                                       \
+    (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z')                \
+     || ((c) >= '0' && (c) <= '9') || (c) == '_' || (c) == '-')
+
+typedef struct {
+    ngx_http_robonope_node_t *nodes;
+    ngx_http_robonope_rule_t *rules;
+    uint32_t *stars;
+    ngx_uint_t nstars;
+    uint32_t best;
+} ngx_http_robonope_match_ctx_t;
+
+static ngx_int_t ngx_http_robonope_agent_token(ngx_pool_t *pool,
+    ngx_str_t *value, ngx_str_t *token);
+static int ngx_libc_cdecl ngx_http_robonope_cmp_patterns(const void *one,
+    const void *two);
+static ngx_int_t ngx_http_robonope_build_node(ngx_http_robonope_build_t *b,
+    ngx_uint_t node, ngx_uint_t lo, ngx_uint_t hi, size_t depth);
+static ngx_int_t ngx_http_robonope_build_star(ngx_http_robonope_build_t *b,
+    ngx_uint_t star, ngx_uint_t lo, ngx_uint_t hi, size_t depth);
+static void ngx_http_robonope_build_rule(ngx_http_robonope_build_t *b,
+    uint32_t *slot, uint32_t rule);
+static void ngx_http_robonope_match_rule(ngx_http_robonope_match_ctx_t *ctx,
+    uint32_t rule);
+static ngx_uint_t ngx_http_robonope_rule_wins(ngx_http_robonope_rule_t *rules,
+    uint32_t rule, uint32_t than);
+static void ngx_http_robonope_match_enter(ngx_http_robonope_match_ctx_t *ctx,
+    ngx_http_robonope_node_t *node);
+static ngx_http_robonope_node_t *ngx_http_robonope_match_child(
+    ngx_http_robonope_match_ctx_t *ctx, ngx_http_robonope_node_t *node,
+    u_char c);
+
+ngx_http_robonope_ruleset_t *
+ngx_http_robonope_compile_rules(ngx_pool_t *pool, ngx_array_t *entries)
+{
+    u_char *strings, *p, *src, *last;
+    size_t strings_len, size;
+    uint32_t nstates, nstars, agent_min, agent_max, default_group;
+    ngx_uint_t i, j, g, hash, allow, nrules, ngroups, nagents, first, *egroup;
+    ngx_str_t *patterns, *token, name;
+    ngx_array_t *tokens, *list;
+    ngx_pool_t *temp_pool;
+    ngx_http_robonope_rule_t *rules;
+    ngx_http_robonope_node_t *root;
+    ngx_http_robonope_sort_t *sorted;
+    ngx_http_robonope_group_t *groups;
+    ngx_http_robonope_agent_t *agents;
+    ngx_http_robonope_build_t b;
+    ngx_http_robonope_ruleset_t *rs;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp_pool == NULL) {
+        return NULL;
+    }
+
+    rs = NULL;
+
+    /*
+     * Every distinct product token gets a group.  Entries naming the same
+     * token are merged into it, as RFC 9309 asks for.
+     */
+
+    tokens = ngx_array_create(temp_pool, 8, sizeof(ngx_str_t));
+    egroup = ngx_palloc(temp_pool, (entries->nelts + 1) * sizeof(ngx_uint_t));
+
+    if (tokens == NULL || egroup == NULL) {
+        goto done;
+    }
+
+    nrules = 0;
+    strings_len = 0;
+    entry = entries->elts;
+
+    for (i = 0; i < entries->nelts; i++) {
+        egroup[i] = NGX_HTTP_ROBONOPE_NO_GROUP;
+
+        if (ngx_http_robonope_agent_token(temp_pool, &entry[i].user_agent,
+                                          &name)
+            != NGX_OK)
+        {
+            goto done;
+        }
+
+        if (name.len == 0) {
+            continue;
+        }
+
+        token = tokens->elts;
+
+        for (g = 0; g < tokens->nelts; g++) {
+            if (token[g].len == name.len
+                && ngx_memcmp(token[g].data, name.data, name.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (g == tokens->nelts) {
+            token = ngx_array_push(tokens);
+            if (token == NULL) {
+                goto done;
+            }
+
+            *token = name;
+            strings_len += name.len;
+        }
+
+        egroup[i] = g;
+
+        for (allow = 0; allow < 2; allow++) {
+            list = allow ? entry[i].allow : entry[i].disallow;
+            if (list == NULL) {
+                continue;
+            }
+
+            patterns = list->elts;
+            for (j = 0; j < list->nelts; j++) {
+                nrules++;
+                strings_len += 2 * patterns[j].len;
+            }
+        }
+    }
+
+    if (strings_len > NGX_MAX_UINT32_VALUE) {
+        goto done;
+    }
+
+    ngroups = tokens->nelts;
+
+    rules = ngx_palloc(temp_pool,
+                       (nrules + 1) * sizeof(ngx_http_robonope_rule_t));
+    sorted = ngx_palloc(temp_pool,
+                        (nrules + 1) * sizeof(ngx_http_robonope_sort_t));
+    groups = ngx_pcalloc(temp_pool,
+                         (ngroups + 1) * sizeof(ngx_http_robonope_group_t));
+
+    /* room for a normalized copy of every pattern after the originals */
+    strings = ngx_pnalloc(temp_pool, strings_len + 1);
+
+    if (rules == NULL || sorted == NULL || groups == NULL || strings == NULL) {
+        goto done;
+    }
+
+    /* copy the patterns into the string pool, group by group */
+
+    p = strings;
+    nrules = 0;
+
+    for (g = 0; g < ngroups; g++) {
+        groups[g].rules = (uint32_t) nrules;
+
+        for (i = 0; i < entries->nelts * 2; i++) {
+            allow = i % 2;
+            list = allow ? entry[i / 2].allow : entry[i / 2].disallow;
+
+            if (egroup[i / 2] != g) {
+                continue;
+            }
+
+            /* merged groups keep the longest Crawl-delay */
+
+            if (entry[i / 2].crawl_delay > groups[g].crawl_delay) {
+                groups[g].crawl_delay = (uint32_t) entry[i / 2].crawl_delay;
+            }
+
+            if (list == NULL) {
+                continue;
+            }
+
+            patterns = list->elts;
+            for (j = 0; j < list->nelts; j++) {
+
+                /* an empty "Allow:" or "Disallow:" has no effect */
+
+                if (patterns[j].len == 0) {
+                    continue;
+                }
+
+                rules[nrules].pattern = (uint32_t) (p - strings);
+                rules[nrules].len = (uint32_t) patterns[j].len;
+                rules[nrules].allow = (u_char) allow;
+
+                sorted[nrules].data = p;
+                sorted[nrules].len = (uint32_t) patterns[j].len;
+                sorted[nrules].rule = (uint32_t) nrules;
+
+                p = ngx_cpymem(p, patterns[j].data, patterns[j].len);
+                nrules++;
+            }
+        }
+
+        groups[g].nrules = (uint32_t) nrules - groups[g].rules;
+    }
+
+    /*
+     * "**" is the same as "*".  Patterns containing it are matched through
+     * a collapsed copy; the rule itself keeps the pattern as written, since
+     * its length decides which rule wins.
+     */
+
+    for (i = 0; i < nrules; i++) {
+        src = sorted[i].data;
+        last = src + sorted[i].len;
+
+        for (j = 1; j < sorted[i].len; j++) {
+            if (src[j] == '*' && src[j - 1] == '*') {
+                break;
+            }
+        }
+
+        if (j >= sorted[i].len) {
+            continue;
+        }
+
+        sorted[i].data = p;
+
+        while (src < last) {
+            if (*src != '*' || p == sorted[i].data || p[-1] != '*') {
+                *p++ = *src;
+            }
+
+            src++;
+        }
+
+        sorted[i].len = (uint32_t) (p - sorted[i].data);
+    }
+
+    /* build a radix tree for every group over its sorted patterns */
+
+    b.nodes = ngx_array_create(temp_pool, nrules * 2 + ngroups + 1,
+                               sizeof(ngx_http_robonope_node_t));
+    if (b.nodes == NULL) {
+        goto done;
+    }
+
+    b.rules = rules;
+    b.sorted = sorted;
+    b.strings = strings;
+
+    nstates = 1;
+    nstars = 0;
+
+    for (g = 0; g < ngroups; g++) {
+        first = groups[g].rules;
+
+        ngx_qsort(&sorted[first], groups[g].nrules,
+                  sizeof(ngx_http_robonope_sort_t),
+                  ngx_http_robonope_cmp_patterns);
+
+        groups[g].root = (uint32_t) b.nodes->nelts;
+
+        root = ngx_array_push(b.nodes);
+        if (root == NULL) {
+            goto done;
+        }
+
+        ngx_memzero(root, sizeof(ngx_http_robonope_node_t));
+
+        b.nstates = 1;
+        b.nstars = 0;
+
+        if (ngx_http_robonope_build_node(&b, groups[g].root, first,
+                                         first + groups[g].nrules, 0)
+            != NGX_OK)
+        {
+            goto done;
+        }
+
+        nstates = ngx_max(nstates, b.nstates);
+        nstars = ngx_max(nstars, b.nstars);
+    }
+
+    /* index the product tokens, "*" is the fallback and stays out */
+
+    for (nagents = 1; nagents < 2 * ngroups; nagents <<= 1) {
+        /* void */
+    }
+
+    agents = ngx_pcalloc(temp_pool,
+                         nagents * sizeof(ngx_http_robonope_agent_t));
+    if (agents == NULL) {
+        goto done;
+    }
+
+    agent_min = NGX_MAX_UINT32_VALUE;
+    agent_max = 0;
+    default_group = NGX_HTTP_ROBONOPE_NO_GROUP;
+
+    token = tokens->elts;
+
+    for (g = 0; g < ngroups; g++) {
+
+        if (token[g].len == 1 && token[g].data[0] == '*') {
+            default_group = (uint32_t) g;
+            continue;
+        }
+
+        for (hash = 0, j = 0; j < token[g].len; j++) {
+            hash = ngx_hash(hash, token[g].data[j]);
+        }
+
+        for (j = hash & (nagents - 1); agents[j].len;
+             j = (j + 1) & (nagents - 1))
+        {
+            /* void */
+        }
+
+        agents[j].hash = (uint32_t) hash;
+        agents[j].name = (uint32_t) (p - strings);
+        agents[j].len = (uint32_t) token[g].len;
+        agents[j].group = (uint32_t) g;
+
+        groups[g].name = agents[j].name;
+        groups[g].len = agents[j].len;
+
+        p = ngx_cpymem(p, token[g].data, token[g].len);
+
+        agent_min = ngx_min(agent_min, (uint32_t) token[g].len);
+        agent_max = ngx_max(agent_max, (uint32_t) token[g].len);
+    }
+
+    /* lay everything out in a single block */
+
+    strings_len = p - strings;
+
+    size = sizeof(ngx_http_robonope_ruleset_t)
+           + ngroups * sizeof(ngx_http_robonope_group_t)
+           + nagents * sizeof(ngx_http_robonope_agent_t)
+           + nrules * sizeof(ngx_http_robonope_rule_t)
+           + b.nodes->nelts * sizeof(ngx_http_robonope_node_t)
+           + strings_len;
+
+    if (size > NGX_MAX_UINT32_VALUE) {
+        goto done;
+    }
+
+    rs = ngx_palloc(pool, size);
+    if (rs == NULL) {
+        goto done;
+    }
+
+    rs->size = size;
+    rs->nrules = (uint32_t) nrules;
+    rs->nnodes = (uint32_t) b.nodes->nelts;
+    rs->nstates = nstates;
+    rs->nstars = nstars;
+    rs->ngroups = (uint32_t) ngroups;
+    rs->nagents = (uint32_t) nagents;
+    rs->agent_min = agent_min;
+    rs->agent_max = agent_max;
+    rs->default_group = default_group;
+    rs->groups = sizeof(ngx_http_robonope_ruleset_t);
+    rs->agents = rs->groups
+                 + (uint32_t) (ngroups * sizeof(ngx_http_robonope_group_t));
+    rs->rules = rs->agents
+                + (uint32_t) (nagents * sizeof(ngx_http_robonope_agent_t));
+    rs->nodes = rs->rules
+                + (uint32_t) (nrules * sizeof(ngx_http_robonope_rule_t));
+    rs->strings = rs->nodes
+                  + (uint32_t) (rs->nnodes * sizeof(ngx_http_robonope_node_t));
+
+    ngx_memcpy(ngx_http_robonope_ruleset_groups(rs), groups,
+               ngroups * sizeof(ngx_http_robonope_group_t));
+    ngx_memcpy(ngx_http_robonope_ruleset_agents(rs), agents,
+               nagents * sizeof(ngx_http_robonope_agent_t));
+    ngx_memcpy(ngx_http_robonope_ruleset_rules(rs), rules,
+               nrules * sizeof(ngx_http_robonope_rule_t));
+    ngx_memcpy(ngx_http_robonope_ruleset_nodes(rs), b.nodes->elts,
+               rs->nnodes * sizeof(ngx_http_robonope_node_t));
+    ngx_memcpy(ngx_http_robonope_ruleset_ptr(rs, rs->strings), strings,
+               strings_len);
+
+done:
+
+    ngx_destroy_pool(temp_pool);
+
+    return rs;
+}
+
+/*
+ * Reduces a robots.txt "User-agent:" value to its lowercased product token:
+ * "Googlebot/2.1" becomes "googlebot".  "*" is kept as is.
+ */
+
+static ngx_int_t
+ngx_http_robonope_agent_token(ngx_pool_t *pool, ngx_str_t *value,
+    ngx_str_t *token)
+{
+    size_t i, len;
+
+    token->len = 0;
+    token->data = NULL;
+
+    if (value->len && value->data[0] == '*') {
+        ngx_str_set(token, "*");
+        return NGX_OK;
+    }
+
+    for (len = 0; len < value->len; len++) {
+        if (!ngx_http_robonope_agent_char(value->data[len])) {
+            break;
+        }
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    token->data = ngx_pnalloc(pool, len);
+    if (token->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < len; i++) {
+        token->data[i] = ngx_tolower(value->data[i]);
+    }
+
+    token->len = len;
+
+    return NGX_OK;
+}
+
+static int ngx_libc_cdecl
+ngx_http_robonope_cmp_patterns(const void *one, const void *two)
+{
+    int rc;
+    ngx_http_robonope_sort_t *first, *second;
+
+    first = (ngx_http_robonope_sort_t *) one;
+    second = (ngx_http_robonope_sort_t *) two;
+
+    rc = ngx_memcmp(first->data, second->data,
+                    ngx_min(first->len, second->len));
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (first->len != second->len) {
+        return (first->len < second->len) ? -1 : 1;
+    }
+
+    /* equal patterns: keep robots.txt order so the first one wins */
+
+    return (first->rule < second->rule) ? -1 : 1;
+}
+
+/*
+ * Builds the subtree below "node" from sorted[lo, hi).  All patterns in the
+ * range share their first "depth" bytes, which is exactly the path from the
+ * root to "node".  Because the range is sorted, patterns ending at this depth
+ * come first, and every child corresponds to a contiguous sub-range.
+ *
+ * A "*" at this depth starts the star child instead of a literal one, and a
+ * "$" that ends a pattern makes that pattern an anchored rule of "node".
+ */
+
+static ngx_int_t
+ngx_http_robonope_build_node(ngx_http_robonope_build_t *b, ngx_uint_t node,
+    ngx_uint_t lo, ngx_uint_t hi, size_t depth)
+{
+    u_char c;
+    size_t end;
+    ngx_uint_t i, first, last, nchildren, child, star;
+    ngx_http_robonope_node_t *nodes, *n;
+    ngx_http_robonope_sort_t *s;
+
+    s = b->sorted;
+    nodes = b->nodes->elts;
+
+    /* patterns that end here */
+
+    while (lo < hi && s[lo].len == depth) {
+        ngx_http_robonope_build_rule(b, &nodes[node].rule, s[lo].rule);
+        lo++;
+    }
+
+    if (lo == hi) {
+        return NGX_OK;
+    }
+
+    /* count the distinct next bytes, one child each */
+
+    nchildren = 0;
+    star = 0;
+
+    for (first = lo; first < hi; first = last) {
+
+        c = s[first].data[depth];
+
+        last = first + 1;
+        while (last < hi && s[last].data[depth] == c) {
+            last++;
+        }
+
+        if (c == '*') {
+            star = 1;
+            continue;
+        }
+
+        if (c == '$' && s[last - 1].len == depth + 1) {
+            /* nothing but anchors */
+            continue;
+        }
+
+        nchildren++;
+    }
+
+    child = b->nodes->nelts;
+
+    n = ngx_array_push_n(b->nodes, nchildren + star);
+    if (n == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(n, (nchildren + star) * sizeof(ngx_http_robonope_node_t));
+
+    nodes = b->nodes->elts;
+    nodes[node].child = (uint32_t) child;
+    nodes[node].nchildren = (uint16_t) nchildren;
+
+    if (star) {
+        star = child + nchildren;
+        nodes[node].star = (uint32_t) star;
+    }
+
+    for (first = lo; first < hi; first = last) {
+
+        c = s[first].data[depth];
+
+        last = first + 1;
+        while (last < hi && s[last].data[depth] == c) {
+            last++;
+        }
+
+        if (c == '*') {
+            if (ngx_http_robonope_build_star(b, star, first, last, depth + 1)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+        if (c == '$') {
+            nodes = b->nodes->elts;
+
+            for (i = first; i < last && s[i].len == depth + 1; i++) {
+                ngx_http_robonope_build_rule(b, &nodes[node].anchored,
+                                             s[i].rule);
+            }
+
+            /* the rest use "$" as a literal byte */
+
+            first = i;
+
+            if (first == last) {
+                continue;
+            }
+        }
+
+        /*
+         * the longest common prefix of a sorted range is the common
+         * prefix of its first and last elements; labels stop short of
+         * a "*" and of a trailing "$"
+         */
+
+        end = depth + 1;
+        while (end < s[first].len && end < s[last - 1].len
+               && s[first].data[end] == s[last - 1].data[end]
+               && s[first].data[end] != '*'
+               && !(s[first].data[end] == '$' && end == s[first].len - 1))
+        {
+            end++;
+        }
+
+        nodes = b->nodes->elts;
+        n = &nodes[child];
+
+        n->label = (uint32_t) (s[first].data + depth - b->strings);
+        n->len = (uint32_t) (end - depth);
+        n->key = c;
+
+        if (ngx_http_robonope_build_node(b, child, first, last, end)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        child++;
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Several patterns can end at the same node: duplicates, an Allow and a
+ * Disallow for the same path, or patterns that only differ in repeated
+ * stars.  Only the one that would win a match is kept.
+ */
+
+static void
+ngx_http_robonope_build_rule(ngx_http_robonope_build_t *b, uint32_t *slot,
+    uint32_t rule)
+{
+    if (*slot == 0 || ngx_http_robonope_rule_wins(b->rules, rule + 1, *slot)) {
+        *slot = rule + 1;
+    }
+}
+
+/*
+ * A star node is entered without consuming input and stays active for the
+ * rest of the URI.  Every byte can start a new position in its subtree, so
+ * each star adds at most as many active positions as the longest literal run
+ * that follows it.  Summing that up gives the size of the match scratch.
+ */
+
+static ngx_int_t
+ngx_http_robonope_build_star(ngx_http_robonope_build_t *b, ngx_uint_t star,
+    ngx_uint_t lo, ngx_uint_t hi, size_t depth)
+{
+    size_t run, longest;
+    ngx_uint_t i;
+    ngx_http_robonope_sort_t *s;
+
+    s = b->sorted;
+    longest = 0;
+
+    for (i = lo; i < hi; i++) {
+        for (run = depth; run < s[i].len && s[i].data[run] != '*'; run++) {
+            /* void */
+        }
+
+        longest = ngx_max(longest, run - depth);
+    }
+
+    if (b->nstates + longest > NGX_MAX_UINT32_VALUE / 4) {
+        return NGX_ERROR;
+    }
+
+    b->nstates += (uint32_t) longest;
+    b->nstars++;
+
+    ((ngx_http_robonope_node_t *) b->nodes->elts)[star].key = '*';
+
+    return ngx_http_robonope_build_node(b, star, lo, hi, depth);
+}
+
+/*
+ * Picks the group for a User-Agent header in a single scan: every product
+ * token in the header is looked up in the agent index while it is being
+ * read, and the longest indexed token wins, so "Googlebot-Image" is not
+ * mistaken for "Googlebot".  Without a match the "*" group applies.
+ * Returns NGX_DECLINED if no group applies at all.
+ */
+
+ngx_int_t
+ngx_http_robonope_find_group(ngx_http_robonope_ruleset_t *rs,
+    ngx_str_t *user_agent)
+{
+    u_char *p, *last, *start, *name;
+    size_t len, k;
+    uint32_t best, best_len;
+    ngx_uint_t hash, i, mask;
+    ngx_http_robonope_agent_t *agents;
+
+    if (rs == NULL) {
+        return NGX_DECLINED;
+    }
+
+    best = rs->default_group;
+
+    if (user_agent == NULL || rs->agent_max == 0) {
+        goto done;
+    }
+
+    agents = ngx_http_robonope_ruleset_agents(rs);
+    name = ngx_http_robonope_ruleset_ptr(rs, rs->strings);
+    mask = rs->nagents - 1;
+    best_len = 0;
+
+    p = user_agent->data;
+    last = p + user_agent->len;
+
+    while (p < last) {
+
+        if (!ngx_http_robonope_agent_char(*p)) {
+            p++;
+            continue;
+        }
+
+        start = p;
+        hash = 0;
+
+        while (p < last && ngx_http_robonope_agent_char(*p)) {
+            hash = ngx_hash(hash, ngx_tolower(*p));
+            p++;
+        }
+
+        len = p - start;
+
+        if (len < rs->agent_min || len > rs->agent_max || len <= best_len) {
+            continue;
+        }
+
+        hash = (uint32_t) hash;
+
+        for (i = hash & mask; agents[i].len; i = (i + 1) & mask) {
+
+            if (agents[i].hash != hash || agents[i].len != len) {
+                continue;
+            }
+
+            for (k = 0; k < len; k++) {
+                if (ngx_tolower(start[k]) != name[agents[i].name + k]) {
+                    break;
+                }
+            }
+
+            if (k == len) {
+                best = agents[i].group;
+                best_len = (uint32_t) len;
+                break;
+            }
+        }
+    }
+
+done:
+
+    if (best == NGX_HTTP_ROBONOPE_NO_GROUP) {
+        return NGX_DECLINED;
+    }
+
+    return best;
+}
+
+/*
+ * Returns the rule of "group" that applies to the URI (and query string, if
+ * any), or NULL if none matches.  Allow and Disallow rules are matched
+ * together, the caller checks rule->allow.  "scratch" must hold
+ * ngx_http_robonope_match_scratch_size(rs) bytes.
+ */
+
+ngx_http_robonope_rule_t *
+ngx_http_robonope_match(ngx_http_robonope_ruleset_t *rs, ngx_uint_t group,
+    void *scratch, ngx_str_t *uri, ngx_str_t *args)
+{
+    u_char c, *p, *last, *strings;
+    size_t n;
+    uint32_t root;
+    ngx_uint_t i, seg, nsegs, ncur, nnext, nstars;
+    ngx_str_t segs[3];
+    ngx_http_robonope_node_t *node, *child;
+    ngx_http_robonope_state_t *cur, *next, *tmp;
+    ngx_http_robonope_match_ctx_t ctx;
+
+    if (rs == NULL || group >= rs->ngroups) {
+        return NULL;
+    }
+
+    root = ngx_http_robonope_ruleset_groups(rs)[group].root;
+
+    ctx.nodes = ngx_http_robonope_ruleset_nodes(rs);
+    ctx.rules = ngx_http_robonope_ruleset_rules(rs);
+    ctx.stars = scratch;
+    ctx.nstars = 0;
+    ctx.best = 0;
+
+    strings = ngx_http_robonope_ruleset_ptr(rs, rs->strings);
+
+    cur = (ngx_http_robonope_state_t *) (ctx.stars + rs->nstars);
+    next = cur + rs->nstates;
+
+    cur[0].node = root;
+    cur[0].off = 0;
+    ncur = 1;
+
+    ngx_http_robonope_match_enter(&ctx, &ctx.nodes[root]);
+
+    /* robots.txt patterns apply to the path and the query string */
+
+    segs[0] = *uri;
+    nsegs = 1;
+
+    if (args != NULL && args->len) {
+        ngx_str_set(&segs[1], "?");
+        segs[2] = *args;
+        nsegs = 3;
+    }
+
+    for (seg = 0; seg < nsegs; seg++) {
+
+        p = segs[seg].data;
+        last = p + segs[seg].len;
+
+        while (p < last) {
+
+            if (ctx.nstars == 0) {
+
+                if (ncur == 0) {
+                    goto done;
+                }
+
+                /*
+                 * a single position and no star: the plain radix tree
+                 * walk, compare the rest of the label at once
+                 */
+
+                node = &ctx.nodes[cur[0].node];
+                n = ngx_min(node->len - cur[0].off, (size_t) (last - p));
+
+                if (ncur == 1 && n > 1) {
+                    if (ngx_memcmp(p, strings + node->label + cur[0].off, n)
+                        != 0)
+                    {
+                        goto done;
+                    }
+
+                    p += n;
+                    cur[0].off += (uint32_t) n;
+
+                    if (cur[0].off == node->len) {
+                        ngx_http_robonope_match_enter(&ctx, node);
+                    }
+
+                    continue;
+                }
+            }
+
+            c = *p++;
+            nnext = 0;
+
+            /* stars entered on this byte only start matching on the next */
+
+            nstars = ctx.nstars;
+
+            for (i = 0; i < ncur; i++) {
+                node = &ctx.nodes[cur[i].node];
+
+                if (cur[i].off < node->len) {
+                    if (strings[node->label + cur[i].off] != c) {
+                        continue;
+                    }
+
+                    next[nnext].node = cur[i].node;
+                    next[nnext].off = cur[i].off + 1;
+
+                    if (next[nnext].off == node->len) {
+                        ngx_http_robonope_match_enter(&ctx, node);
+                    }
+
+                    nnext++;
+                    continue;
+                }
+
+                child = ngx_http_robonope_match_child(&ctx, node, c);
+                if (child == NULL) {
+                    continue;
+                }
+
+                next[nnext].node = (uint32_t) (child - ctx.nodes);
+                next[nnext].off = 1;
+
+                if (child->len == 1) {
+                    ngx_http_robonope_match_enter(&ctx, child);
+                }
+
+                nnext++;
+            }
+
+            for (i = 0; i < nstars; i++) {
+                node = &ctx.nodes[ctx.stars[i]];
+
+                child = ngx_http_robonope_match_child(&ctx, node, c);
+                if (child == NULL) {
+                    continue;
+                }
+
+                next[nnext].node = (uint32_t) (child - ctx.nodes);
+                next[nnext].off = 1;
+
+                if (child->len == 1) {
+                    ngx_http_robonope_match_enter(&ctx, child);
+                }
+
+                nnext++;
+            }
+
+            tmp = cur;
+            cur = next;
+            next = tmp;
+            ncur = nnext;
+        }
+    }
+
+    /* end of the URI: anchored rules of the nodes reached exactly */
+
+    for (i = 0; i < ncur; i++) {
+        node = &ctx.nodes[cur[i].node];
+
+        if (cur[i].off == node->len) {
+            ngx_http_robonope_match_rule(&ctx, node->anchored);
+        }
+    }
+
+    for (i = 0; i < ctx.nstars; i++) {
+        ngx_http_robonope_match_rule(&ctx, ctx.nodes[ctx.stars[i]].anchored);
+    }
+
+done:
+
+    if (ctx.best == 0) {
+        return NULL;
+    }
+
+    return &ctx.rules[ctx.best - 1];
+}
+
+static void
+ngx_http_robonope_match_rule(ngx_http_robonope_match_ctx_t *ctx, uint32_t rule)
+{
+    if (rule == 0) {
+        return;
+    }
+
+    if (ctx->best == 0
+        || ngx_http_robonope_rule_wins(ctx->rules, rule, ctx->best))
+    {
+        ctx->best = rule;
+    }
+}
+
+/*
+ * RFC 9309 precedence between two matching rules, given as index + 1: the
+ * longer pattern wins, Allow wins over Disallow of the same length, and
+ * otherwise the one first in robots.txt.
+ */
+
+static ngx_uint_t
+ngx_http_robonope_rule_wins(ngx_http_robonope_rule_t *rules, uint32_t rule,
+    uint32_t than)
+{
+    ngx_http_robonope_rule_t *one, *two;
+
+    one = &rules[rule - 1];
+    two = &rules[than - 1];
+
+    if (one->len != two->len) {
+        return one->len > two->len;
+    }
+
+    if (one->allow != two->allow) {
+        return one->allow;
+    }
+
+    return rule < than;
+}
+
+/*
+ * Called whenever a position reaches the end of a node's label: records the
+ * node's rule and activates its star child, which matches the empty string.
+ */
+
+static void
+ngx_http_robonope_match_enter(ngx_http_robonope_match_ctx_t *ctx,
+    ngx_http_robonope_node_t *node)
+{
+    ngx_uint_t i;
+
+    ngx_http_robonope_match_rule(ctx, node->rule);
+
+    if (node->star == 0) {
+        return;
+    }
+
+    for (i = 0; i < ctx->nstars; i++) {
+        if (ctx->stars[i] == node->star) {
+            return;
+        }
+    }
+
+    ctx->stars[ctx->nstars++] = node->star;
+
+    ngx_http_robonope_match_rule(ctx, ctx->nodes[node->star].rule);
+}
+
+/*
+ * The rule lookup of a request: the group of its User-Agent, "*" if none
+ * names it, and the Disallow rule of that group matching its URI and query
+ * string.  Returns the rule, or NULL if the request is allowed; "group" is
+ * set to the group, or NGX_DECLINED if no group applies.
+ */
+
+ngx_http_robonope_rule_t *
+ngx_http_robonope_match_request(ngx_http_robonope_ruleset_t *rs,
+    void *scratch, ngx_http_request_t *r, ngx_int_t *group)
+{
+    ngx_str_t                 *user_agent;
+    ngx_http_robonope_rule_t  *rule;
+
+    user_agent = (r->headers_in.user_agent != NULL)
+                 ? &r->headers_in.user_agent->value : NULL;
+
+    *group = ngx_http_robonope_find_group(rs, user_agent);
+    if (*group == NGX_DECLINED) {
+        return NULL;
+    }
+
+    rule = ngx_http_robonope_match(rs, *group, scratch, &r->uri, &r->args);
+    if (rule == NULL || rule->allow) {
+        return NULL;
+    }
+
+    return rule;
+}
+
+
+static ngx_http_robonope_node_t *
+ngx_http_robonope_match_child(ngx_http_robonope_match_ctx_t *ctx,
+    ngx_http_robonope_node_t *node, u_char c)
+{
+    ngx_uint_t lo, hi, mid;
+
+    lo = node->child;
+    hi = lo + node->nchildren;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (ctx->nodes[mid].key < c) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == (ngx_uint_t) node->child + node->nchildren
+        || ctx->nodes[lo].key != c)
+    {
+        return NULL;
+    }
+
+    return &ctx->nodes[lo];
+}
@@ -2,6 +2,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 /* Optional modules configuration */
 #ifndef NGX_HTTP_SSL
 #define NGX_HTTP_SSL 0
@@ -29,30 +33,118 @@
 #include "ngx_http_robonope_module.h"
 
 // Function declarations for internal use only
+static ngx_int_t ngx_http_robonope_load_robots(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *robots_path, ngx_uint_t watched);
+static ngx_int_t ngx_http_robonope_set_rules(ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ruleset_t *rs, ngx_pool_t *pool);
+static ngx_int_t ngx_http_robonope_init_rules_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path, ngx_msec_t interval);
+static ngx_int_t ngx_http_robonope_init_rules_shm_zone(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_http_robonope_rules_check_handler(ngx_event_t *ev);
+static void ngx_http_robonope_reload_rules(ngx_http_robonope_main_conf_t *mcf, ngx_file_info_t *fi, ngx_log_t *log);
+static ngx_int_t ngx_http_robonope_retire_rules(ngx_http_robonope_rules_zone_t *rz);
+static ngx_int_t ngx_http_robonope_sync_rules(ngx_http_robonope_main_conf_t *mcf);
+static ngx_int_t ngx_http_robonope_init_db(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *db_path);
+static ngx_int_t ngx_http_robonope_init_cache(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf);
+static ngx_int_t ngx_http_robonope_init_cache_zone(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_http_robonope_cache_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_http_robonope_cache_node_t *ngx_http_robonope_cache_find(ngx_http_robonope_cache_t *cache, u_char *fingerprint);
+static void ngx_http_robonope_cache_delete(ngx_http_robonope_cache_t *cache, ngx_http_robonope_cache_node_t *cn);
+static ngx_int_t ngx_http_robonope_cache_lookup(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
+static void ngx_http_robonope_cache_insert(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
+static char *ngx_http_robonope_set_crawl_delay(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_robonope_init_crawl_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, size_t size);
+static ngx_int_t ngx_http_robonope_init_crawl_shm_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_robonope_crawl_delay(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, u_char *fingerprint, u_char **known);
+static char *ngx_http_robonope_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_robonope_init_status_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf);
+static ngx_int_t ngx_http_robonope_init_status_shm_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_robonope_status_handler(ngx_http_request_t *r);
 static void *ngx_http_robonope_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_robonope_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child);
 static void *ngx_http_robonope_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_robonope_init_main_conf(ngx_conf_t *cf, void *conf);
 static ngx_int_t ngx_http_robonope_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_robonope_handler(ngx_http_request_t *r);
-static void ngx_http_robonope_cleanup_db(void *data);
-static void ngx_http_robonope_cache_cleanup(ngx_http_robonope_main_conf_t *mcf) __attribute__((unused));
-static u_char *ngx_http_robonope_generate_random_text(ngx_pool_t *pool, ngx_uint_t words);
-static ngx_str_t *ngx_http_robonope_generate_honeypot_link(ngx_pool_t *pool, ngx_str_t *base_url, ngx_array_t *disallow_patterns, ngx_http_robonope_loc_conf_t *lcf);
-static ngx_int_t ngx_http_robonope_send_response(ngx_http_request_t *r, u_char *content);
-static u_char *ngx_http_robonope_generate_class_name(ngx_pool_t *pool);
-static ngx_int_t ngx_http_robonope_serve_honeypot(ngx_http_request_t *r, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link);
-static ngx_int_t ngx_http_robonope_load_robots_and_db(ngx_http_request_t *r, ngx_http_robonope_loc_conf_t *lcf, 
-                                                    ngx_str_t **robots_content, ngx_array_t **disallow_patterns);
-static ngx_int_t ngx_http_robonope_is_disallowed(ngx_http_request_t *r, ngx_array_t *disallow_patterns);
-static ngx_int_t ngx_http_robonope_log_request(
-#ifdef ROBONOPE_USE_DUCKDB
-    duckdb_connection conn,
-#else
-    sqlite3 *db,
+static ngx_int_t ngx_http_robonope_inspect(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf);
+static void ngx_http_robonope_cache_cleanup(ngx_http_robonope_main_conf_t *mcf);
+static ngx_int_t ngx_http_robonope_send_response(ngx_http_request_t *r, ngx_str_t *content);
+static ngx_int_t ngx_http_robonope_send_chain(ngx_http_request_t *r, ngx_chain_t *out, off_t len);
+static ngx_int_t ngx_http_robonope_tarpit(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_chain_t *out);
+static void ngx_http_robonope_tarpit_handler(ngx_event_t *ev);
+static void ngx_http_robonope_tarpit_cleanup(void *data);
+static ngx_int_t ngx_http_robonope_load_template(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path);
+static ngx_int_t ngx_http_robonope_load_markov(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path);
+static ngx_int_t ngx_http_robonope_read_text(ngx_conf_t *cf, ngx_pool_t *pool, ngx_str_t *name, ngx_array_t *texts);
+static void ngx_http_robonope_free_markov(void *data);
+static ngx_http_robonope_page_t *ngx_http_robonope_page_create(ngx_http_robonope_page_pool_t *pp, ngx_log_t *log);
+static void ngx_http_robonope_page_release(void *data);
+static void ngx_http_robonope_page_refresh_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_robonope_serve_page(ngx_http_request_t *r, ngx_http_robonope_page_pool_t *pp);
+static ngx_int_t ngx_http_robonope_serve_deterministic(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf);
+static ngx_int_t ngx_http_robonope_etag_match(ngx_table_elt_t *if_none_match, ngx_str_t *etag);
+static ngx_int_t ngx_http_robonope_serve_honeypot(ngx_http_request_t *r, ngx_http_robonope_rng_t *rng, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link);
+static ngx_int_t ngx_http_robonope_is_disallowed(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ctx_t *ctx);
+static ngx_http_robonope_ctx_t *ngx_http_robonope_get_ctx(ngx_http_request_t *r);
+static ngx_int_t ngx_http_robonope_classify(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ctx_t *ctx);
+static ngx_int_t ngx_http_robonope_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_robonope_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_robonope_init_process(ngx_cycle_t *cycle);
+static void ngx_http_robonope_exit_process(ngx_cycle_t *cycle);
+static void ngx_http_robonope_log_request(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *matched_pattern, u_char *fingerprint);
+static void ngx_http_robonope_log_flush(ngx_http_robonope_main_conf_t *mcf);
+static void ngx_http_robonope_log_flush_handler(ngx_event_t *ev);
+static void ngx_http_robonope_log_done(ngx_http_robonope_main_conf_t *mcf);
+static ngx_int_t ngx_http_robonope_log_write(ngx_http_robonope_main_conf_t *mcf);
+#if (NGX_THREADS)
+static void ngx_http_robonope_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_robonope_log_thread_event_handler(ngx_event_t *ev);
 #endif
-    ngx_http_request_t *r,
-    ngx_str_t *matched_pattern);
+
+static ngx_str_t ngx_http_robonope_verdicts[] = {
+    ngx_null_string,                       /* NGX_HTTP_ROBONOPE_VERDICT_NONE */
+    ngx_string("allowed"),                 /* NGX_HTTP_ROBONOPE_VERDICT_ALLOWED */
+    ngx_string("disallowed"),              /* NGX_HTTP_ROBONOPE_VERDICT_DISALLOWED */
+    ngx_string("offender"),                /* NGX_HTTP_ROBONOPE_VERDICT_OFFENDER */
+    ngx_string("crawl_delay"),             /* NGX_HTTP_ROBONOPE_VERDICT_CRAWL_DELAY */
+};
+
+#define NGX_HTTP_ROBONOPE_VAR_VERDICT      0
+#define NGX_HTTP_ROBONOPE_VAR_PATTERN      1
+#define NGX_HTTP_ROBONOPE_VAR_GROUP        2
+#define NGX_HTTP_ROBONOPE_VAR_FINGERPRINT  3
+
+// Not cacheable: a value read before the access phase may change there
+static ngx_http_variable_t ngx_http_robonope_vars[] = {
+    { ngx_string("robonope_verdict"), NULL, ngx_http_robonope_variable,
+      NGX_HTTP_ROBONOPE_VAR_VERDICT, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+    { ngx_string("robonope_matched_pattern"), NULL, ngx_http_robonope_variable,
+      NGX_HTTP_ROBONOPE_VAR_PATTERN, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+    { ngx_string("robonope_rule_group"), NULL, ngx_http_robonope_variable,
+      NGX_HTTP_ROBONOPE_VAR_GROUP, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+    { ngx_string("robonope_fingerprint"), NULL, ngx_http_robonope_variable,
+      NGX_HTTP_ROBONOPE_VAR_FINGERPRINT, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+    ngx_http_null_variable
+};
+
+static ngx_conf_enum_t ngx_http_robonope_offender_actions[] = {
+    { ngx_string("off"), NGX_HTTP_ROBONOPE_OFFENDER_OFF },
+    { ngx_string("honeypot"), NGX_HTTP_ROBONOPE_OFFENDER_HONEYPOT },
+    { ngx_string("403"), NGX_HTTP_ROBONOPE_OFFENDER_FORBIDDEN },
+    { ngx_string("close"), NGX_HTTP_ROBONOPE_OFFENDER_CLOSE },
+    { ngx_null_string, 0 }
+};
+
+static ngx_conf_enum_t ngx_http_robonope_log_formats[] = {
+    { ngx_string("database"), NGX_HTTP_ROBONOPE_LOG_DATABASE },
+    { ngx_string("binary"), NGX_HTTP_ROBONOPE_LOG_BINARY },
+    { ngx_string("aggregate"), NGX_HTTP_ROBONOPE_LOG_AGGREGATE },
+    { ngx_null_string, 0 }
+};
+
+static ngx_conf_enum_t ngx_http_robonope_crawl_delay_actions[] = {
+    { ngx_string("off"), NGX_HTTP_ROBONOPE_CRAWL_DELAY_OFF },
+    { ngx_string("429"), NGX_HTTP_ROBONOPE_CRAWL_DELAY_429 },
+    { ngx_string("honeypot"), NGX_HTTP_ROBONOPE_CRAWL_DELAY_HONEYPOT },
+    { ngx_null_string, 0 }
+};
 
 static ngx_command_t ngx_http_robonope_commands[] = {
     {
@@ -135,11 +227,219 @@ static ngx_command_t ngx_http_robonope_commands[] = {
         offsetof(ngx_http_robonope_loc_conf_t, instructions_url),
         NULL
     },
+    {
+        ngx_string("robonope_deterministic"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, deterministic),
+        NULL
+    },
+    {
+        ngx_string("robonope_secret"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, secret),
+        NULL
+    },
+    {
+        ngx_string("robonope_template"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, template_path),
+        NULL
+    },
+    {
+        ngx_string("robonope_page_pool"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, page_pool),
+        NULL
+    },
+    {
+        ngx_string("robonope_page_refresh"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, page_refresh),
+        NULL
+    },
+    {
+        ngx_string("robonope_markov"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, markov),
+        NULL
+    },
+    {
+        ngx_string("robonope_offender_action"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_enum_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, offender_action),
+        &ngx_http_robonope_offender_actions
+    },
+    {
+        ngx_string("robonope_tarpit"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, tarpit),
+        NULL
+    },
+    {
+        ngx_string("robonope_tarpit_rate"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, tarpit_rate),
+        NULL
+    },
+    {
+        ngx_string("robonope_tarpit_interval"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, tarpit_interval),
+        NULL
+    },
+    {
+        ngx_string("robonope_tarpit_duration"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, tarpit_duration),
+        NULL
+    },
+    {
+        ngx_string("robonope_tarpit_max"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, tarpit_max),
+        NULL
+    },
+    {
+        ngx_string("robonope_robots_check"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, robots_check),
+        NULL
+    },
+    {
+        ngx_string("robonope_crawl_delay"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_http_robonope_set_crawl_delay,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, crawl_delay),
+        &ngx_http_robonope_crawl_delay_actions
+    },
+    {
+        ngx_string("robonope_crawl_delay_burst"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, crawl_delay_burst),
+        NULL
+    },
+    {
+        ngx_string("robonope_crawl_delay_zone"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, crawl_delay_zone),
+        NULL
+    },
+    {
+        ngx_string("robonope_maze"),
+        NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, maze),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_queue_size"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_queue_size),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_thread_pool"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_thread_pool),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_flush_rows"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_flush_rows),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_flush_interval"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_flush_interval),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_format"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_enum_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_format),
+        &ngx_http_robonope_log_formats
+    },
+    {
+        ngx_string("robonope_log_bucket"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_bucket),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_path"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_path),
+        NULL
+    },
+    {
+        ngx_string("robonope_log_segment_size"),
+        NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_robonope_loc_conf_t, log_segment_size),
+        NULL
+    },
+    {
+        ngx_string("robonope_status"),
+        NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+        ngx_http_robonope_set_status,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        NULL
+    },
     ngx_null_command
 };
 
 static ngx_http_module_t ngx_http_robonope_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_robonope_add_variables,     /* preconfiguration */
     ngx_http_robonope_init,              /* postconfiguration */
     ngx_http_robonope_create_main_conf,  /* create main configuration */
     ngx_http_robonope_init_main_conf,    /* init main configuration */
@@ -156,10 +456,10 @@ ngx_module_t ngx_http_robonope_module = {
     NGX_HTTP_MODULE,                   /* module type */
     NULL,                              /* init master */
     NULL,                              /* init module */
-    NULL,                              /* init process */
+    ngx_http_robonope_init_process,   /* init process */
     NULL,                              /* init thread */
     NULL,                              /* exit thread */
-    NULL,                              /* exit process */
+    ngx_http_robonope_exit_process,   /* exit process */
     NULL,                              /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -191,13 +491,231 @@ ngx_http_robonope_create_main_conf(ngx_conf_t *cf)
 static char *
 ngx_http_robonope_init_main_conf(ngx_conf_t *cf, void *conf)
 {
+    ngx_http_robonope_main_conf_t *mcf = conf;
     ngx_http_robonope_loc_conf_t *lcf;
+    ngx_http_robonope_log_queue_t *q;
+    ngx_http_robonope_page_pool_t *pp;
+    ngx_str_t robots_path, content_path;
+    ngx_uint_t i;
+    uint32_t secret;
+#if (NGX_THREADS)
+    ngx_str_t thread_pool;
+#endif
 
     lcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_robonope_module);
     if (lcf == NULL) {
         return NGX_CONF_ERROR;
     }
 
+    /*
+     * robots.txt is loaded and compiled here, once, in the master process.
+     * Workers inherit the compiled table, so requests never parse the file
+     * or build pattern arrays.
+     */
+    robots_path = lcf->robots_path;
+    if (robots_path.data == NULL) {
+        ngx_str_set(&robots_path, NGX_HTTP_ROBONOPE_ROBOTS_PATH);
+    }
+
+    if (ngx_http_robonope_load_robots(mcf, &robots_path,
+                                      lcf->robots_check != NGX_CONF_UNSET_MSEC && lcf->robots_check > 0)
+        != NGX_OK)
+    {
+        if (lcf->robots_path.data != NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               "failed to load robots.txt \"%V\"", &robots_path);
+            return NGX_CONF_ERROR;
+        }
+
+        // The default path is optional, run without rules if it is missing
+        ngx_conf_log_error(NGX_LOG_WARN, cf, ngx_errno,
+                           "failed to load robots.txt \"%V\"", &robots_path);
+        mcf->robot_entries->nelts = 0;
+    }
+
+    mcf->rules = ngx_http_robonope_compile_rules(cf->pool, mcf->robot_entries);
+    if (mcf->rules == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    // Pages rendered here use the http level value, merging comes later
+    if (lcf->maze == NGX_CONF_UNSET_UINT) {
+        lcf->maze = 0;
+    }
+
+    if (ngx_http_robonope_load_template(cf, mcf, &lcf->template_path) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (lcf->markov == 1) {
+        content_path = lcf->static_content_path;
+        if (content_path.data == NULL) {
+            ngx_str_set(&content_path, "/etc/nginx/robonope_static");
+        }
+
+        if (ngx_http_robonope_load_markov(cf, mcf, &content_path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    // Without a configured secret a random one is used, which holds until reload
+    if (lcf->secret.data != NULL) {
+        mcf->secret = lcf->secret;
+
+    } else {
+        mcf->secret.len = 4 * sizeof(uint32_t);
+        mcf->secret.data = ngx_pnalloc(cf->pool, mcf->secret.len);
+        if (mcf->secret.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < 4; i++) {
+            secret = (uint32_t) ngx_random();
+            ngx_memcpy(mcf->secret.data + i * sizeof(uint32_t), &secret, sizeof(uint32_t));
+        }
+    }
+
+    if (ngx_http_robonope_set_rules(mcf, mcf->rules, cf->pool) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (lcf->robots_check != NGX_CONF_UNSET_MSEC && lcf->robots_check > 0) {
+        if (ngx_http_robonope_init_rules_zone(cf, mcf, &robots_path, lcf->robots_check) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    /*
+     * Violations are logged through a per-worker queue, the buffers are
+     * allocated by each worker in ngx_http_robonope_init_process().  With
+     * "robonope_db_path off" and no binary log there is no queue,
+     * violations can go to access_log through the variables instead.
+     */
+    if (lcf->log_format == NGX_CONF_UNSET_UINT) {
+        lcf->log_format = NGX_HTTP_ROBONOPE_LOG_DATABASE;
+    }
+
+    if (lcf->log_format != NGX_HTTP_ROBONOPE_LOG_BINARY
+        && lcf->db_path.len == 3 && ngx_strncmp(lcf->db_path.data, "off", 3) == 0)
+    {
+        ngx_str_set(&lcf->db_path, "");
+        goto log_done;
+    }
+
+    q = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_log_queue_t));
+    if (q == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    q->db_path = lcf->db_path;
+    if (q->db_path.data == NULL) {
+        ngx_str_set(&q->db_path, NGX_HTTP_ROBONOPE_DB_PATH);
+    }
+
+    q->size = lcf->log_queue_size;
+    if (q->size == NGX_CONF_UNSET_UINT) {
+        q->size = NGX_HTTP_ROBONOPE_LOG_QUEUE;
+    }
+
+    if (q->size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "robonope_log_queue_size must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    // Used by the DuckDB appender, which keeps rows across batches
+    q->flush_rows = (lcf->log_flush_rows == NGX_CONF_UNSET_UINT)
+                    ? NGX_HTTP_ROBONOPE_LOG_FLUSH_ROWS : lcf->log_flush_rows;
+    q->flush_interval = (lcf->log_flush_interval == NGX_CONF_UNSET_MSEC)
+                        ? NGX_HTTP_ROBONOPE_LOG_FLUSH_INTERVAL : lcf->log_flush_interval;
+
+    /*
+     * Counters per fingerprint, pattern and time bucket instead of a row
+     * per request.  The batch is indexed by key, with a table at most half
+     * full, and is written from the flush timer only.
+     */
+    if (lcf->log_format == NGX_HTTP_ROBONOPE_LOG_AGGREGATE) {
+        q->aggregate = 1;
+        q->bucket = (lcf->log_bucket == NGX_CONF_UNSET_MSEC)
+                    ? NGX_HTTP_ROBONOPE_LOG_BUCKET : lcf->log_bucket;
+
+        if (q->bucket < 1000) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "robonope_log_bucket must be at least 1s");
+            return NGX_CONF_ERROR;
+        }
+
+        for (q->index_mask = 1; q->index_mask < 2 * q->size; q->index_mask <<= 1) {
+            /* void */
+        }
+
+        q->index_mask--;
+    }
+
+    // Segment files instead of the database, written by the same queue
+    if (lcf->log_format == NGX_HTTP_ROBONOPE_LOG_BINARY) {
+        q->binlog = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_binlog_t));
+        if (q->binlog == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        q->binlog->path = lcf->log_path;
+        if (q->binlog->path.data == NULL) {
+            ngx_str_set(&q->binlog->path, NGX_HTTP_ROBONOPE_LOG_PATH);
+        }
+
+        q->binlog->max_size = (lcf->log_segment_size == NGX_CONF_UNSET_SIZE)
+                              ? 64 * 1024 * 1024 : lcf->log_segment_size;
+
+        if (q->binlog->max_size < NGX_HTTP_ROBONOPE_BINLOG_BUFFER) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "robonope_log_segment_size must be at least %uzk",
+                               (size_t) NGX_HTTP_ROBONOPE_BINLOG_BUFFER / 1024);
+            return NGX_CONF_ERROR;
+        }
+
+        // Names the log in error messages
+        q->db_path = q->binlog->path;
+    }
+
+#if (NGX_THREADS)
+    thread_pool = lcf->log_thread_pool;
+    if (thread_pool.data == NULL) {
+        ngx_str_set(&thread_pool, "default");
+    }
+
+    q->thread_pool = ngx_thread_pool_add(cf, &thread_pool);
+    if (q->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+    mcf->log_queue = q;
+
+log_done:
+
+    // Counted per worker, each worker gets its own copy when it forks
+    mcf->tarpit = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_tarpit_stats_t));
+    if (mcf->tarpit == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->tarpit->max = (lcf->tarpit_max == NGX_CONF_UNSET_UINT) ? 64 : lcf->tarpit_max;
+
+    // Pre-rendered pages, rendered by each worker in ngx_http_robonope_init_process()
+    if (lcf->page_pool != NGX_CONF_UNSET_UINT && lcf->page_pool > 0) {
+        pp = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_page_pool_t));
+        if (pp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        pp->npages = lcf->page_pool;
+        pp->refresh = (lcf->page_refresh == NGX_CONF_UNSET_MSEC) ? 60000 : lcf->page_refresh;
+        pp->mcf = mcf;
+        pp->lcf = lcf;
+
+        mcf->page_pool = pp;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -216,12 +734,37 @@ ngx_http_robonope_create_loc_conf(ngx_conf_t *cf)
     conf->cache_ttl = NGX_CONF_UNSET_UINT;
     conf->max_cache_entries = NGX_CONF_UNSET_UINT;
     conf->use_lorem_ipsum = NGX_CONF_UNSET;
+    conf->log_queue_size = NGX_CONF_UNSET_UINT;
+    conf->offender_action = NGX_CONF_UNSET_UINT;
+    conf->page_pool = NGX_CONF_UNSET_UINT;
+    conf->deterministic = NGX_CONF_UNSET;
+    conf->page_refresh = NGX_CONF_UNSET_MSEC;
+    conf->markov = NGX_CONF_UNSET;
+    conf->tarpit = NGX_CONF_UNSET;
+    conf->tarpit_rate = NGX_CONF_UNSET_SIZE;
+    conf->tarpit_interval = NGX_CONF_UNSET_MSEC;
+    conf->tarpit_duration = NGX_CONF_UNSET_MSEC;
+    conf->tarpit_max = NGX_CONF_UNSET_UINT;
+    conf->maze = NGX_CONF_UNSET_UINT;
+    conf->robots_check = NGX_CONF_UNSET_MSEC;
+    conf->crawl_delay = NGX_CONF_UNSET_UINT;
+    conf->crawl_delay_burst = NGX_CONF_UNSET_UINT;
+    conf->crawl_delay_zone = NGX_CONF_UNSET_SIZE;
+    conf->log_format = NGX_CONF_UNSET_UINT;
+    conf->log_segment_size = NGX_CONF_UNSET_SIZE;
+    conf->log_flush_rows = NGX_CONF_UNSET_UINT;
+    conf->log_flush_interval = NGX_CONF_UNSET_MSEC;
+    conf->log_bucket = NGX_CONF_UNSET_MSEC;
     
     conf->robots_path.data = NULL;
     conf->db_path.data = NULL;
     conf->static_content_path.data = NULL;
     conf->honeypot_class.data = NULL;
     conf->instructions_url.data = NULL;
+    conf->log_thread_pool.data = NULL;
+    conf->log_path.data = NULL;
+    conf->template_path.data = NULL;
+    conf->secret.data = NULL;
 
     return conf;
 }
@@ -234,13 +777,42 @@ ngx_http_robonope_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
     ngx_conf_merge_value(conf->dynamic_content, prev->dynamic_content, 1);
-    ngx_conf_merge_str_value(conf->robots_path, prev->robots_path, "/etc/nginx/robots.txt");
-    ngx_conf_merge_str_value(conf->db_path, prev->db_path, "/var/lib/nginx/robonope.db");
+    ngx_conf_merge_str_value(conf->robots_path, prev->robots_path, NGX_HTTP_ROBONOPE_ROBOTS_PATH);
+    ngx_conf_merge_str_value(conf->db_path, prev->db_path, NGX_HTTP_ROBONOPE_DB_PATH);
     ngx_conf_merge_str_value(conf->static_content_path, prev->static_content_path, "/etc/nginx/robonope_static");
     ngx_conf_merge_uint_value(conf->cache_ttl, prev->cache_ttl, 3600);
     ngx_conf_merge_uint_value(conf->max_cache_entries, prev->max_cache_entries, NGX_HTTP_ROBONOPE_MAX_CACHE);
     ngx_conf_merge_str_value(conf->honeypot_class, prev->honeypot_class, "honeypot");
     ngx_conf_merge_value(conf->use_lorem_ipsum, prev->use_lorem_ipsum, 1);
+    ngx_conf_merge_uint_value(conf->log_queue_size, prev->log_queue_size, NGX_HTTP_ROBONOPE_LOG_QUEUE);
+    ngx_conf_merge_str_value(conf->log_thread_pool, prev->log_thread_pool, "default");
+    ngx_conf_merge_uint_value(conf->log_format, prev->log_format, NGX_HTTP_ROBONOPE_LOG_DATABASE);
+    ngx_conf_merge_str_value(conf->log_path, prev->log_path, NGX_HTTP_ROBONOPE_LOG_PATH);
+    ngx_conf_merge_size_value(conf->log_segment_size, prev->log_segment_size, 64 * 1024 * 1024);
+    ngx_conf_merge_uint_value(conf->log_flush_rows, prev->log_flush_rows, NGX_HTTP_ROBONOPE_LOG_FLUSH_ROWS);
+    ngx_conf_merge_msec_value(conf->log_flush_interval, prev->log_flush_interval, NGX_HTTP_ROBONOPE_LOG_FLUSH_INTERVAL);
+    ngx_conf_merge_msec_value(conf->log_bucket, prev->log_bucket, NGX_HTTP_ROBONOPE_LOG_BUCKET);
+    ngx_conf_merge_uint_value(conf->offender_action, prev->offender_action, NGX_HTTP_ROBONOPE_OFFENDER_OFF);
+    ngx_conf_merge_uint_value(conf->page_pool, prev->page_pool, 0);
+    ngx_conf_merge_msec_value(conf->page_refresh, prev->page_refresh, 60000);
+    ngx_conf_merge_value(conf->markov, prev->markov, 0);
+    ngx_conf_merge_value(conf->tarpit, prev->tarpit, 0);
+    ngx_conf_merge_size_value(conf->tarpit_rate, prev->tarpit_rate, 64);
+    ngx_conf_merge_msec_value(conf->tarpit_interval, prev->tarpit_interval, 1000);
+    ngx_conf_merge_msec_value(conf->tarpit_duration, prev->tarpit_duration, 60000);
+    ngx_conf_merge_uint_value(conf->tarpit_max, prev->tarpit_max, 64);
+    ngx_conf_merge_uint_value(conf->maze, prev->maze, 0);
+    ngx_conf_merge_msec_value(conf->robots_check, prev->robots_check, 0);
+    ngx_conf_merge_uint_value(conf->crawl_delay, prev->crawl_delay, NGX_HTTP_ROBONOPE_CRAWL_DELAY_OFF);
+    ngx_conf_merge_uint_value(conf->crawl_delay_burst, prev->crawl_delay_burst, 0);
+    ngx_conf_merge_size_value(conf->crawl_delay_zone, prev->crawl_delay_zone, 1048576);
+
+    if (conf->tarpit_rate == 0 || conf->tarpit_interval == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "robonope_tarpit_rate and robonope_tarpit_interval must be positive");
+        return NGX_CONF_ERROR;
+    }
+    ngx_conf_merge_value(conf->deterministic, prev->deterministic, 0);
     
     // Don't set a default value for instructions_url
     if (conf->instructions_url.data == NULL) {
@@ -250,212 +822,368 @@ ngx_http_robonope_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     return NGX_CONF_OK;
 }
 
-static ngx_int_t
-ngx_http_robonope_init(ngx_conf_t *cf)
+/* "robonope_crawl_delay", also notes that the bucket zone is needed */
+static char *
+ngx_http_robonope_set_crawl_delay(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_handler_pt *h;
-    ngx_http_core_main_conf_t *cmcf;
-    ngx_pool_cleanup_t *cln;
+    ngx_http_robonope_loc_conf_t *lcf = conf;
     ngx_http_robonope_main_conf_t *mcf;
+    char *rv;
 
-    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
-    mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_robonope_module);
-
-    h = ngx_array_push(&cmcf->phases[NGX_HTTP_ACCESS_PHASE].handlers);
-    if (h == NULL) {
-        return NGX_ERROR;
+    rv = ngx_conf_set_enum_slot(cf, cmd, conf);
+    if (rv != NGX_CONF_OK) {
+        return rv;
     }
 
-    *h = ngx_http_robonope_handler;
-
-    // Initialize cache
-    if (ngx_http_robonope_init_cache(mcf) != NGX_OK) {
-        return NGX_ERROR;
+    if (lcf->crawl_delay == NGX_HTTP_ROBONOPE_CRAWL_DELAY_OFF) {
+        return NGX_CONF_OK;
     }
 
-    // Register cleanup handler
-    cln = ngx_pool_cleanup_add(cf->pool, 0);
-    if (cln == NULL) {
-        return NGX_ERROR;
+    // Buckets are single atomic words holding a tag and a 40 bit time
+    if (sizeof(ngx_atomic_uint_t) < sizeof(uint64_t)) {
+        return "is not supported on this platform";
     }
 
-    cln->handler = ngx_http_robonope_cleanup_db;
-    cln->data = mcf;
+    mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_robonope_module);
+    mcf->crawl_delay = 1;
 
-    return NGX_OK;
+    return NGX_CONF_OK;
+}
+
+/* "robonope_status", serves the counters and notes that their zone is needed */
+static char *
+ngx_http_robonope_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf;
+    ngx_http_robonope_main_conf_t *mcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_robonope_status_handler;
+
+    mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_robonope_module);
+    mcf->status = 1;
+
+    return NGX_CONF_OK;
 }
 
 static ngx_int_t
-ngx_http_robonope_handler(ngx_http_request_t *r)
+ngx_http_robonope_add_variables(ngx_conf_t *cf)
 {
-    ngx_http_robonope_loc_conf_t *lcf;
-    ngx_str_t *robots_content = NULL;
-    ngx_array_t *disallow_patterns = NULL;
-    ngx_str_t *honeypot_link = NULL;
-    ngx_str_t *user_agent = NULL;
-    ngx_str_t ua_lowercase;
-    size_t i;
+    ngx_http_variable_t *var, *v;
 
-    lcf = ngx_http_get_module_loc_conf(r, ngx_http_robonope_module);
+    for (v = ngx_http_robonope_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
 
-    if (!lcf->enable) {
-        return NGX_DECLINED;
+        var->get_handler = v->get_handler;
+        var->data = v->data;
     }
 
-    /* Check if the User-Agent header exists and if it's a bot */
-    if (r->headers_in.user_agent) {
-        user_agent = &r->headers_in.user_agent->value;
-        
-        /* Convert user agent to lowercase for case-insensitive comparison */
-        ua_lowercase.len = user_agent->len;
-        ua_lowercase.data = ngx_pnalloc(r->pool, ua_lowercase.len);
-        if (ua_lowercase.data == NULL) {
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    return NGX_OK;
+}
+
+/*
+ * $robonope_verdict and friends.  They come from the same classification
+ * as the access handler's; where the handler did not run, as with
+ * robonope_enable off, they say what the rules would have done.
+ */
+static ngx_int_t
+ngx_http_robonope_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_ctx_t *ctx;
+    ngx_str_t *value;
+    u_char *p;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
+
+    ctx = ngx_http_robonope_get_ctx(r);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (data == NGX_HTTP_ROBONOPE_VAR_FINGERPRINT) {
+        if (!ctx->fingerprinted) {
+            ngx_http_robonope_fingerprint(r, ctx->fingerprint);
+            ctx->fingerprinted = 1;
         }
-        
-        for (i = 0; i < user_agent->len; i++) {
-            ua_lowercase.data[i] = ngx_tolower(user_agent->data[i]);
+
+        p = ngx_pnalloc(r->pool, 2 * sizeof(ctx->fingerprint));
+        if (p == NULL) {
+            return NGX_ERROR;
         }
+
+        v->len = ngx_hex_dump(p, ctx->fingerprint, sizeof(ctx->fingerprint)) - p;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+        v->data = p;
+
+        return NGX_OK;
     }
 
-    /* Load robots.txt and database */
-    if (ngx_http_robonope_load_robots_and_db(r, lcf, &robots_content, &disallow_patterns) != NGX_OK) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (!ctx->classified) {
+        if (ngx_http_robonope_sync_rules(mcf) != NGX_OK
+            || ngx_http_robonope_classify(r, mcf, ctx) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
     }
 
-    /* Check if the request URI is in the disallow patterns */
-    if (!ngx_http_robonope_is_disallowed(r, disallow_patterns)) {
-        return NGX_DECLINED;
+    switch (data) {
+
+    case NGX_HTTP_ROBONOPE_VAR_VERDICT:
+        value = &ngx_http_robonope_verdicts[ctx->verdict];
+        break;
+
+    case NGX_HTTP_ROBONOPE_VAR_PATTERN:
+        value = &ctx->pattern;
+        break;
+
+    default: /* NGX_HTTP_ROBONOPE_VAR_GROUP */
+        value = &ctx->group;
+        break;
     }
 
-    /* Generate honeypot link - this will use instructions URL if redirect_to_instructions is enabled */
-    honeypot_link = ngx_http_robonope_generate_honeypot_link(r->pool, &r->uri, disallow_patterns, lcf);
-    if (honeypot_link == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (value->len == 0) {
+        v->not_found = 1;
+        return NGX_OK;
     }
 
-    /* Serve honeypot content */
-    return ngx_http_robonope_serve_honeypot(r, lcf, honeypot_link);
+    v->len = value->len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = value->data;
+
+    return NGX_OK;
 }
 
-ngx_int_t
-ngx_http_robonope_load_robots(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *robots_path)
+static ngx_int_t
+ngx_http_robonope_init(ngx_conf_t *cf)
 {
-    ngx_fd_t fd;
-    ngx_file_t file;
-    char *buf, *line, *directive, *value;
-    ngx_http_robonope_robot_entry_t *entry = NULL;
-    size_t size;
-    ssize_t n;
+    ngx_http_handler_pt *h;
+    ngx_http_core_main_conf_t *cmcf;
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_loc_conf_t *lcf;
+    ngx_str_t *honeypot_link;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_robonope_module);
+    lcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_robonope_module);
 
-    if (mcf == NULL || robots_path == NULL || mcf->cache_pool == NULL) {
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_ACCESS_PHASE].handlers);
+    if (h == NULL) {
         return NGX_ERROR;
     }
 
-    fd = ngx_open_file(robots_path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
-    if (fd == NGX_INVALID_FILE) {
+    *h = ngx_http_robonope_handler;
+
+    // Initialize cache
+    if (ngx_http_robonope_init_cache(cf, mcf) != NGX_OK) {
         return NGX_ERROR;
     }
 
-    ngx_memzero(&file, sizeof(ngx_file_t));
-    file.fd = fd;
-    file.name = *robots_path;
+    // Crawl-delay buckets, only if some location enforces Crawl-delay
+    if (mcf->crawl_delay) {
+        if (ngx_http_robonope_init_crawl_zone(cf, mcf,
+                (lcf->crawl_delay_zone == NGX_CONF_UNSET_SIZE) ? 1048576 : lcf->crawl_delay_zone)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
 
-    struct stat sb;
-    if (stat((const char *)robots_path->data, &sb) == -1) {
-        ngx_close_file(fd);
-        return NGX_ERROR;
+    // Status counters, only if some location serves them
+    if (mcf->status) {
+        if (ngx_http_robonope_init_status_zone(cf, mcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
-    size = sb.st_size;
 
-    buf = ngx_palloc(mcf->cache_pool, size + 1);
-    if (buf == NULL) {
-        ngx_close_file(fd);
-        return NGX_ERROR;
+    // Page served to known offenders, and to clients ignoring Crawl-delay
+    if (mcf->cache != NULL || mcf->crawl_zone != NULL) {
+        honeypot_link = ngx_http_robonope_generate_honeypot_link(cf->pool, NULL, NULL, mcf->rules, lcf);
+        if (honeypot_link == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_robonope_render_honeypot(cf->pool, mcf, lcf, honeypot_link, &mcf->offender_page) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
-    n = ngx_read_file(&file, (u_char *)buf, size, 0);
-    ngx_close_file(fd);
+    return NGX_OK;
+}
 
-    if (n == NGX_ERROR) {
-        return NGX_ERROR;
+static ngx_int_t
+ngx_http_robonope_handler(ngx_http_request_t *r)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_loc_conf_t *lcf;
+    ngx_http_robonope_status_slot_t *slot;
+    uint64_t start;
+    ngx_int_t rc;
+
+    lcf = ngx_http_get_module_loc_conf(r, ngx_http_robonope_module);
+
+    if (!lcf->enable) {
+        return NGX_DECLINED;
     }
 
-    buf[n] = '\0';
-    char *saveptr1 = NULL, *saveptr2 = NULL;
-    line = strtok_r(buf, "\n", &saveptr1);
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
 
-    while (line != NULL) {
-        // Skip comments and empty lines
-        if (line[0] == '#' || line[0] == '\0') {
-            line = strtok_r(NULL, "\n", &saveptr1);
-            continue;
-        }
+    slot = mcf->status_slot;
+    if (slot == NULL) {
+        return ngx_http_robonope_inspect(r, mcf, lcf);
+    }
 
-        directive = strtok_r(line, ":", &saveptr2);
-        if (directive == NULL) {
-            line = strtok_r(NULL, "\n", &saveptr1);
-            continue;
-        }
+    start = ngx_http_robonope_status_now();
 
-        value = strtok_r(NULL, "\n", &saveptr2);
-        if (value == NULL) {
-            line = strtok_r(NULL, "\n", &saveptr1);
-            continue;
-        }
+    rc = ngx_http_robonope_inspect(r, mcf, lcf);
 
-        // Trim whitespace
-        while (*value == ' ') value++;
+    slot->inspected++;
+    ngx_http_robonope_status_latency(slot, ngx_http_robonope_status_now() - start);
 
-        if (ngx_strncasecmp((u_char *)"User-agent", (u_char *)directive, 10) == 0) {
-            entry = ngx_array_push(mcf->robot_entries);
-            if (entry == NULL) {
-                return NGX_ERROR;
-            }
-            entry->user_agent.len = ngx_strlen(value);
-            entry->user_agent.data = ngx_pcalloc(mcf->cache_pool, entry->user_agent.len + 1);
-            if (entry->user_agent.data == NULL) {
-                return NGX_ERROR;
+    return rc;
+}
+
+static ngx_int_t
+ngx_http_robonope_inspect(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf)
+{
+    ngx_http_robonope_ctx_t *ctx;
+    ngx_str_t *honeypot_link = NULL;
+    u_char *known = NULL;
+    ngx_int_t rc;
+
+    if (ngx_http_robonope_sync_rules(mcf) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx = ngx_http_robonope_get_ctx(r);
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* Known offenders get the configured response without matching any rules */
+    if (lcf->offender_action != NGX_HTTP_ROBONOPE_OFFENDER_OFF && mcf->cache != NULL) {
+        ngx_http_robonope_fingerprint(r, ctx->fingerprint);
+        ctx->fingerprinted = 1;
+        known = ctx->fingerprint;
+
+        if (ngx_http_robonope_cache_lookup(mcf, known) != NGX_OK) {
+            if (mcf->status_slot != NULL) {
+                mcf->status_slot->cache_misses++;
             }
-            ngx_memcpy(entry->user_agent.data, value, entry->user_agent.len);
-            entry->allow = ngx_array_create(mcf->cache_pool, 4, sizeof(ngx_str_t));
-            if (entry->allow == NULL) {
-                return NGX_ERROR;
+
+        } else {
+            if (mcf->status_slot != NULL) {
+                mcf->status_slot->cache_hits++;
             }
-            entry->disallow = ngx_array_create(mcf->cache_pool, 4, sizeof(ngx_str_t));
-            if (entry->disallow == NULL) {
-                return NGX_ERROR;
+
+            ctx->verdict = NGX_HTTP_ROBONOPE_VERDICT_OFFENDER;
+
+            switch (lcf->offender_action) {
+
+            case NGX_HTTP_ROBONOPE_OFFENDER_FORBIDDEN:
+                return NGX_HTTP_FORBIDDEN;
+
+            case NGX_HTTP_ROBONOPE_OFFENDER_CLOSE:
+                return NGX_HTTP_CLOSE;
+
+            default: /* NGX_HTTP_ROBONOPE_OFFENDER_HONEYPOT */
+                if (mcf->page_pool != NULL) {
+                    return ngx_http_robonope_serve_page(r, mcf->page_pool);
+                }
+                return ngx_http_robonope_send_response(r, &mcf->offender_page);
             }
         }
-        else if (entry != NULL) {
-            ngx_str_t *pattern = NULL;
-            if (ngx_strncasecmp((u_char *)"Allow", (u_char *)directive, 5) == 0) {
-                pattern = ngx_array_push(entry->allow);
-            }
-            else if (ngx_strncasecmp((u_char *)"Disallow", (u_char *)directive, 8) == 0) {
-                pattern = ngx_array_push(entry->disallow);
+    }
+
+    /* Clients fetching faster than their group's Crawl-delay are refused before any matching */
+    if (lcf->crawl_delay != NGX_HTTP_ROBONOPE_CRAWL_DELAY_OFF && mcf->crawl_zone != NULL) {
+        rc = ngx_http_robonope_crawl_delay(r, mcf, lcf, ctx->fingerprint, &known);
+        ctx->fingerprinted = (known != NULL);
+
+        switch (rc) {
+
+        case NGX_OK:
+            break;
+
+        case NGX_BUSY:
+            if (mcf->status_slot != NULL) {
+                mcf->status_slot->crawl_delayed++;
             }
-            else {
-                line = strtok_r(NULL, "\n", &saveptr1);
-                continue;
+
+            ctx->verdict = NGX_HTTP_ROBONOPE_VERDICT_CRAWL_DELAY;
+
+            if (lcf->crawl_delay == NGX_HTTP_ROBONOPE_CRAWL_DELAY_429) {
+                return NGX_HTTP_TOO_MANY_REQUESTS;
             }
 
-            if (pattern == NULL) {
-                return NGX_ERROR;
+            // Remember the client, so robonope_offender_action applies from now on
+            if (mcf->cache != NULL) {
+                ngx_http_robonope_cache_insert(mcf, known);
             }
 
-            pattern->len = ngx_strlen(value);
-            pattern->data = ngx_pcalloc(mcf->cache_pool, pattern->len + 1);
-            if (pattern->data == NULL) {
-                return NGX_ERROR;
+            if (mcf->page_pool != NULL) {
+                return ngx_http_robonope_serve_page(r, mcf->page_pool);
             }
-            ngx_memcpy(pattern->data, value, pattern->len);
+            return ngx_http_robonope_send_response(r, &mcf->offender_page);
+
+        default:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
+    }
 
-        line = strtok_r(NULL, "\n", &saveptr1);
+    /* Check if the request URI is disallowed for this User-Agent */
+    rc = ngx_http_robonope_is_disallowed(r, mcf, ctx);
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    return NGX_OK;
+    if (!rc) {
+        return NGX_DECLINED;
+    }
+
+    /* The same URI always gets the same page, which clients may have cached */
+    if (lcf->deterministic) {
+        return ngx_http_robonope_serve_deterministic(r, mcf, lcf);
+    }
+
+    /* Serve a pre-rendered page if they were rendered for this location's link and maze */
+    if (mcf->page_pool != NULL
+        && lcf->instructions_url.data == mcf->page_pool->lcf->instructions_url.data
+        && lcf->maze == mcf->page_pool->lcf->maze)
+    {
+        return ngx_http_robonope_serve_page(r, mcf->page_pool);
+    }
+
+    /* Generate honeypot link - this will use instructions URL if redirect_to_instructions is enabled */
+    honeypot_link = ngx_http_robonope_generate_honeypot_link(r->pool, NULL, &r->uri, mcf->rules, lcf);
+    if (honeypot_link == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* Serve honeypot content */
+    return ngx_http_robonope_serve_honeypot(r, NULL, lcf, honeypot_link);
+}
+
+ngx_int_t
+ngx_http_robonope_load_robots(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *robots_path, ngx_uint_t watched)
+{
+    if (mcf == NULL || mcf->cache_pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    // A file checked for changes may be rewritten while it is parsed, it is not mapped
+    if (watched) {
+        return ngx_http_robonope_read_robots(mcf->cache_pool, mcf->robot_entries, robots_path);
+    }
+
+    return ngx_http_robonope_parse_robots(mcf->cache_pool, mcf->robot_entries, robots_path);
 }
 
 static ngx_int_t
@@ -467,17 +1195,38 @@ ngx_http_robonope_init_db(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *db_path
     }
 
 #ifdef ROBONOPE_USE_DUCKDB
-    if (duckdb_open((char *)db_path->data, &mcf->db) != DuckDBSuccess) {
+    duckdb_config config;
+    duckdb_database db;
+    duckdb_connection conn;
+    duckdb_state state;
+    char *err;
+
+    // One DuckDB thread per worker, the workers already run in parallel
+    if (duckdb_create_config(&config) != DuckDBSuccess) {
+        return NGX_ERROR;
+    }
+
+    duckdb_set_config(config, "threads", "1");
+
+    err = NULL;
+    state = duckdb_open_ext((char *) db_path->data, &db, config, &err);
+    duckdb_destroy_config(&config);
+
+    if (state != DuckDBSuccess) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "robonope failed to open \"%V\": %s",
+                      db_path, err ? err : "unknown error");
+        duckdb_free(err);
         return NGX_ERROR;
     }
 
-    if (duckdb_connect(mcf->db, &mcf->conn) != DuckDBSuccess) {
-        duckdb_close(&mcf->db);
+    if (duckdb_connect(db, &conn) != DuckDBSuccess) {
+        duckdb_close(&db);
         return NGX_ERROR;
     }
 
+    // Rows come from the appender with every column, so there is no id
     const char *sql = "CREATE TABLE IF NOT EXISTS requests ("
-                     "id INTEGER PRIMARY KEY AUTOINCREMENT,"
                      "timestamp TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
                      "ip VARCHAR,"
                      "user_agent VARCHAR,"
@@ -485,23 +1234,71 @@ ngx_http_robonope_init_db(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *db_path
                      "matched_pattern VARCHAR"
                      ");";
 
-    duckdb_state state;
-    state = duckdb_query(mcf->conn, sql, NULL);
-    if (state != DuckDBSuccess) {
-        duckdb_disconnect(&mcf->conn);
-        duckdb_close(&mcf->db);
+    if (duckdb_query(conn, sql, NULL) != DuckDBSuccess) {
+        duckdb_disconnect(&conn);
+        duckdb_close(&db);
         return NGX_ERROR;
     }
 
-#else
-    sqlite3 *sqlite_db;
-    if (sqlite3_open((char *)db_path->data, &sqlite_db) != SQLITE_OK) {
-        return NGX_ERROR;
+    // Counters are upserted with a prepared statement, DuckDB's appender only inserts
+    if (mcf->log_queue->aggregate) {
+        duckdb_prepared_statement stmt = NULL;
+
+        sql = "CREATE TABLE IF NOT EXISTS request_counts ("
+              "fingerprint VARCHAR NOT NULL,"
+              "matched_pattern VARCHAR NOT NULL,"
+              "bucket TIMESTAMP NOT NULL,"
+              "ip VARCHAR,"
+              "user_agent VARCHAR,"
+              "url VARCHAR,"
+              "hits BIGINT NOT NULL,"
+              "first_seen TIMESTAMP,"
+              "last_seen TIMESTAMP,"
+              "PRIMARY KEY (fingerprint, matched_pattern, bucket)"
+              ");";
+
+        if (duckdb_query(conn, sql, NULL) != DuckDBSuccess) {
+            duckdb_disconnect(&conn);
+            duckdb_close(&db);
+            return NGX_ERROR;
+        }
+
+        // A failed prepare still allocates the statement, with its error
+        if (duckdb_prepare(conn,
+                           "INSERT INTO request_counts (fingerprint, matched_pattern, bucket, "
+                           "ip, user_agent, url, hits, first_seen, last_seen) "
+                           "VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9) "
+                           "ON CONFLICT (fingerprint, matched_pattern, bucket) DO UPDATE SET "
+                           "hits = hits + excluded.hits, "
+                           "last_seen = greatest(last_seen, excluded.last_seen);",
+                           &stmt) != DuckDBSuccess)
+        {
+            duckdb_destroy_prepare(&stmt);
+            duckdb_disconnect(&conn);
+            duckdb_close(&db);
+            return NGX_ERROR;
+        }
+
+        mcf->log_queue->stmt = stmt;
     }
-    mcf->db = sqlite_db;
 
+    mcf->db = db;
+    mcf->log_queue->conn = conn;
+
+#else
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
     char *err_msg = NULL;
-    char *sql = "CREATE TABLE IF NOT EXISTS requests ("
+    int busy_timeout;
+
+    /*
+     * WAL lets the workers append to the same file without blocking
+     * readers, and with synchronous=NORMAL a commit does not wait for
+     * fsync; a crash can lose the last batches but not corrupt the file.
+     */
+    char *sql = "PRAGMA journal_mode=WAL;"
+                "PRAGMA synchronous=NORMAL;"
+                "CREATE TABLE IF NOT EXISTS requests ("
                 "id INTEGER PRIMARY KEY AUTOINCREMENT,"
                 "timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
                 "ip TEXT,"
@@ -510,524 +1307,2624 @@ ngx_http_robonope_init_db(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *db_path
                 "matched_pattern TEXT"
                 ");";
 
-    if (sqlite3_exec(mcf->db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+    // "robonope_log_format aggregate": one row per fingerprint, pattern and bucket
+    char *counts_sql = "CREATE TABLE IF NOT EXISTS request_counts ("
+                       "fingerprint TEXT NOT NULL,"
+                       "matched_pattern TEXT NOT NULL,"
+                       "bucket DATETIME NOT NULL,"
+                       "ip TEXT,"
+                       "user_agent TEXT,"
+                       "url TEXT,"
+                       "hits INTEGER NOT NULL,"
+                       "first_seen DATETIME,"
+                       "last_seen DATETIME,"
+                       "PRIMARY KEY (fingerprint, matched_pattern, bucket)"
+                       ");";
+
+    // Only the log writer uses the connection, one batch at a time
+    if (sqlite3_open_v2((char *) db_path->data, &db,
+                        SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_NOMUTEX,
+                        NULL) != SQLITE_OK)
+    {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "robonope failed to open \"%V\": %s",
+                      db_path, db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        return NGX_ERROR;
+    }
+
+    /*
+     * Wait for another worker's commit instead of failing the batch.  On
+     * the thread pool waiting is cheap, on the event loop it stalls the
+     * worker, so the wait is short there.
+     */
+    busy_timeout = NGX_HTTP_ROBONOPE_DB_BUSY_TIMEOUT_LOOP;
+#if (NGX_THREADS)
+    if (mcf->log_queue->thread_pool != NULL) {
+        busy_timeout = NGX_HTTP_ROBONOPE_DB_BUSY_TIMEOUT;
+    }
+#endif
+    sqlite3_busy_timeout(db, busy_timeout);
+
+    if (sqlite3_exec(db, sql, NULL, NULL, &err_msg) != SQLITE_OK
+        || (mcf->log_queue->aggregate
+            && sqlite3_exec(db, counts_sql, NULL, NULL, &err_msg) != SQLITE_OK))
+    {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "robonope failed to set up \"%V\": %s",
+                      db_path, err_msg ? err_msg : "unknown error");
         sqlite3_free(err_msg);
+        sqlite3_close(db);
+        return NGX_ERROR;
+    }
+
+    // Prepared once, reset and rebound for every row the worker logs
+    if (sqlite3_prepare_v2(db,
+                           mcf->log_queue->aggregate
+                           ? "INSERT INTO request_counts (fingerprint, matched_pattern, bucket, "
+                             "ip, user_agent, url, hits, first_seen, last_seen) "
+                             "VALUES (?, ?, datetime(?, 'unixepoch'), ?, ?, ?, ?, "
+                             "datetime(?, 'unixepoch'), datetime(?, 'unixepoch')) "
+                             "ON CONFLICT (fingerprint, matched_pattern, bucket) DO UPDATE SET "
+                             "hits = hits + excluded.hits, "
+                             "last_seen = max(last_seen, excluded.last_seen);"
+                           : "INSERT INTO requests (timestamp, ip, user_agent, url, matched_pattern) "
+                             "VALUES (strftime('%Y-%m-%d %H:%M:%f', ?, 'unixepoch'), ?, ?, ?, ?);",
+                           -1, &stmt, NULL) != SQLITE_OK)
+    {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "robonope failed to prepare the insert into \"%V\": %s",
+                      db_path, sqlite3_errmsg(db));
+        sqlite3_close(db);
         return NGX_ERROR;
     }
+
+    mcf->db = db;
+    mcf->log_queue->stmt = stmt;
 #endif
 
     return NGX_OK;
 }
 
-static u_char *
-ngx_http_robonope_generate_random_text(ngx_pool_t *pool, ngx_uint_t words)
+/*
+ * Make rs the rule set this process matches with, along with everything
+ * derived from it: the matcher scratch, the maze link size and the content
+ * key.  Called once at configuration time, and by a worker whenever it sees
+ * newer rules published in the rules zone.
+ */
+static ngx_int_t
+ngx_http_robonope_set_rules(ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ruleset_t *rs, ngx_pool_t *pool)
 {
-    static const char *subjects[] = {
-        "the system", "our network", "the server", "this page", "the website",
-        "the database", "the service", "the platform", "the application", "the interface"
-    };
-    
-    static const char *verbs[] = {
-        "processes", "manages", "handles", "analyzes", "monitors",
-        "validates", "updates", "maintains", "controls", "optimizes"
-    };
-    
-    static const char *objects[] = {
-        "data requests", "user sessions", "network traffic", "system resources",
-        "security protocols", "access permissions", "configuration settings",
-        "database connections", "cache entries", "service endpoints"
-    };
-    
-    static const char *adjectives[] = {
-        "secure", "efficient", "reliable", "dynamic", "automated",
-        "integrated", "optimized", "scalable", "robust", "advanced"
-    };
-    
-    static const char *adverbs[] = {
-        "automatically", "efficiently", "securely", "dynamically", "continuously",
-        "reliably", "seamlessly", "actively", "intelligently", "effectively"
-    };
-    
-    static const char *conjunctions[] = {
-        "while", "and", "as", "because", "although",
-        "however", "therefore", "moreover", "furthermore", "additionally"
-    };
-
-    static const size_t num_subjects = sizeof(subjects) / sizeof(subjects[0]);
-    static const size_t num_verbs = sizeof(verbs) / sizeof(verbs[0]);
-    static const size_t num_objects = sizeof(objects) / sizeof(objects[0]);
-    static const size_t num_adjectives = sizeof(adjectives) / sizeof(adjectives[0]);
-    static const size_t num_adverbs = sizeof(adverbs) / sizeof(adverbs[0]);
-    static const size_t num_conjunctions = sizeof(conjunctions) / sizeof(conjunctions[0]);
-
-    size_t total_len = words * 20; // Average word length + space + punctuation
-    u_char *content, *p;
-    ngx_uint_t i, sentences;
-    
-    content = ngx_pcalloc(pool, total_len + 1);
-    if (content == NULL) {
-        return NULL;
-    }
-    
-    p = content;
-    sentences = words / 10 + 1; // Create a new sentence every ~10 words
-    
-    for (i = 0; i < sentences; i++) {
-        // Basic sentence patterns
-        switch (ngx_random() % 3) {
-            case 0: // Pattern: Subject + Verb + Object
-                p = ngx_sprintf(p, "%s %s %s. ",
-                    subjects[ngx_random() % num_subjects],
-                    verbs[ngx_random() % num_verbs],
-                    objects[ngx_random() % num_objects]);
-                break;
-                
-            case 1: // Pattern: Subject + Adverb + Verb + Adjective + Object
-                p = ngx_sprintf(p, "%s %s %s %s %s. ",
-                    subjects[ngx_random() % num_subjects],
-                    adverbs[ngx_random() % num_adverbs],
-                    verbs[ngx_random() % num_verbs],
-                    adjectives[ngx_random() % num_adjectives],
-                    objects[ngx_random() % num_objects]);
-                break;
-                
-            case 2: // Pattern: Conjunction + Subject + Verb + Object
-                p = ngx_sprintf(p, "%s %s %s %s. ",
-                    conjunctions[ngx_random() % num_conjunctions],
-                    subjects[ngx_random() % num_subjects],
-                    verbs[ngx_random() % num_verbs],
-                    objects[ngx_random() % num_objects]);
-                break;
-        }
-    }
-    
-    return content;
-}
+    ngx_http_robonope_segment_t *seg;
+    ngx_http_robonope_rule_t *rule;
+    ngx_uint_t i;
+    size_t size;
 
-static ngx_str_t *
-ngx_http_robonope_generate_honeypot_link(ngx_pool_t *pool, ngx_str_t *base_url, ngx_array_t *disallow_patterns, ngx_http_robonope_loc_conf_t *lcf)
-{
-    ngx_str_t *link;
-    u_char *p;
-    size_t len;
-    ngx_str_t *patterns;
-    ngx_uint_t pattern_index;
-    
-    // Check if we should use the instructions URL for the honeypot link
-    if (lcf != NULL && lcf->instructions_url.data != NULL && lcf->instructions_url.len > 0) {
-        // Use the configured instructions URL as the honeypot link
-        len = lcf->instructions_url.len;
-        
-        link = ngx_palloc(pool, sizeof(ngx_str_t));
-        if (link == NULL) {
-            return NULL;
-        }
-        
-        p = ngx_palloc(pool, len + 1);
-        if (p == NULL) {
-            return NULL;
+    // Scratch only grows, it is rarely worth freeing
+    size = ngx_http_robonope_match_scratch_size(rs);
+
+    if (mcf->match_scratch == NULL || size > mcf->match_scratch_size) {
+        mcf->match_scratch = ngx_palloc(pool, size);
+        if (mcf->match_scratch == NULL) {
+            return NGX_ERROR;
         }
-        
-        link->data = p;
-        p = ngx_cpymem(p, lcf->instructions_url.data, len);
-        *p = '\0';
-        link->len = len;
-        
-        return link;
+
+        mcf->match_scratch_size = size;
     }
-    
-    if (disallow_patterns == NULL || disallow_patterns->nelts == 0) {
-        // Fallback to default honeypot link if no disallow patterns are available
-        len = sizeof("/admin/index.html") - 1;
-        
-        link = ngx_palloc(pool, sizeof(ngx_str_t));
-        if (link == NULL) {
-            return NULL;
-        }
-        
-        p = ngx_palloc(pool, len + 1);
-        if (p == NULL) {
-            return NULL;
+
+    // Maze links go under Disallow prefixes, sized once for the longest
+    mcf->maze_prefix = sizeof("/admin") - 1;
+    rule = ngx_http_robonope_ruleset_rules(rs);
+
+    for (i = 0; i < rs->nrules; i++) {
+        if (!rule[i].allow) {
+            mcf->maze_prefix = ngx_max(mcf->maze_prefix, ngx_http_robonope_rule_prefix(rs, &rule[i]));
         }
-        
-        link->data = p;
-        p = ngx_cpymem(p, "/admin/index.html", len);
-        *p = '\0';
-        link->len = len;
-        
-        return link;
     }
-    
-    // Select a random pattern from the disallow list
-    patterns = disallow_patterns->elts;
-    pattern_index = ngx_random() % disallow_patterns->nelts;
-    
-    // Create a link based on the selected pattern
-    len = patterns[pattern_index].len;
-    
-    // Add some randomness to the path
-    static const char *extensions[] = {
-        "index.html", "login.php", "data.json", "config.xml", "settings.html"
-    };
-    static const size_t num_extensions = sizeof(extensions) / sizeof(extensions[0]);
-    const char *extension = extensions[ngx_random() % num_extensions];
-    size_t ext_len = ngx_strlen(extension);
-    
-    link = ngx_palloc(pool, sizeof(ngx_str_t));
-    if (link == NULL) {
-        return NULL;
+
+    /*
+     * Key for deterministic pages, from what the page depends on for every
+     * location: the rules, the template and the Markov model.  Settings of
+     * the location are added by ngx_http_robonope_serve_deterministic().
+     * The rules are hashed field by field, the block has uninitialized
+     * padding.
+     */
+    ngx_md5_init(&mcf->content_key);
+    ngx_md5_update(&mcf->content_key, mcf->secret.data, mcf->secret.len);
+
+    for (i = 0; i < rs->nrules; i++) {
+        ngx_md5_update(&mcf->content_key, &rule[i].allow, sizeof(u_char));
+        ngx_md5_update(&mcf->content_key, &rule[i].len, sizeof(uint32_t));
+        ngx_md5_update(&mcf->content_key, ngx_http_robonope_rule_pattern(rs, &rule[i]), rule[i].len);
     }
-    
-    // Allocate memory for pattern + "/" + extension + null terminator
-    p = ngx_palloc(pool, len + 1 + ext_len + 1);
-    if (p == NULL) {
-        return NULL;
+
+    seg = mcf->template->elts;
+    for (i = 0; i < mcf->template->nelts; i++) {
+        ngx_md5_update(&mcf->content_key, &seg[i].type, sizeof(ngx_uint_t));
+        ngx_md5_update(&mcf->content_key, seg[i].text.data, seg[i].text.len);
     }
-    
-    link->data = p;
-    
-    // Copy pattern
-    p = ngx_cpymem(p, patterns[pattern_index].data, patterns[pattern_index].len);
-    
-    // Add slash if the pattern doesn't end with one
-    if (p > link->data && *(p-1) != '/') {
-        *p++ = '/';
+
+    if (mcf->markov) {
+        ngx_md5_update(&mcf->content_key, mcf->markov, mcf->markov->size);
     }
-    
-    // Add random extension
-    p = ngx_cpymem(p, extension, ext_len);
-    
-    *p = '\0';
-    link->len = p - link->data;
-    
-    return link;
-}
 
-ngx_int_t 
-ngx_http_robonope_init_cache(ngx_http_robonope_main_conf_t *mcf)
-{
-    // Implementation of ngx_http_robonope_init_cache function
-    return NGX_OK; // Placeholder return, actual implementation needed
+    mcf->rules = rs;
+
+    return NGX_OK;
 }
 
-ngx_int_t 
-ngx_http_robonope_cache_lookup(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint)
+/*
+ * Hot reload of robots.txt.  Every worker checks the file's mtime and size
+ * on a timer.  The first to see a change compiles the new rules, copies the
+ * rule set into the rules zone and publishes it by swapping the current
+ * pointer; the zone mutex only keeps two workers from doing so at once.
+ * Workers switch to the new set at their next request, requests already
+ * matching finish on the old one, and old sets are freed after a grace
+ * period.
+ */
+static ngx_int_t
+ngx_http_robonope_init_rules_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path, ngx_msec_t interval)
 {
-    // Implementation of ngx_http_robonope_cache_lookup function
-    return NGX_OK; // Placeholder return, actual implementation needed
+    ngx_http_robonope_rules_zone_t *rz;
+    ngx_shm_zone_t *shm_zone;
+    ngx_str_t name = ngx_string("robonope_rules");
+    ngx_file_info_t fi;
+    size_t size;
+
+    rz = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_rules_zone_t));
+    if (rz == NULL) {
+        return NGX_ERROR;
+    }
+
+    rz->path = *path;
+    rz->interval = interval;
+
+    // A missing file counts as changed once it appears
+    if (ngx_file_info(path->data, &fi) != NGX_FILE_ERROR) {
+        rz->mtime = ngx_file_mtime(&fi);
+        rz->size = ngx_file_size(&fi);
+    }
+
+    // Room for the current and the retired rule sets, with space to grow
+    size = 8 * ngx_pagesize
+           + (NGX_HTTP_ROBONOPE_RULES_RETIRED + 2) * ngx_max(mcf->rules->size, 65536);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_robonope_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_robonope_init_rules_shm_zone;
+    shm_zone->data = rz;
+
+    mcf->rules_zone = rz;
+
+    return NGX_OK;
 }
 
-void 
-ngx_http_robonope_cache_insert(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint)
+static ngx_int_t
+ngx_http_robonope_init_rules_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
-    // Implementation of ngx_http_robonope_cache_insert function
+    ngx_http_robonope_rules_zone_t *orz = data;
+    ngx_http_robonope_rules_zone_t *rz = shm_zone->data;
+
+    if (orz != NULL) {
+        rz->sh = orz->sh;
+        rz->shpool = orz->shpool;
+
+        /*
+         * The new configuration has just compiled robots.txt itself, so
+         * its workers ignore rules published before the reload.  Those stay
+         * current for the workers of the old configuration, which may still
+         * be matching with them, and are retired by the next reload.
+         */
+        ngx_shmtx_lock(&rz->shpool->mutex);
+
+        rz->generation = rz->sh->generation;
+        rz->sh->mtime = rz->mtime;
+        rz->sh->size = rz->size;
+
+        ngx_shmtx_unlock(&rz->shpool->mutex);
+
+        return NGX_OK;
+    }
+
+    rz->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        rz->sh = rz->shpool->data;
+        rz->generation = rz->sh->generation;
+        return NGX_OK;
+    }
+
+    rz->sh = ngx_slab_alloc(rz->shpool, sizeof(ngx_http_robonope_rules_sh_t));
+    if (rz->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(rz->sh, sizeof(ngx_http_robonope_rules_sh_t));
+
+    rz->shpool->data = rz->sh;
+
+    rz->sh->mtime = rz->mtime;
+    rz->sh->size = rz->size;
+
+    rz->shpool->log_nomem = 0;
+
+    return NGX_OK;
 }
 
-static void ngx_http_robonope_cache_cleanup(ngx_http_robonope_main_conf_t *mcf)
+static void
+ngx_http_robonope_rules_check_handler(ngx_event_t *ev)
 {
-    // Implementation of ngx_http_robonope_cache_cleanup function
+    ngx_http_robonope_main_conf_t *mcf = ev->data;
+    ngx_http_robonope_rules_zone_t *rz;
+    ngx_file_info_t fi;
+
+    rz = mcf->rules_zone;
+
+    // Unlocked peek, ngx_http_robonope_reload_rules() checks again
+    if (ngx_file_info(rz->path.data, &fi) != NGX_FILE_ERROR
+        && (ngx_file_mtime(&fi) != rz->sh->mtime || ngx_file_size(&fi) != rz->sh->size))
+    {
+        ngx_http_robonope_reload_rules(mcf, &fi, ev->log);
+    }
+
+    ngx_add_timer(ev, rz->interval);
 }
 
-static void ngx_http_robonope_cleanup_db(void *data)
+static void
+ngx_http_robonope_reload_rules(ngx_http_robonope_main_conf_t *mcf, ngx_file_info_t *fi, ngx_log_t *log)
 {
-    // Implementation of ngx_http_robonope_cleanup_db function
-}
+    ngx_http_robonope_rules_zone_t *rz;
+    ngx_http_robonope_ruleset_t *rs, *shared;
+    ngx_array_t *entries;
+    ngx_pool_t *pool;
 
-/* Helper function to convert char* to ngx_str_t */
-static ngx_str_t *
-ngx_http_robonope_str_create(ngx_pool_t *pool, const char *src) __attribute__((unused));
+    rz = mcf->rules_zone;
 
-static ngx_str_t *
-ngx_http_robonope_str_create(ngx_pool_t *pool, const char *src)
-{
-    ngx_str_t *dst;
-    size_t len;
-    
-    dst = ngx_palloc(pool, sizeof(ngx_str_t));
-    if (dst == NULL) {
-        return NULL;
+    // Another worker is already at it
+    if (!ngx_shmtx_trylock(&rz->shpool->mutex)) {
+        return;
     }
-    
-    len = ngx_strlen(src);
-    dst->len = len;
-    dst->data = ngx_pcalloc(pool, len + 1);
-    if (dst->data == NULL) {
-        return NULL;
+
+    if (rz->sh->mtime == ngx_file_mtime(fi) && rz->sh->size == ngx_file_size(fi)) {
+        goto unlock;
     }
-    
-    ngx_memcpy(dst->data, src, len);
-    
-    return dst;
+
+    pool = ngx_create_pool(4096, log);
+    if (pool == NULL) {
+        goto unlock;
+    }
+
+    entries = ngx_array_create(pool, 10, sizeof(ngx_http_robonope_robot_entry_t));
+    if (entries == NULL) {
+        goto done;
+    }
+
+    if (ngx_http_robonope_read_robots(pool, entries, &rz->path) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      "failed to reload robots.txt \"%V\"", &rz->path);
+        goto done;
+    }
+
+    rs = ngx_http_robonope_compile_rules(pool, entries);
+    if (rs == NULL) {
+        goto done;
+    }
+
+    shared = ngx_slab_alloc_locked(rz->shpool, rs->size);
+    if (shared == NULL) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "not enough room in robonope_rules to reload \"%V\"", &rz->path);
+        goto done;
+    }
+
+    if (ngx_http_robonope_retire_rules(rz) != NGX_OK) {
+        ngx_slab_free_locked(rz->shpool, shared);
+        goto done; // Old rules still in use, retry on the next check
+    }
+
+    // The set is relocatable, so a plain copy is ready to match with
+    ngx_memcpy(shared, rs, rs->size);
+
+    ngx_memory_barrier();
+
+    rz->sh->current = shared;
+    rz->sh->mtime = ngx_file_mtime(fi);
+    rz->sh->size = ngx_file_size(fi);
+
+    (void) ngx_atomic_fetch_add(&rz->sh->generation, 1);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "robots.txt \"%V\" reloaded, %uD rules, generation %uA",
+                  &rz->path, rs->nrules, rz->sh->generation);
+
+done:
+
+    ngx_destroy_pool(pool);
+
+unlock:
+
+    ngx_shmtx_unlock(&rz->shpool->mutex);
 }
 
+/*
+ * Move the current rules to a retired slot, freeing the retired sets past
+ * their grace period first.  Without a free slot nothing changes, a set is
+ * never freed while a worker may still be matching with it.  Called with
+ * the zone mutex held.
+ */
 static ngx_int_t
-ngx_http_robonope_send_response(ngx_http_request_t *r, u_char *content)
+ngx_http_robonope_retire_rules(ngx_http_robonope_rules_zone_t *rz)
 {
-    ngx_buf_t *b;
-    ngx_chain_t out;
-    
-    // Set response headers
-    r->headers_out.content_type.len = sizeof("text/html") - 1;
-    r->headers_out.content_type.data = (u_char *) "text/html";
-    r->headers_out.status = NGX_HTTP_OK;
-    
-    // Allocate response buffer
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    ngx_http_robonope_rules_sh_t *sh = rz->sh;
+    ngx_uint_t i, slot;
+    time_t now;
+
+    now = ngx_time();
+    slot = NGX_HTTP_ROBONOPE_RULES_RETIRED;
+
+    for (i = 0; i < NGX_HTTP_ROBONOPE_RULES_RETIRED; i++) {
+        if (sh->retired[i] != NULL && now - sh->retired_at[i] >= NGX_HTTP_ROBONOPE_RULES_GRACE) {
+            ngx_slab_free_locked(rz->shpool, sh->retired[i]);
+            sh->retired[i] = NULL;
+        }
+
+        if (sh->retired[i] == NULL) {
+            slot = i;
+        }
     }
-    
-    b->pos = content;
-    b->last = content + ngx_strlen(content);
-    b->memory = 1;
-    b->last_buf = 1;
-    
-    out.buf = b;
-    out.next = NULL;
-    
-    r->headers_out.content_length_n = b->last - b->pos;
-    ngx_http_send_header(r);
-    
-    return ngx_http_output_filter(r, &out);
+
+    if (sh->current == NULL) {
+        return NGX_OK;
+    }
+
+    if (slot == NGX_HTTP_ROBONOPE_RULES_RETIRED) {
+        return NGX_DECLINED;
+    }
+
+    sh->retired[slot] = sh->current;
+    sh->retired_at[slot] = now;
+    sh->current = NULL;
+
+    return NGX_OK;
 }
 
-/* Helper function to generate a random CSS class name */
-static u_char *
-ngx_http_robonope_generate_class_name(ngx_pool_t *pool)
+/*
+ * Switch this worker to the latest published rules.  Reading the pointer is
+ * the only synchronization: a rule set never changes once published, and a
+ * replaced one is kept long enough for any request still matching with it.
+ */
+static ngx_int_t
+ngx_http_robonope_sync_rules(ngx_http_robonope_main_conf_t *mcf)
 {
-    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    static const size_t charset_size = sizeof(charset) - 1;
-    static const size_t class_length = 12; // Random length between 8-16 chars
-    
-    u_char *class_name = ngx_pcalloc(pool, class_length + 1);
-    if (class_name == NULL) {
-        return NULL;
+    ngx_http_robonope_rules_zone_t *rz;
+    ngx_http_robonope_ruleset_t *rs;
+
+    rz = mcf->rules_zone;
+    if (rz == NULL) {
+        return NGX_OK;
     }
-    
-    // First character must be a letter
-    class_name[0] = charset[ngx_random() % 52];
-    
-    // Rest can be any character from charset
-    for (size_t i = 1; i < class_length; i++) {
-        class_name[i] = charset[ngx_random() % charset_size];
+
+    // Rules published before this configuration are older than its own
+    if (rz->sh->generation == rz->generation) {
+        return NGX_OK;
     }
-    
-    return class_name;
+
+    ngx_memory_barrier();
+
+    rs = rz->sh->current;
+
+    if (rs == NULL || rs == mcf->rules) {
+        return NGX_OK;
+    }
+
+    return ngx_http_robonope_set_rules(mcf, rs, ngx_cycle->pool);
 }
 
-static ngx_int_t
-ngx_http_robonope_serve_honeypot(ngx_http_request_t *r, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link)
+ngx_int_t 
+ngx_http_robonope_init_cache(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf)
 {
-    u_char *content, *body;
-    u_char *random_class;
-    size_t total_len;
+    ngx_http_robonope_loc_conf_t *lcf;
+    ngx_http_robonope_cache_t *cache;
+    ngx_shm_zone_t *shm_zone;
+    ngx_str_t name = ngx_string("robonope_cache");
+    ngx_uint_t max;
+    size_t size;
 
-    // Generate random class name
-    random_class = ngx_http_robonope_generate_class_name(r->pool);
-    if (random_class == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    lcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_robonope_module);
+
+    max = lcf->max_cache_entries;
+    if (max == NGX_CONF_UNSET_UINT) {
+        max = NGX_HTTP_ROBONOPE_MAX_CACHE;
     }
 
-    // Generate body content - always use random text
-    body = ngx_http_robonope_generate_random_text(r->pool, 50);
-    if (body == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (max == 0) {
+        return NGX_OK; // Cache disabled
     }
 
-    // Calculate total length needed
-    total_len = ngx_strlen(body) + honeypot_link->len + 500; // Extra space for HTML structure
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
 
-    content = ngx_pcalloc(r->pool, total_len);
-    if (content == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    cache->max = max;
+    cache->ttl = (lcf->cache_ttl == NGX_CONF_UNSET_UINT) ? 3600 : (time_t) lcf->cache_ttl;
+
+    /*
+     * The zone is sized for the entry cap: slab allocations are rounded up
+     * to a power of two, so twice the node size per entry, plus a few pages
+     * for the slab pool itself.
+     */
+    size = 8 * ngx_pagesize + max * 2 * sizeof(ngx_http_robonope_cache_node_t);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_robonope_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
     }
 
-    // Construct the full HTML
-    ngx_sprintf(content,
-        "<html>\n"
-        "<head>\n"
-        "<style>\n"
-        ".%s { opacity: 0; position: absolute; top: -9999px; }\n"
-        "</style>\n"
-        "</head>\n"
-        "<body>\n"
-        "<div class=\"content\">\n"
-        "%s\n"
-        "</div>\n"
-        "<a href=\"%s\" class=\"%s\">Important Information</a>\n"
-        "</body>\n"
-        "</html>",
-        random_class,
-        body,
-        honeypot_link->data,
-        random_class);
+    shm_zone->init = ngx_http_robonope_init_cache_zone;
+    shm_zone->data = cache;
 
-    // Send the response
-    return ngx_http_robonope_send_response(r, content);
+    mcf->cache = cache;
+
+    return NGX_OK;
 }
 
 static ngx_int_t
-ngx_http_robonope_load_robots_and_db(ngx_http_request_t *r, ngx_http_robonope_loc_conf_t *lcf, 
-                                    ngx_str_t **robots_content, ngx_array_t **disallow_patterns)
+ngx_http_robonope_init_cache_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
-    ngx_http_robonope_main_conf_t *mcf;
-    
-    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
-    if (mcf == NULL) {
-        return NGX_ERROR;
-    }
-    
-    // Initialize robots.txt if not already done
-    if (mcf->robot_entries->nelts == 0) {
-        if (ngx_http_robonope_load_robots(mcf, &lcf->robots_path) != NGX_OK) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "failed to load robots.txt");
-            return NGX_ERROR;
-        }
+    ngx_http_robonope_cache_t *ocache = data;
+    ngx_http_robonope_cache_t *cache = shm_zone->data;
+
+    // Keep the offenders seen before a reload
+    if (ocache != NULL) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
     }
-    
-    // Initialize database if not already done and db_path is set
-    if (mcf->db == NULL && lcf->db_path.data != NULL && lcf->db_path.len > 0) {
-        if (ngx_http_robonope_init_db(mcf, &lcf->db_path) != NGX_OK) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "failed to initialize database");
-            // Continue even if database initialization fails
-            // This allows the module to function without logging
-        }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        return NGX_OK;
     }
-    
-    // Create a combined array of all disallow patterns
-    *disallow_patterns = ngx_array_create(r->pool, 10, sizeof(ngx_str_t));
-    if (*disallow_patterns == NULL) {
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_robonope_cache_sh_t));
+    if (cache->sh == NULL) {
         return NGX_ERROR;
     }
-    
-    // Collect all disallow patterns from all user-agent entries
-    for (ngx_uint_t i = 0; i < mcf->robot_entries->nelts; i++) {
-        ngx_http_robonope_robot_entry_t *entry = &((ngx_http_robonope_robot_entry_t *)mcf->robot_entries->elts)[i];
-        
-        if (entry->disallow == NULL || entry->disallow->nelts == 0) {
-            continue;
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_robonope_cache_insert_value);
+    ngx_queue_init(&cache->sh->lru);
+    cache->sh->nentries = 0;
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_robonope_cache_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t **p;
+    ngx_http_robonope_cache_node_t *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else {
+            cn = (ngx_http_robonope_cache_node_t *) node;
+            cnt = (ngx_http_robonope_cache_node_t *) temp;
+
+            p = (ngx_memcmp(cn->fingerprint, cnt->fingerprint, 16) < 0)
+                ? &temp->left : &temp->right;
         }
-        
-        ngx_str_t *patterns = entry->disallow->elts;
-        for (ngx_uint_t j = 0; j < entry->disallow->nelts; j++) {
-            ngx_str_t *pattern = ngx_array_push(*disallow_patterns);
-            if (pattern == NULL) {
-                return NGX_ERROR;
-            }
-            
-            pattern->len = patterns[j].len;
-            pattern->data = patterns[j].data;
+
+        if (*p == sentinel) {
+            break;
         }
+
+        temp = *p;
     }
-    
-    return NGX_OK;
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
-static ngx_int_t
-ngx_http_robonope_is_disallowed(ngx_http_request_t *r, ngx_array_t *disallow_patterns)
+/* Find a fingerprint, the zone must be locked */
+static ngx_http_robonope_cache_node_t *
+ngx_http_robonope_cache_find(ngx_http_robonope_cache_t *cache, u_char *fingerprint)
 {
-    ngx_str_t *patterns;
-    ngx_str_t matched_pattern;
-    ngx_http_robonope_main_conf_t *mcf;
-    ngx_http_robonope_loc_conf_t *lcf;
-    ngx_md5_t md5;
-    u_char fingerprint[16];
-    
-    if (disallow_patterns == NULL || disallow_patterns->nelts == 0) {
-        return 0; // Not disallowed if no patterns
-    }
-    
-    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
-    lcf = ngx_http_get_module_loc_conf(r, ngx_http_robonope_module);
-    if (mcf == NULL || lcf == NULL) {
-        return 0;
-    }
-    
-    patterns = disallow_patterns->elts;
-    
-    // Check each disallow pattern
-    for (ngx_uint_t i = 0; i < disallow_patterns->nelts; i++) {
-        if (ngx_strncmp(r->uri.data, patterns[i].data, patterns[i].len) == 0) {
-            matched_pattern = patterns[i];
-            
-            // Generate MD5 fingerprint of client IP and user agent
-            ngx_md5_init(&md5);
-            ngx_md5_update(&md5, r->connection->addr_text.data, r->connection->addr_text.len);
-            
-            if (r->headers_in.user_agent != NULL) {
-                ngx_md5_update(&md5, r->headers_in.user_agent->value.data, r->headers_in.user_agent->value.len);
-            }
-            
-            ngx_md5_final(fingerprint, &md5);
-            
-            // Log request only if database path is set
-            if (lcf->db_path.data != NULL && lcf->db_path.len > 0 && mcf->db != NULL) {
-                ngx_http_robonope_log_request(
-                    mcf->db,
-                    r,
-                    &matched_pattern
-                );
-            }
-            
-            // Add client to cache if not already there
-            if (ngx_http_robonope_cache_lookup(mcf, fingerprint) != NGX_OK) {
-                ngx_http_robonope_cache_insert(mcf, fingerprint);
-            }
-            
-            return 1; // URL is disallowed
+    ngx_rbtree_node_t *node, *sentinel;
+    ngx_http_robonope_cache_node_t *cn;
+    ngx_rbtree_key_t key;
+    ngx_int_t rc;
+    uint32_t hash;
+
+    // MD5 output is uniform, its first bytes make a good tree key
+    ngx_memcpy(&hash, fingerprint, sizeof(uint32_t));
+    key = hash;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        cn = (ngx_http_robonope_cache_node_t *) node;
+
+        rc = ngx_memcmp(fingerprint, cn->fingerprint, 16);
+        if (rc == 0) {
+            return cn;
         }
+
+        node = (rc < 0) ? node->left : node->right;
     }
-    
-    return 0; // URL is not disallowed
+
+    return NULL;
 }
 
-static ngx_int_t
-ngx_http_robonope_log_request(
-#ifdef ROBONOPE_USE_DUCKDB
-    duckdb_connection conn,
-#else
-    sqlite3 *db,
-#endif
-    ngx_http_request_t *r,
-    ngx_str_t *matched_pattern)
+/* Remove an entry, the zone must be locked */
+static void
+ngx_http_robonope_cache_delete(ngx_http_robonope_cache_t *cache, ngx_http_robonope_cache_node_t *cn)
 {
-    ngx_str_t ip;
-    ip.data = r->connection->addr_text.data;
-    ip.len = r->connection->addr_text.len;
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+    ngx_slab_free_locked(cache->shpool, cn);
+    cache->sh->nentries--;
+}
 
-#ifdef ROBONOPE_USE_DUCKDB
-    char *sql = ngx_sprintf("INSERT INTO requests (ip, user_agent, url, matched_pattern) "
-                           "VALUES ('%s', '%s', '%s', '%s');",
-                           ip.data,
-                           r->headers_in.user_agent->value.data,
-                           r->uri.data,
-                           matched_pattern->data);
+/*
+ * Check whether a fingerprint is a known offender.  Returns NGX_OK for a
+ * live entry and NGX_DECLINED otherwise; a stale entry is removed here.
+ */
+ngx_int_t 
+ngx_http_robonope_cache_lookup(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint)
+{
+    ngx_http_robonope_cache_t *cache = mcf->cache;
+    ngx_http_robonope_cache_node_t *cn;
+    ngx_int_t rc = NGX_DECLINED;
 
-    duckdb_state state;
-    state = duckdb_query(conn, sql, NULL);
-    if (state != DuckDBSuccess) {
-        return NGX_ERROR;
+    if (cache == NULL || cache->sh == NULL) {
+        return NGX_DECLINED;
     }
 
-#else
-    char *sql;
-    char *err_msg = NULL;
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    sql = sqlite3_mprintf("INSERT INTO requests (ip, user_agent, url, matched_pattern) "
-                         "VALUES ('%q', '%q', '%q', '%q');",
-                         ip.data,
-                         r->headers_in.user_agent->value.data,
-                         r->uri.data,
-                         matched_pattern->data);
+    cn = ngx_http_robonope_cache_find(cache, fingerprint);
+    if (cn != NULL) {
+        if (cn->expire <= ngx_time()) {
+            ngx_http_robonope_cache_delete(cache, cn);
 
-    if (sqlite3_exec(db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
-        return NGX_ERROR;
+        } else {
+            ngx_queue_remove(&cn->queue);
+            ngx_queue_insert_head(&cache->sh->lru, &cn->queue);
+            rc = NGX_OK;
+        }
     }
 
-    sqlite3_free(sql);
-#endif
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    return NGX_OK;
-} 
\ No newline at end of file
+    return rc;
+}
+
+/*
+ * Record a fingerprint as an offender for cache_ttl seconds.  When the
+ * cache is full the least recently used entry makes room.
+ */
+void 
+ngx_http_robonope_cache_insert(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint)
+{
+    ngx_http_robonope_cache_t *cache = mcf->cache;
+    ngx_http_robonope_cache_node_t *cn;
+    ngx_queue_t *q;
+    uint32_t hash;
+
+    if (cache == NULL || cache->sh == NULL) {
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_http_robonope_cache_find(cache, fingerprint);
+    if (cn != NULL) {
+        // Another worker got here first
+        cn->expire = ngx_time() + cache->ttl;
+        ngx_queue_remove(&cn->queue);
+        ngx_queue_insert_head(&cache->sh->lru, &cn->queue);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    ngx_http_robonope_cache_cleanup(mcf);
+
+    cn = ngx_slab_alloc_locked(cache->shpool, sizeof(ngx_http_robonope_cache_node_t));
+    if (cn == NULL && !ngx_queue_empty(&cache->sh->lru)) {
+        // Out of zone memory, give up the least recently used entry
+        q = ngx_queue_last(&cache->sh->lru);
+        ngx_http_robonope_cache_delete(cache, ngx_queue_data(q, ngx_http_robonope_cache_node_t, queue));
+        cn = ngx_slab_alloc_locked(cache->shpool, sizeof(ngx_http_robonope_cache_node_t));
+    }
+
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    ngx_memcpy(cn->fingerprint, fingerprint, 16);
+    ngx_memcpy(&hash, fingerprint, sizeof(uint32_t));
+    cn->node.key = hash;
+    cn->expire = ngx_time() + cache->ttl;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->sh->lru, &cn->queue);
+    cache->sh->nentries++;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+static ngx_int_t
+ngx_http_robonope_init_crawl_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, size_t size)
+{
+    ngx_http_robonope_crawl_zone_t *cz;
+    ngx_shm_zone_t *shm_zone;
+    ngx_str_t name = ngx_string("robonope_crawl_delay");
+    ngx_uint_t n;
+
+    if (size < ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "robonope_crawl_delay_zone \"%uz\" is too small", size);
+        return NGX_ERROR;
+    }
+
+    cz = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_crawl_zone_t));
+    if (cz == NULL) {
+        return NGX_ERROR;
+    }
+
+    // A power of two slots, so the fingerprint picks one with a mask
+    for (n = 1; n * 2 * sizeof(ngx_atomic_t) <= size; n <<= 1) {
+        /* void */
+    }
+
+    cz->mask = n - 1;
+
+    /*
+     * The slot table is one slab allocation, rounded up to whole pages.
+     * The slab pool needs a few pages of its own plus a page descriptor
+     * for every page of the table.
+     */
+    size = 8 * ngx_pagesize + n * sizeof(ngx_atomic_t) + n * sizeof(ngx_atomic_t) / 64;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_robonope_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_robonope_init_crawl_shm_zone;
+    shm_zone->data = cz;
+
+    mcf->crawl_zone = cz;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_robonope_init_crawl_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_robonope_crawl_zone_t *ocz = data;
+    ngx_http_robonope_crawl_zone_t *cz = shm_zone->data;
+
+    // Keep the buckets across a reload, the zone only survives with the same size
+    if (ocz != NULL) {
+        cz->slots = ocz->slots;
+        cz->shpool = ocz->shpool;
+        return NGX_OK;
+    }
+
+    cz->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cz->slots = cz->shpool->data;
+        return NGX_OK;
+    }
+
+    cz->slots = ngx_slab_alloc(cz->shpool, (cz->mask + 1) * sizeof(ngx_atomic_t));
+    if (cz->slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero((void *) cz->slots, (cz->mask + 1) * sizeof(ngx_atomic_t));
+
+    cz->shpool->data = (void *) cz->slots;
+
+    return NGX_OK;
+}
+
+/*
+ * Crawl-delay check, a generic cell rate algorithm over one slot per
+ * client.  The slot holds the time the client may fetch again with its
+ * whole burst left.  A fetch is allowed while that time is no more than
+ * burst delays ahead of now, and moves it one delay further.  An allowed
+ * fetch costs one load and one compare-and-swap, a refused one only the
+ * load.  Clients sharing a slot evict each other, which at worst gives a
+ * client a fresh burst.  Returns NGX_BUSY when the client is too early.
+ */
+static ngx_int_t
+ngx_http_robonope_crawl_delay(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, u_char *fingerprint, u_char **known)
+{
+    ngx_http_robonope_ruleset_t *rs = mcf->rules;
+    ngx_http_robonope_crawl_zone_t *cz = mcf->crawl_zone;
+    ngx_str_t *user_agent = NULL;
+    ngx_atomic_t *slot;
+    ngx_atomic_uint_t old;
+    ngx_table_elt_t *h;
+    ngx_int_t group;
+    uint64_t tag, now, tat, delay, tolerance;
+    uint32_t hash;
+    u_char *fp;
+
+    if (rs == NULL || rs->ngroups == 0) {
+        return NGX_OK;
+    }
+
+    if (r->headers_in.user_agent) {
+        user_agent = &r->headers_in.user_agent->value;
+    }
+
+    group = ngx_http_robonope_find_group(rs, user_agent);
+    if (group == NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    delay = ngx_http_robonope_ruleset_groups(rs)[group].crawl_delay;
+    if (delay == 0) {
+        return NGX_OK;
+    }
+
+    // The same fingerprint as the offender cache, computed once per request
+    if (*known == NULL) {
+        ngx_http_robonope_fingerprint(r, fingerprint);
+        *known = fingerprint;
+    }
+
+    fp = *known;
+
+    ngx_memcpy(&hash, fp, sizeof(uint32_t));
+    slot = &cz->slots[hash & cz->mask];
+
+    tag = ((uint64_t) fp[4] << 16 | (uint64_t) fp[5] << 8 | fp[6]) << NGX_HTTP_ROBONOPE_CRAWL_TIME_BITS;
+    now = (uint64_t) ngx_current_msec & NGX_HTTP_ROBONOPE_CRAWL_TIME_MASK;
+    tolerance = delay * lcf->crawl_delay_burst;
+
+    for ( ;; ) {
+        old = *slot;
+        tat = (uint64_t) old & NGX_HTTP_ROBONOPE_CRAWL_TIME_MASK;
+
+        // Another client's slot, or an idle client
+        if (((uint64_t) old & ~NGX_HTTP_ROBONOPE_CRAWL_TIME_MASK) != tag || tat < now) {
+            tat = now;
+        }
+
+        if (tat - now > tolerance) {
+            break;
+        }
+
+        if (ngx_atomic_cmp_set(slot, old, (ngx_atomic_uint_t) (tag | ((tat + delay) & NGX_HTTP_ROBONOPE_CRAWL_TIME_MASK)))) {
+            return NGX_OK;
+        }
+    }
+
+    if (lcf->crawl_delay != NGX_HTTP_ROBONOPE_CRAWL_DELAY_429) {
+        return NGX_BUSY;
+    }
+
+    // Tell the client when to come back, in whole seconds
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->value.data = ngx_pnalloc(r->pool, NGX_INT64_LEN);
+    if (h->value.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->hash = 1;
+    h->next = NULL;
+    ngx_str_set(&h->key, "Retry-After");
+    h->value.len = ngx_sprintf(h->value.data, "%uL", (tat - tolerance - now + 999) / 1000) - h->value.data;
+
+    return NGX_BUSY;
+}
+
+/*
+ * Status counters, one slot per worker in each of two sets, see
+ * ngx_http_robonope_status_zone_t.  The slots are sized for the
+ * worker_processes known at this point, which needs the directive to come
+ * before the http block; otherwise there is a slot per CPU.
+ */
+static ngx_int_t
+ngx_http_robonope_init_status_zone(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf)
+{
+    ngx_http_robonope_status_zone_t *sz;
+    ngx_core_conf_t *ccf;
+    ngx_shm_zone_t *shm_zone;
+    ngx_str_t name = ngx_string("robonope_status");
+    size_t size;
+
+    sz = ngx_pcalloc(cf->pool, sizeof(ngx_http_robonope_status_zone_t));
+    if (sz == NULL) {
+        return NGX_ERROR;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx, ngx_core_module);
+
+    sz->nslots = (ccf->worker_processes != NGX_CONF_UNSET) ? (ngx_uint_t) ccf->worker_processes : (ngx_uint_t) ngx_ncpu;
+    sz->nslots = ngx_max(sz->nslots, 1);
+
+    // Slots never share a cache line, so workers never write to the same line
+    sz->slot_size = ngx_align(sizeof(ngx_http_robonope_status_slot_t), NGX_CPU_CACHE_LINE);
+
+    size = 8 * ngx_pagesize + 2 * sz->nslots * sz->slot_size;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_robonope_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_robonope_init_status_shm_zone;
+    shm_zone->data = sz;
+
+    mcf->status_zone = sz;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_robonope_init_status_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_robonope_status_zone_t *osz = data;
+    ngx_http_robonope_status_zone_t *sz = shm_zone->data;
+    size_t size;
+
+    // Keep the counters across a reload, the new workers take the other set
+    if (osz != NULL) {
+        sz->slots = osz->slots;
+        sz->shpool = osz->shpool;
+        sz->generation = osz->generation + 1;
+        sz->first = (sz->generation % 2) * sz->nslots;
+        return NGX_OK;
+    }
+
+    sz->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        sz->slots = sz->shpool->data;
+        return NGX_OK;
+    }
+
+    size = 2 * sz->nslots * sz->slot_size;
+
+    // Larger than a page, so the table starts on a page boundary
+    sz->slots = ngx_slab_alloc(sz->shpool, size);
+    if (sz->slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sz->slots, size);
+
+    sz->shpool->data = sz->slots;
+
+    return NGX_OK;
+}
+
+/* Content handler of a robonope_status location */
+static ngx_int_t
+ngx_http_robonope_status_handler(ngx_http_request_t *r)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_chain_t out;
+    off_t len;
+    ngx_int_t rc;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
+
+    // Group names come from the rules this worker would match against now
+    if (ngx_http_robonope_sync_rules(mcf) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_robonope_status_render(r->pool, mcf->status_zone, mcf->rules, &out, &len) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = len;
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain; version=0.0.4");
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+/*
+ * Make room for one entry: drop stale entries from the cold end of the LRU
+ * queue, then the least recently used ones while the cache is at its cap.
+ * The zone must be locked.
+ */
+static void ngx_http_robonope_cache_cleanup(ngx_http_robonope_main_conf_t *mcf)
+{
+    ngx_http_robonope_cache_t *cache = mcf->cache;
+    ngx_http_robonope_cache_node_t *cn;
+    ngx_queue_t *q;
+    ngx_uint_t n;
+    time_t now;
+
+    now = ngx_time();
+
+    // Expire lazily, a couple of entries per insert is enough to keep up
+    for (n = 0; n < 2 && !ngx_queue_empty(&cache->sh->lru); n++) {
+        q = ngx_queue_last(&cache->sh->lru);
+        cn = ngx_queue_data(q, ngx_http_robonope_cache_node_t, queue);
+
+        if (cn->expire > now) {
+            break;
+        }
+
+        ngx_http_robonope_cache_delete(cache, cn);
+    }
+
+    while (cache->sh->nentries >= cache->max && !ngx_queue_empty(&cache->sh->lru)) {
+        q = ngx_queue_last(&cache->sh->lru);
+        ngx_http_robonope_cache_delete(cache, ngx_queue_data(q, ngx_http_robonope_cache_node_t, queue));
+    }
+}
+
+/* Helper function to convert char* to ngx_str_t */
+static ngx_str_t *
+ngx_http_robonope_str_create(ngx_pool_t *pool, const char *src) __attribute__((unused));
+
+static ngx_str_t *
+ngx_http_robonope_str_create(ngx_pool_t *pool, const char *src)
+{
+    ngx_str_t *dst;
+    size_t len;
+    
+    dst = ngx_palloc(pool, sizeof(ngx_str_t));
+    if (dst == NULL) {
+        return NULL;
+    }
+    
+    len = ngx_strlen(src);
+    dst->len = len;
+    dst->data = ngx_pcalloc(pool, len + 1);
+    if (dst->data == NULL) {
+        return NULL;
+    }
+    
+    ngx_memcpy(dst->data, src, len);
+    
+    return dst;
+}
+
+static ngx_int_t
+ngx_http_robonope_send_response(ngx_http_request_t *r, ngx_str_t *content)
+{
+    ngx_buf_t *b;
+    ngx_chain_t out;
+    
+    // Allocate response buffer
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    
+    b->pos = content->data;
+    b->last = content->data + content->len;
+    b->memory = 1;
+    b->last_buf = 1;
+    
+    out.buf = b;
+    out.next = NULL;
+    
+    return ngx_http_robonope_send_chain(r, &out, content->len);
+}
+
+static ngx_int_t
+ngx_http_robonope_send_chain(ngx_http_request_t *r, ngx_chain_t *out, off_t len)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_loc_conf_t *lcf;
+    ngx_uint_t tarpit;
+    ngx_int_t rc;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
+    lcf = ngx_http_get_module_loc_conf(r, ngx_http_robonope_module);
+
+    // Set response headers
+    r->headers_out.content_type.len = sizeof("text/html") - 1;
+    r->headers_out.content_type.data = (u_char *) "text/html";
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = len;
+
+    tarpit = 0;
+
+    if (lcf->tarpit && len > 0) {
+        if (mcf->tarpit->active < mcf->tarpit->max) {
+            tarpit = 1;
+            r->keepalive = 0;
+
+        } else {
+            mcf->tarpit->rejected++;
+        }
+    }
+
+    // Finalized here as well, a HEAD request must not reach the content phase
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        ngx_http_finalize_request(r, rc);
+        return NGX_DONE;
+    }
+
+    if (tarpit) {
+        return ngx_http_robonope_tarpit(r, mcf, lcf, out);
+    }
+
+    /*
+     * The response is complete, finalize it here so the access phase does
+     * not hand the request on to the content phase.
+     */
+    ngx_http_finalize_request(r, ngx_http_output_filter(r, out));
+
+    return NGX_DONE;
+}
+
+/*
+ * Drip-feed the body: every tarpit interval a timer sends the next few bytes
+ * of the buffers in "out", without copying them.  The connection is held at
+ * the cost of the request and one timer, and nothing is queued while the
+ * client is not reading.  Once the tarpit duration is over the rest of the
+ * body is handed to nginx at once, so send_timeout applies from then on.
+ */
+static ngx_int_t
+ngx_http_robonope_tarpit(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_chain_t *out)
+{
+    ngx_http_robonope_tarpit_t *t;
+    ngx_pool_cleanup_t *cln;
+
+    t = ngx_pcalloc(r->pool, sizeof(ngx_http_robonope_tarpit_t));
+    if (t == NULL) {
+        return NGX_ERROR;
+    }
+
+    t->buf = ngx_calloc_buf(r->pool);
+    if (t->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    t->request = r;
+    t->in = out;
+    t->rate = lcf->tarpit_rate;
+    t->interval = lcf->tarpit_interval;
+    t->deadline = ngx_current_msec + lcf->tarpit_duration;
+    t->stats = mcf->tarpit;
+
+    t->timer.handler = ngx_http_robonope_tarpit_handler;
+    t->timer.data = t;
+    t->timer.log = r->connection->log;
+    t->timer.cancelable = 1;
+
+    // Runs however the request ends, also when the client goes away
+    cln->handler = ngx_http_robonope_tarpit_cleanup;
+    cln->data = t;
+
+    t->stats->active++;
+    t->stats->started++;
+
+    // Ticks drive the writes, reads only watch for the client closing
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_robonope_tarpit_handler(&t->timer);
+
+    return NGX_DONE;
+}
+
+static void
+ngx_http_robonope_tarpit_handler(ngx_event_t *ev)
+{
+    ngx_http_robonope_tarpit_t *t = ev->data;
+    ngx_http_request_t *r;
+    ngx_buf_t *src, *b;
+    ngx_int_t rc;
+    size_t n;
+
+    r = t->request;
+
+    if ((ngx_msec_int_t) (ngx_current_msec - t->deadline) >= 0) {
+        t->done = 1;
+        t->stats->finished++;
+        ngx_http_finalize_request(r, ngx_http_output_filter(r, t->in));
+        return;
+    }
+
+    if (r->connection->buffered) {
+        // The client is not reading, try to flush but queue nothing more
+        rc = ngx_http_output_filter(r, NULL);
+
+    } else {
+        while (ngx_buf_size(t->in->buf) == 0 && t->in->next != NULL) {
+            t->in = t->in->next;
+        }
+
+        src = t->in->buf;
+        n = ngx_min(t->rate, (size_t) (src->last - src->pos));
+
+        b = t->buf;
+        b->pos = src->pos;
+        b->last = src->pos + n;
+        b->memory = 1;
+        b->flush = 1;
+
+        src->pos += n;
+        t->stats->sent += n;
+
+        t->out.buf = b;
+        t->out.next = NULL;
+
+        if (src->pos == src->last && t->in->next == NULL) {
+            b->last_buf = src->last_buf;
+            b->last_in_chain = 1;
+
+            t->done = 1;
+            t->stats->finished++;
+            ngx_http_finalize_request(r, ngx_http_output_filter(r, &t->out));
+            return;
+        }
+
+        rc = ngx_http_output_filter(r, &t->out);
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    ngx_add_timer(ev, t->interval);
+}
+
+static void
+ngx_http_robonope_tarpit_cleanup(void *data)
+{
+    ngx_http_robonope_tarpit_t *t = data;
+
+    if (t->timer.timer_set) {
+        ngx_del_timer(&t->timer);
+    }
+
+    t->stats->active--;
+
+    if (!t->done) {
+        t->stats->aborted++;
+    }
+}
+
+/*
+ * Honeypot page template.  The template is split once, at configuration
+ * time, into static segments and the placeholders between them; pages are
+ * then assembled from the segments and the values generated for each page.
+ */
+static ngx_str_t ngx_http_robonope_default_template = ngx_string(
+    "<html>\n"
+    "<head>\n"
+    "<style>\n"
+    ".{{class}} { opacity: 0; position: absolute; top: -9999px; }\n"
+    "</style>\n"
+    "</head>\n"
+    "<body>\n"
+    "<div class=\"content\">\n"
+    "{{text}}\n"
+    "</div>\n"
+    "<a href=\"{{link}}\" class=\"{{class}}\">Important Information</a>\n"
+    "{{maze}}"
+    "</body>\n"
+    "</html>");
+
+static ngx_str_t ngx_http_robonope_placeholders[] = {
+    ngx_null_string,                       /* NGX_HTTP_ROBONOPE_SEGMENT_STATIC */
+    ngx_string("class"),                   /* NGX_HTTP_ROBONOPE_SEGMENT_CLASS */
+    ngx_string("text"),                    /* NGX_HTTP_ROBONOPE_SEGMENT_TEXT */
+    ngx_string("link"),                    /* NGX_HTTP_ROBONOPE_SEGMENT_LINK */
+    ngx_string("maze"),                    /* NGX_HTTP_ROBONOPE_SEGMENT_MAZE */
+};
+
+static ngx_int_t
+ngx_http_robonope_load_template(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path)
+{
+    ngx_fd_t fd;
+    ngx_file_t file;
+    ngx_file_info_t fi;
+    ngx_str_t source, name;
+    ngx_http_robonope_segment_t *seg;
+    u_char *p, *last, *start, *end;
+    ngx_uint_t type;
+    ssize_t n;
+
+    source = ngx_http_robonope_default_template;
+
+    if (path->data != NULL) {
+        fd = ngx_open_file(path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+        if (fd == NGX_INVALID_FILE) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               ngx_open_file_n " \"%V\" failed", path);
+            return NGX_ERROR;
+        }
+
+        if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               ngx_fd_info_n " \"%V\" failed", path);
+            ngx_close_file(fd);
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(&file, sizeof(ngx_file_t));
+        file.fd = fd;
+        file.name = *path;
+        file.log = cf->log;
+
+        source.len = ngx_file_size(&fi);
+        source.data = ngx_pnalloc(cf->pool, source.len);
+        if (source.data == NULL) {
+            ngx_close_file(fd);
+            return NGX_ERROR;
+        }
+
+        n = ngx_read_file(&file, source.data, source.len, 0);
+        ngx_close_file(fd);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        source.len = n;
+    }
+
+    mcf->template = ngx_array_create(cf->pool, 16, sizeof(ngx_http_robonope_segment_t));
+    if (mcf->template == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = source.data;
+    last = source.data + source.len;
+    start = p;
+
+    while (p < last) {
+        if (p + 1 >= last || p[0] != '{' || p[1] != '{') {
+            p++;
+            continue;
+        }
+
+        for (end = p + 2; end + 1 < last; end++) {
+            if (end[0] == '}' && end[1] == '}') {
+                break;
+            }
+        }
+
+        if (end + 1 >= last) {
+            break; // Unterminated, the rest is static text
+        }
+
+        name.data = p + 2;
+        name.len = end - name.data;
+
+        for (type = NGX_HTTP_ROBONOPE_SEGMENT_CLASS; type < NGX_HTTP_ROBONOPE_SEGMENTS; type++) {
+            if (name.len == ngx_http_robonope_placeholders[type].len
+                && ngx_strncmp(name.data, ngx_http_robonope_placeholders[type].data, name.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (type == NGX_HTTP_ROBONOPE_SEGMENTS) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown placeholder \"{{%V}}\" in honeypot template", &name);
+            return NGX_ERROR;
+        }
+
+        if (p > start) {
+            seg = ngx_array_push(mcf->template);
+            if (seg == NULL) {
+                return NGX_ERROR;
+            }
+            seg->type = NGX_HTTP_ROBONOPE_SEGMENT_STATIC;
+            seg->text.data = start;
+            seg->text.len = p - start;
+        }
+
+        seg = ngx_array_push(mcf->template);
+        if (seg == NULL) {
+            return NGX_ERROR;
+        }
+        seg->type = type;
+        ngx_str_null(&seg->text);
+
+        p = end + 2;
+        start = p;
+    }
+
+    if (last > start) {
+        seg = ngx_array_push(mcf->template);
+        if (seg == NULL) {
+            return NGX_ERROR;
+        }
+        seg->type = NGX_HTTP_ROBONOPE_SEGMENT_STATIC;
+        seg->text.data = start;
+        seg->text.len = last - start;
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Train the text model on the files under robonope_static_content_path, a
+ * directory or a single file.  The model is built once here and copied into
+ * a shared mapping that is made read-only, so all workers use the same
+ * pages of memory and generating text allocates nothing but the result.
+ */
+static ngx_int_t
+ngx_http_robonope_load_markov(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *path)
+{
+    ngx_http_robonope_markov_t *m;
+    ngx_pool_cleanup_t *cln;
+    ngx_array_t *texts;
+    ngx_file_info_t fi;
+    ngx_pool_t *temp;
+    ngx_str_t name;
+    ngx_dir_t dir;
+    ngx_shm_t *shm;
+    ngx_int_t rc;
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, cf->log);
+    if (temp == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    texts = ngx_array_create(temp, 16, sizeof(ngx_str_t));
+    if (texts == NULL) {
+        goto done;
+    }
+
+    if (ngx_file_info(path->data, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_file_info_n " \"%V\" failed", path);
+        goto done;
+    }
+
+    if (!ngx_is_dir(&fi)) {
+        if (ngx_http_robonope_read_text(cf, temp, path, texts) == NGX_ERROR) {
+            goto done;
+        }
+
+    } else {
+        if (ngx_open_dir(path, &dir) == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               ngx_open_dir_n " \"%V\" failed", path);
+            goto done;
+        }
+
+        for ( ;; ) {
+            ngx_set_errno(0);
+
+            if (ngx_read_dir(&dir) == NGX_ERROR) {
+                if (ngx_errno != NGX_ENOMOREFILES) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                                       ngx_read_dir_n " \"%V\" failed", path);
+                    ngx_close_dir(&dir);
+                    goto done;
+                }
+
+                break;
+            }
+
+            if (ngx_de_name(&dir)[0] == '.') {
+                continue;
+            }
+
+            name.len = path->len + 1 + ngx_de_namelen(&dir);
+            name.data = ngx_pnalloc(temp, name.len + 1);
+            if (name.data == NULL) {
+                ngx_close_dir(&dir);
+                goto done;
+            }
+
+            ngx_sprintf(name.data, "%V/%s%Z", path, ngx_de_name(&dir));
+
+            if (ngx_http_robonope_read_text(cf, temp, &name, texts) == NGX_ERROR) {
+                ngx_close_dir(&dir);
+                goto done;
+            }
+        }
+
+        ngx_close_dir(&dir);
+    }
+
+    m = ngx_http_robonope_compile_markov(temp, texts);
+    if (m == NULL) {
+        goto done;
+    }
+
+    if (m->nstates == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no text to train robonope_markov in \"%V\"", path);
+        goto done;
+    }
+
+    shm = ngx_pcalloc(cf->pool, sizeof(ngx_shm_t));
+    if (shm == NULL) {
+        goto done;
+    }
+
+    shm->size = m->size;
+    shm->log = cf->log;
+    ngx_str_set(&shm->name, "robonope_markov");
+
+    if (ngx_shm_alloc(shm) != NGX_OK) {
+        goto done;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_shm_free(shm);
+        goto done;
+    }
+
+    cln->handler = ngx_http_robonope_free_markov;
+    cln->data = shm;
+
+    ngx_memcpy(shm->addr, m, m->size);
+
+    if (mprotect(shm->addr, shm->size, PROT_READ) == -1) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, ngx_errno,
+                           "mprotect() of the robonope_markov model failed");
+    }
+
+    mcf->markov = (ngx_http_robonope_markov_t *) shm->addr;
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "robonope_markov: %ui texts, %uD words, %uD states, %uz bytes",
+                       texts->nelts, m->nwords, m->nstates, m->size);
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_destroy_pool(temp);
+
+    return rc;
+}
+
+/* Read one regular file into texts, anything else is skipped */
+static ngx_int_t
+ngx_http_robonope_read_text(ngx_conf_t *cf, ngx_pool_t *pool, ngx_str_t *name, ngx_array_t *texts)
+{
+    ngx_fd_t fd;
+    ngx_file_t file;
+    ngx_file_info_t fi;
+    ngx_str_t *text;
+    ssize_t n;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", name);
+        ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    if (!ngx_is_file(&fi) || ngx_file_size(&fi) == 0) {
+        ngx_close_file(fd);
+        return NGX_DECLINED;
+    }
+
+    text = ngx_array_push(texts);
+    if (text == NULL) {
+        ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.fd = fd;
+    file.name = *name;
+    file.log = cf->log;
+
+    text->len = ngx_file_size(&fi);
+    text->data = ngx_pnalloc(pool, text->len);
+    if (text->data == NULL) {
+        ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_file(&file, text->data, text->len, 0);
+    ngx_close_file(fd);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    text->len = n;
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_robonope_free_markov(void *data)
+{
+    ngx_shm_t *shm = data;
+
+    ngx_shm_free(shm);
+}
+
+/*
+ * Send a freshly generated page without assembling it: the response is a
+ * chain of buffers pointing at the template's static segments and at the
+ * generated values in turn.
+ */
+static ngx_int_t
+ngx_http_robonope_serve_honeypot(ngx_http_request_t *r, ngx_http_robonope_rng_t *rng, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_str_t values[NGX_HTTP_ROBONOPE_SEGMENTS], *v;
+    ngx_str_t empty = ngx_null_string;
+    ngx_http_robonope_segment_t *seg;
+    ngx_buf_t *bufs, *b = NULL;
+    ngx_chain_t *cl, *out = NULL, **ll = &out;
+    ngx_uint_t i;
+    off_t len = 0;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_robonope_module);
+
+    if (ngx_http_robonope_honeypot_values(r->pool, mcf, lcf, rng, &r->uri, honeypot_link, values) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    seg = mcf->template->elts;
+
+    bufs = ngx_pcalloc(r->pool, mcf->template->nelts * sizeof(ngx_buf_t));
+    cl = ngx_palloc(r->pool, mcf->template->nelts * sizeof(ngx_chain_t));
+    if (bufs == NULL || cl == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    for (i = 0; i < mcf->template->nelts; i++) {
+        v = (seg[i].type == NGX_HTTP_ROBONOPE_SEGMENT_STATIC) ? &seg[i].text : &values[seg[i].type];
+        if (v->len == 0) {
+            continue;
+        }
+
+        b = &bufs[i];
+        b->pos = v->data;
+        b->last = v->data + v->len;
+        b->memory = 1;
+
+        cl[i].buf = b;
+        *ll = &cl[i];
+        ll = &cl[i].next;
+
+        len += v->len;
+    }
+
+    *ll = NULL;
+
+    if (b == NULL) {
+        return ngx_http_robonope_send_response(r, &empty); // Empty template
+    }
+
+    b->last_buf = 1;
+
+    // Send the response
+    return ngx_http_robonope_send_chain(r, out, len);
+}
+
+/*
+ * Deterministic pages: the generators are seeded from MD5(secret, rules,
+ * template, location settings, URI).  The same value is the strong ETag,
+ * so a conditional request that still matches is answered with a 304
+ * before anything is generated.
+ */
+static ngx_int_t
+ngx_http_robonope_serve_deterministic(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf)
+{
+    ngx_md5_t md5;
+    ngx_table_elt_t *h;
+    ngx_str_t *honeypot_link;
+    ngx_http_robonope_rng_t rng;
+    u_char key[16], *p;
+
+    // The settings of the location that change the page, then the URI
+    md5 = mcf->content_key;
+    ngx_md5_update(&md5, &lcf->maze, sizeof(ngx_uint_t));
+    ngx_md5_update(&md5, &lcf->instructions_url.len, sizeof(size_t));
+    ngx_md5_update(&md5, lcf->instructions_url.data, lcf->instructions_url.len);
+    ngx_md5_update(&md5, r->uri.data, r->uri.len);
+    ngx_md5_final(key, &md5);
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = ngx_pnalloc(r->pool, 2 + 2 * sizeof(key));
+    if (p == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    h->hash = 1;
+    h->next = NULL;
+    ngx_str_set(&h->key, "ETag");
+    h->value.data = p;
+    *p++ = '"';
+    p = ngx_hex_dump(p, key, sizeof(key));
+    *p++ = '"';
+    h->value.len = p - h->value.data;
+
+    r->headers_out.etag = h;
+
+    if (ngx_http_robonope_etag_match(r->headers_in.if_none_match, &h->value)) {
+        r->headers_out.status = NGX_HTTP_NOT_MODIFIED;
+        r->headers_out.content_length_n = -1;
+        r->header_only = 1;
+
+        ngx_http_finalize_request(r, ngx_http_send_header(r));
+        return NGX_DONE;
+    }
+
+    ngx_http_robonope_rng_seed(&rng, key);
+
+    honeypot_link = ngx_http_robonope_generate_honeypot_link(r->pool, &rng, &r->uri, mcf->rules, lcf);
+    if (honeypot_link == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    return ngx_http_robonope_serve_honeypot(r, &rng, lcf, honeypot_link);
+}
+
+/* If-None-Match uses the weak comparison, "W/" prefixes are ignored */
+static ngx_int_t
+ngx_http_robonope_etag_match(ngx_table_elt_t *if_none_match, ngx_str_t *etag)
+{
+    u_char *p, *last, *start;
+
+    if (if_none_match == NULL) {
+        return 0;
+    }
+
+    p = if_none_match->value.data;
+    last = p + if_none_match->value.len;
+
+    while (p < last) {
+        while (p < last && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+
+        if (p < last && *p == '*') {
+            return 1;
+        }
+
+        if (last - p > 2 && p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+
+        start = p;
+        while (p < last && *p != ',' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+
+        if ((size_t) (p - start) == etag->len
+            && ngx_strncmp(start, etag->data, etag->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Pre-rendered honeypot pages.  Each worker renders robonope_page_pool
+ * pages at startup and replaces one of them at a time in the background.
+ * A page is referenced by the responses still sending it, a replaced page
+ * is freed when the last of them finishes.
+ */
+static ngx_http_robonope_page_t *
+ngx_http_robonope_page_create(ngx_http_robonope_page_pool_t *pp, ngx_log_t *log)
+{
+    ngx_pool_t *pool;
+    ngx_http_robonope_page_t *page;
+    ngx_str_t *honeypot_link;
+
+    pool = ngx_create_pool(4096, log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    page = ngx_pcalloc(pool, sizeof(ngx_http_robonope_page_t));
+    if (page == NULL) {
+        goto failed;
+    }
+
+    page->pool = pool;
+
+    if (ngx_http_robonope_sync_rules(pp->mcf) != NGX_OK) {
+        goto failed;
+    }
+
+    honeypot_link = ngx_http_robonope_generate_honeypot_link(pool, NULL, NULL, pp->mcf->rules, pp->lcf);
+    if (honeypot_link == NULL) {
+        goto failed;
+    }
+
+    if (ngx_http_robonope_render_honeypot(pool, pp->mcf, pp->lcf, honeypot_link, &page->content) != NGX_OK) {
+        goto failed;
+    }
+
+    return page;
+
+failed:
+
+    ngx_destroy_pool(pool);
+    return NULL;
+}
+
+static void
+ngx_http_robonope_page_release(void *data)
+{
+    ngx_http_robonope_page_t *page = data;
+
+    if (--page->refs == 0 && page->retired) {
+        ngx_destroy_pool(page->pool);
+    }
+}
+
+static void
+ngx_http_robonope_page_refresh_handler(ngx_event_t *ev)
+{
+    ngx_http_robonope_page_pool_t *pp = ev->data;
+    ngx_http_robonope_page_t *page, *old;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    page = ngx_http_robonope_page_create(pp, ev->log);
+
+    // Keep serving the old page if a new one cannot be rendered
+    if (page != NULL) {
+        old = pp->pages[pp->next];
+        pp->pages[pp->next] = page;
+
+        old->retired = 1;
+        if (old->refs == 0) {
+            ngx_destroy_pool(old->pool);
+        }
+    }
+
+    pp->next = (pp->next + 1) % pp->npages;
+
+    // Spread the refresh of the whole pool over robonope_page_refresh
+    ngx_add_timer(ev, ngx_max(pp->refresh / pp->npages, 1));
+}
+
+/* Send a random pre-rendered page, the response points at the page itself */
+static ngx_int_t
+ngx_http_robonope_serve_page(ngx_http_request_t *r, ngx_http_robonope_page_pool_t *pp)
+{
+    ngx_pool_cleanup_t *cln;
+    ngx_http_robonope_page_t *page;
+
+    page = pp->pages[ngx_random() % pp->npages];
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln->handler = ngx_http_robonope_page_release;
+    cln->data = page;
+    page->refs++;
+
+    return ngx_http_robonope_send_response(r, &page->content);
+}
+
+/* The request context, created on first use */
+static ngx_http_robonope_ctx_t *
+ngx_http_robonope_get_ctx(ngx_http_request_t *r)
+{
+    ngx_http_robonope_ctx_t *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_robonope_module);
+    if (ctx != NULL) {
+        return ctx;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_robonope_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->group_index = NGX_DECLINED;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_robonope_module);
+
+    return ctx;
+}
+
+/*
+ * Match the request against the rules, once per request: the access
+ * handler and the variables share the result through the context.  With
+ * robots.txt hot reload the strings are copied, since old rules are freed
+ * while a tarpitted request may still be waiting to be logged.
+ */
+static ngx_int_t
+ngx_http_robonope_classify(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ctx_t *ctx)
+{
+    ngx_http_robonope_ruleset_t *rs = mcf->rules;
+    ngx_http_robonope_group_t *group;
+    ngx_http_robonope_rule_t *rule;
+    ngx_int_t g;
+
+    if (ctx->classified) {
+        return NGX_OK;
+    }
+
+    ctx->classified = 1;
+    rule = NULL;
+
+    if (rs == NULL || rs->nrules == 0) {
+        goto done; // Not disallowed if no patterns
+    }
+
+    /*
+     * The robots.txt group for this User-Agent, "*" if none names it, and
+     * its rule matching the URI and query string; an Allow may override a
+     * Disallow
+     */
+    rule = ngx_http_robonope_match_request(rs, mcf->match_scratch, r, &g);
+    if (g == NGX_DECLINED) {
+        goto done; // No rules for this User-Agent
+    }
+
+    ctx->group_index = g;
+    group = &ngx_http_robonope_ruleset_groups(rs)[g];
+
+    if (group->len == 0) {
+        ngx_str_set(&ctx->group, "*");
+
+    } else {
+        ctx->group.data = ngx_http_robonope_group_name(rs, group);
+        ctx->group.len = group->len;
+    }
+
+    if (rule != NULL) {
+        ctx->pattern.data = ngx_http_robonope_rule_pattern(rs, rule);
+        ctx->pattern.len = rule->len;
+    }
+
+    if (mcf->rules_zone != NULL) {
+        if (group->len > 0) {
+            ctx->group.data = ngx_pstrdup(r->pool, &ctx->group);
+            if (ctx->group.data == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (rule != NULL) {
+            ctx->pattern.data = ngx_pstrdup(r->pool, &ctx->pattern);
+            if (ctx->pattern.data == NULL) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+done:
+
+    if (ctx->verdict == NGX_HTTP_ROBONOPE_VERDICT_NONE) {
+        ctx->verdict = (rule != NULL) ? NGX_HTTP_ROBONOPE_VERDICT_DISALLOWED
+                                      : NGX_HTTP_ROBONOPE_VERDICT_ALLOWED;
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Returns 1 when the request matches a Disallow rule, after queueing it for
+ * the request log and adding the client to the offender cache.
+ */
+static ngx_int_t
+ngx_http_robonope_is_disallowed(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_ctx_t *ctx)
+{
+    ngx_http_robonope_loc_conf_t *lcf;
+
+    if (ngx_http_robonope_classify(r, mcf, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->verdict != NGX_HTTP_ROBONOPE_VERDICT_DISALLOWED) {
+        return 0; // URL is not disallowed
+    }
+
+    lcf = ngx_http_get_module_loc_conf(r, ngx_http_robonope_module);
+
+    if (mcf->status_slot != NULL) {
+        mcf->status_slot->blocked_group[ngx_min((ngx_uint_t) ctx->group_index, NGX_HTTP_ROBONOPE_STATUS_GROUPS - 1)]++;
+    }
+
+    // Generate MD5 fingerprint of client IP and user agent, unless the handler already did
+    if (!ctx->fingerprinted) {
+        ngx_http_robonope_fingerprint(r, ctx->fingerprint);
+        ctx->fingerprinted = 1;
+    }
+
+    // Queue the request for the database writer only if database path is set
+    if (lcf->db_path.data != NULL && lcf->db_path.len > 0) {
+        ngx_http_robonope_log_request(r, mcf, &ctx->pattern, ctx->fingerprint);
+    }
+
+    // Add client to cache if not already there
+    if (ngx_http_robonope_cache_lookup(mcf, ctx->fingerprint) != NGX_OK) {
+        ngx_http_robonope_cache_insert(mcf, ctx->fingerprint);
+    }
+
+    return 1; // URL is disallowed
+}
+
+static ngx_int_t
+ngx_http_robonope_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_log_queue_t *q;
+    ngx_http_robonope_page_pool_t *pp;
+    ngx_http_robonope_status_zone_t *sz;
+    ngx_http_robonope_status_slot_t *slot;
+    ngx_uint_t i;
+#ifdef ROBONOPE_USE_DUCKDB
+    u_char *p;
+    ngx_core_conf_t *ccf;
+#endif
+
+    mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_robonope_module);
+    if (mcf == NULL) {
+        return NGX_OK;
+    }
+
+    if (mcf->rules_zone != NULL) {
+        mcf->rules_zone->timer.handler = ngx_http_robonope_rules_check_handler;
+        mcf->rules_zone->timer.data = mcf;
+        mcf->rules_zone->timer.log = cycle->log;
+        mcf->rules_zone->timer.cancelable = 1;
+        ngx_add_timer(&mcf->rules_zone->timer, mcf->rules_zone->interval);
+    }
+
+    // Render the page pool after the worker has seeded its random generator
+    pp = mcf->page_pool;
+    if (pp != NULL) {
+        pp->pages = ngx_palloc(cycle->pool, pp->npages * sizeof(ngx_http_robonope_page_t *));
+        if (pp->pages == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < pp->npages; i++) {
+            pp->pages[i] = ngx_http_robonope_page_create(pp, cycle->log);
+            if (pp->pages[i] == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (pp->refresh > 0) {
+            pp->timer.handler = ngx_http_robonope_page_refresh_handler;
+            pp->timer.data = pp;
+            pp->timer.log = cycle->log;
+            pp->timer.cancelable = 1;
+            ngx_add_timer(&pp->timer, ngx_max(pp->refresh / pp->npages, 1));
+        }
+    }
+
+    /*
+     * Count into this worker's slot.  Counters carry on from the worker
+     * that had the slot before, gauges start over.
+     */
+    sz = mcf->status_zone;
+    if (sz != NULL && (ngx_process == NGX_PROCESS_WORKER || ngx_process == NGX_PROCESS_SINGLE)) {
+        if (ngx_worker < sz->nslots) {
+            slot = ngx_http_robonope_status_slot(sz, sz->first + ngx_worker);
+            slot->log_queued = 0;
+            slot->tarpit.active = 0;
+            slot->tarpit.max = mcf->tarpit->max;
+
+            mcf->tarpit = &slot->tarpit;
+            mcf->status_slot = slot;
+
+        } else {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "robonope_status has no slot for worker %ui, "
+                          "set worker_processes before the http block", ngx_worker);
+        }
+    }
+
+    q = mcf->log_queue;
+    if (q == NULL) {
+        return NGX_OK;
+    }
+
+    // Two buffers: one filled by requests while the other is written out
+    q->pending = ngx_palloc(cycle->pool, q->size * sizeof(ngx_http_robonope_log_record_t));
+    if (q->pending == NULL) {
+        return NGX_ERROR;
+    }
+
+    q->writing = ngx_palloc(cycle->pool, q->size * sizeof(ngx_http_robonope_log_record_t));
+    if (q->writing == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (q->binlog != NULL && ngx_http_robonope_binlog_init(q->binlog, cycle->pool) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (q->aggregate) {
+        q->index = ngx_pcalloc(cycle->pool, (q->index_mask + 1) * sizeof(uint32_t));
+        if (q->index == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * The connection lives as long as the worker, opened here after the
+     * fork so no handle is shared with the master.  Only one process can
+     * have a DuckDB file open for writing, so with several workers each
+     * writes its own file, the configured path followed by the worker
+     * number.  If the database cannot be opened now, the writer retries.
+     */
+    if (q->binlog == NULL
+        && (ngx_process == NGX_PROCESS_WORKER || ngx_process == NGX_PROCESS_SINGLE))
+    {
+#ifdef ROBONOPE_USE_DUCKDB
+        ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+        if (ngx_process == NGX_PROCESS_WORKER && ccf->worker_processes > 1) {
+            p = ngx_pnalloc(cycle->pool, q->db_path.len + 1 + NGX_INT_T_LEN + 1);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            q->db_path.len = ngx_sprintf(p, "%V.%ui%Z", &q->db_path, ngx_worker) - p - 1;
+            q->db_path.data = p;
+        }
+#endif
+
+        (void) ngx_http_robonope_init_db(mcf, &q->db_path);
+    }
+
+    q->flush.handler = ngx_http_robonope_log_flush_handler;
+    q->flush.data = mcf;
+    q->flush.log = cycle->log;
+    q->flush.cancelable = 1;
+
+#if (NGX_THREADS)
+    q->task = ngx_thread_task_alloc(cycle->pool, 0);
+    if (q->task == NULL) {
+        return NGX_ERROR;
+    }
+
+    q->task->ctx = mcf;
+    q->task->handler = ngx_http_robonope_log_thread_handler;
+    q->task->event.handler = ngx_http_robonope_log_thread_event_handler;
+    q->task->event.data = mcf;
+    q->task->event.log = cycle->log;
+#endif
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_robonope_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_robonope_main_conf_t *mcf;
+    ngx_http_robonope_log_queue_t *q;
+
+    mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_robonope_module);
+    if (mcf == NULL) {
+        return;
+    }
+
+    // With robonope_status the counters are in the slot, shared with earlier workers
+    if (mcf->status_slot == NULL && mcf->tarpit != NULL && mcf->tarpit->started > 0) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "robonope tarpit: %ui started, %ui finished, %ui aborted, "
+                      "%ui over the limit, %O bytes sent",
+                      mcf->tarpit->started, mcf->tarpit->finished,
+                      mcf->tarpit->aborted, mcf->tarpit->rejected,
+                      mcf->tarpit->sent);
+    }
+
+    if (mcf->log_queue == NULL || mcf->log_queue->pending == NULL) {
+        return;
+    }
+
+    q = mcf->log_queue;
+
+#if (NGX_THREADS)
+    /*
+     * Thread pools are already shut down, write what is still queued here.
+     * A batch that was in flight has been written, but its completion
+     * event will not run anymore.
+     */
+    q->thread_pool = NULL;
+
+    if (q->busy) {
+        ngx_http_robonope_log_done(mcf);
+    }
+
+    if (q->flush.timer_set) {
+        ngx_del_timer(&q->flush);
+    }
+#endif
+
+    q->closing = 1;
+
+    if (!q->busy && (q->npending > 0 || q->appended > 0)) {
+        ngx_http_robonope_log_flush(mcf);
+    }
+
+    if (!q->busy && q->binlog != NULL) {
+        ngx_http_robonope_binlog_close(q->binlog, cycle->log);
+    }
+
+#ifdef ROBONOPE_USE_DUCKDB
+    if (!q->busy && mcf->db != NULL) {
+        duckdb_appender appender = q->appender;
+        duckdb_connection conn = q->conn;
+        duckdb_database db = mcf->db;
+
+        if (appender != NULL) {
+            duckdb_appender_destroy(&appender);
+            q->appender = NULL;
+        }
+
+        if (q->stmt != NULL) {
+            duckdb_prepared_statement stmt = q->stmt;
+
+            duckdb_destroy_prepare(&stmt);
+            q->stmt = NULL;
+        }
+
+        duckdb_disconnect(&conn);
+        duckdb_close(&db);
+        q->conn = NULL;
+        mcf->db = NULL;
+    }
+#else
+    if (!q->busy && mcf->db != NULL) {
+        sqlite3_finalize(q->stmt);
+        sqlite3_close(mcf->db);
+        q->stmt = NULL;
+        mcf->db = NULL;
+    }
+#endif
+}
+
+/*
+ * Queue a record for the database writer.  This is the only logging work
+ * done on the request path: the record is copied into the pending buffer,
+ * or dropped and counted if the buffer is full.
+ */
+static void
+ngx_http_robonope_log_request(ngx_http_request_t *r, ngx_http_robonope_main_conf_t *mcf, ngx_str_t *matched_pattern, u_char *fingerprint)
+{
+    ngx_uint_t n;
+    ngx_http_robonope_log_queue_t *q;
+    ngx_http_robonope_log_record_t *rec;
+
+    q = mcf->log_queue;
+    if (q == NULL || q->pending == NULL) {
+        return;
+    }
+
+    // A batch full of counters goes out early rather than losing new keys
+    if (q->aggregate && q->npending == q->size && !q->busy) {
+        ngx_http_robonope_log_flush(mcf);
+    }
+
+    n = q->npending;
+
+    if (q->aggregate) {
+        rec = ngx_http_robonope_log_count(q, r, matched_pattern, fingerprint);
+    } else {
+        rec = ngx_http_robonope_log_push(q, r, matched_pattern, fingerprint);
+    }
+
+    if (rec == NULL) {
+        if (mcf->status_slot != NULL) {
+            mcf->status_slot->log_dropped++;
+        }
+        return;
+    }
+
+    if (q->npending == n) {
+        return; // Counted in a record already queued
+    }
+
+    if (mcf->status_slot != NULL) {
+        mcf->status_slot->log_queued++;
+    }
+
+    if (q->busy) {
+        return; // Picked up when the current batch completes
+    }
+
+#if (NGX_THREADS)
+    if (q->thread_pool != NULL && !q->aggregate) {
+        ngx_http_robonope_log_flush(mcf);
+        return;
+    }
+#endif
+
+    // Without threads batches are written from a timer, never per request
+    if (!q->flush.timer_set) {
+        ngx_add_timer(&q->flush, q->aggregate ? q->flush_interval : 1000);
+    }
+}
+
+/* Hand the pending records to the writer as one batch */
+static void
+ngx_http_robonope_log_flush(ngx_http_robonope_main_conf_t *mcf)
+{
+    ngx_http_robonope_log_queue_t *q = mcf->log_queue;
+    ngx_http_robonope_log_record_t *records;
+
+    records = q->writing;
+    q->writing = q->pending;
+    q->pending = records;
+    q->nwriting = q->npending;
+    q->npending = 0;
+    q->held = q->appended;
+    q->now = ngx_current_msec;
+    q->busy = 1;
+
+    if (q->index != NULL) {
+        ngx_memzero(q->index, (q->index_mask + 1) * sizeof(uint32_t));
+    }
+
+#if (NGX_THREADS)
+    if (q->thread_pool != NULL) {
+        if (ngx_thread_task_post(q->thread_pool, q->task) == NGX_OK) {
+            return;
+        }
+
+        q->rc = NGX_ERROR;
+        ngx_http_robonope_log_done(mcf);
+        return;
+    }
+#endif
+
+    q->rc = ngx_http_robonope_log_write(mcf);
+    ngx_http_robonope_log_done(mcf);
+}
+
+static void
+ngx_http_robonope_log_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_robonope_main_conf_t *mcf = ev->data;
+
+    // Also runs with nothing pending to flush rows left in the DuckDB appender
+    if (!mcf->log_queue->busy
+        && (mcf->log_queue->npending > 0 || mcf->log_queue->appended > 0))
+    {
+        ngx_http_robonope_log_flush(mcf);
+    }
+}
+
+/*
+ * Account for the finished batch, runs on the event loop.  Rows the DuckDB
+ * appender still holds are not written yet, they are counted with the
+ * batch that flushes them or loses them.
+ */
+static void
+ngx_http_robonope_log_done(ngx_http_robonope_main_conf_t *mcf)
+{
+    ngx_http_robonope_log_queue_t *q = mcf->log_queue;
+    ngx_uint_t n;
+
+    n = (q->appended > 0) ? 0 : q->held + q->nwriting;
+
+    if (mcf->status_slot != NULL) {
+        mcf->status_slot->log_queued -= q->nwriting;
+
+        if (q->rc == NGX_OK) {
+            mcf->status_slot->log_written += n;
+        } else {
+            mcf->status_slot->log_failed += n;
+        }
+    }
+
+    if (q->rc == NGX_OK) {
+        q->written += n;
+    } else {
+        q->failed += n;
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "robonope failed to log %ui requests to \"%V\"",
+                      n, &q->db_path);
+    }
+
+    if (q->dropped != q->reported) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "robonope log queue full, %ui requests not logged",
+                      q->dropped - q->reported);
+        q->reported = q->dropped;
+    }
+
+    q->nwriting = 0;
+    q->busy = 0;
+
+    if (q->npending == 0) {
+        // Rows the appender still holds are flushed once they are old enough
+        if (q->appended > 0 && !q->flush.timer_set) {
+            ngx_add_timer(&q->flush, q->flush_interval);
+        }
+        return;
+    }
+
+#if (NGX_THREADS)
+    if (q->thread_pool != NULL && !q->aggregate) {
+        ngx_http_robonope_log_flush(mcf);
+        return;
+    }
+#endif
+
+    if (!q->flush.timer_set) {
+        ngx_add_timer(&q->flush, q->aggregate ? q->flush_interval : 1000);
+    }
+}
+
+#if (NGX_THREADS)
+
+static void
+ngx_http_robonope_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_robonope_main_conf_t *mcf = data;
+
+    mcf->log_queue->rc = ngx_http_robonope_log_write(mcf);
+}
+
+static void
+ngx_http_robonope_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_robonope_log_done(ev->data);
+}
+
+#endif
+
+/*
+ * Write the batch in q->writing in a single transaction, or append it to
+ * the binary log.  Called from the thread pool, so it only touches the
+ * database or the segment file and the batch itself.
+ */
+static ngx_int_t
+ngx_http_robonope_log_write(ngx_http_robonope_main_conf_t *mcf)
+{
+    ngx_http_robonope_log_queue_t *q = mcf->log_queue;
+    ngx_http_robonope_log_record_t *rec;
+    ngx_uint_t i;
+
+    if (q->binlog != NULL) {
+        return ngx_http_robonope_binlog_write(q->binlog, q->writing, q->nwriting, ngx_cycle->log);
+    }
+
+    if (mcf->db == NULL && ngx_http_robonope_init_db(mcf, &q->db_path) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#ifdef ROBONOPE_USE_DUCKDB
+    /*
+     * Rows go through an appender, which stores them in columnar chunks
+     * without parsing or planning a statement per row.  The appender keeps
+     * them across batches and is flushed, committing them, when enough
+     * rows or enough time have gathered.  Rows lost to a failed flush are
+     * counted as failed with the batch that flushed them.
+     */
+    duckdb_appender appender = q->appender;
+    duckdb_timestamp ts;
+
+    if (q->aggregate) {
+        duckdb_prepared_statement stmt = q->stmt;
+        duckdb_timestamp bucket, first, last;
+        u_char fingerprint[32];
+
+        if (duckdb_query(q->conn, "BEGIN TRANSACTION;", NULL) != DuckDBSuccess) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < q->nwriting; i++) {
+            rec = &q->writing[i];
+
+            ngx_hex_dump(fingerprint, rec->fingerprint, sizeof(rec->fingerprint));
+            bucket.micros = (int64_t) (rec->time / q->bucket * q->bucket) * 1000;
+            first.micros = (int64_t) rec->time * 1000;
+            last.micros = (int64_t) rec->last * 1000;
+
+            if (duckdb_bind_varchar_length(stmt, 1, (char *) fingerprint, sizeof(fingerprint)) != DuckDBSuccess
+                || duckdb_bind_varchar_length(stmt, 2, (char *) rec->pattern, rec->pattern_len) != DuckDBSuccess
+                || duckdb_bind_timestamp(stmt, 3, bucket) != DuckDBSuccess
+                || duckdb_bind_varchar_length(stmt, 4, (char *) rec->ip, rec->ip_len) != DuckDBSuccess
+                || duckdb_bind_varchar_length(stmt, 5, (char *) rec->user_agent, rec->user_agent_len) != DuckDBSuccess
+                || duckdb_bind_varchar_length(stmt, 6, (char *) rec->url, rec->url_len) != DuckDBSuccess
+                || duckdb_bind_int64(stmt, 7, rec->hits) != DuckDBSuccess
+                || duckdb_bind_timestamp(stmt, 8, first) != DuckDBSuccess
+                || duckdb_bind_timestamp(stmt, 9, last) != DuckDBSuccess
+                || duckdb_execute_prepared(stmt, NULL) != DuckDBSuccess)
+            {
+                duckdb_query(q->conn, "ROLLBACK;", NULL);
+                return NGX_ERROR;
+            }
+        }
+
+        if (duckdb_query(q->conn, "COMMIT;", NULL) != DuckDBSuccess) {
+            duckdb_query(q->conn, "ROLLBACK;", NULL);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    if (appender == NULL) {
+        if (duckdb_appender_create(q->conn, NULL, "requests", &appender) != DuckDBSuccess) {
+            goto failed;
+        }
+        q->appender = appender;
+    }
+
+    for (i = 0; i < q->nwriting; i++) {
+        rec = &q->writing[i];
+        ts.micros = (int64_t) rec->time * 1000;
+
+        if (duckdb_append_timestamp(appender, ts) != DuckDBSuccess
+            || duckdb_append_varchar_length(appender, (char *) rec->ip, rec->ip_len) != DuckDBSuccess
+            || duckdb_append_varchar_length(appender, (char *) rec->user_agent, rec->user_agent_len) != DuckDBSuccess
+            || duckdb_append_varchar_length(appender, (char *) rec->url, rec->url_len) != DuckDBSuccess
+            || duckdb_append_varchar_length(appender, (char *) rec->pattern, rec->pattern_len) != DuckDBSuccess
+            || duckdb_appender_end_row(appender) != DuckDBSuccess)
+        {
+            goto failed;
+        }
+
+        if (q->appended++ == 0) {
+            q->appended_at = q->now;
+        }
+    }
+
+    if (q->appended == 0
+        || (q->appended < q->flush_rows
+            && q->now - q->appended_at < q->flush_interval
+            && !q->closing))
+    {
+        return NGX_OK;
+    }
+
+    if (duckdb_appender_flush(appender) == DuckDBSuccess) {
+        q->appended = 0;
+        return NGX_OK;
+    }
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "robonope DuckDB appender: %s",
+                  appender ? duckdb_appender_error(appender) : "not created");
+
+    // An appender that failed is unusable, a new one is created next batch
+    duckdb_appender_destroy(&appender);
+    q->appender = NULL;
+    q->appended = 0;
+
+    return NGX_ERROR;
+
+#else
+    sqlite3 *db = mcf->db;
+    sqlite3_stmt *stmt = q->stmt;
+    u_char fingerprint[32];
+
+    if (sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < q->nwriting; i++) {
+        rec = &q->writing[i];
+
+        if (q->aggregate) {
+            // Adds the record's count to the row of its key, times in seconds
+            ngx_hex_dump(fingerprint, rec->fingerprint, sizeof(rec->fingerprint));
+
+            sqlite3_bind_text(stmt, 1, (char *) fingerprint, sizeof(fingerprint), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 2, (char *) rec->pattern, rec->pattern_len, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64) (rec->time / q->bucket * q->bucket / 1000));
+            sqlite3_bind_text(stmt, 4, (char *) rec->ip, rec->ip_len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 5, (char *) rec->user_agent, rec->user_agent_len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 6, (char *) rec->url, rec->url_len, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 7, rec->hits);
+            sqlite3_bind_int64(stmt, 8, (sqlite3_int64) (rec->time / 1000));
+            sqlite3_bind_int64(stmt, 9, (sqlite3_int64) (rec->last / 1000));
+
+        } else {
+            // The time of the request, not of the batch, in seconds with milliseconds
+            sqlite3_bind_double(stmt, 1, (double) rec->time / 1000);
+            sqlite3_bind_text(stmt, 2, (char *) rec->ip, rec->ip_len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 3, (char *) rec->user_agent, rec->user_agent_len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 4, (char *) rec->url, rec->url_len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 5, (char *) rec->pattern, rec->pattern_len, SQLITE_STATIC);
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            sqlite3_reset(stmt);
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            return NGX_ERROR;
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return NGX_ERROR;
+    }
+#endif
+
+    return NGX_OK;
+}
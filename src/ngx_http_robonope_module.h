@@ -8,6 +8,34 @@
 
 /* Module constants */
 #define NGX_HTTP_ROBONOPE_MAX_CACHE 1000
+#define NGX_HTTP_ROBONOPE_ROBOTS_PATH "/etc/nginx/robots.txt"
+#define NGX_HTTP_ROBONOPE_DB_PATH "/var/lib/nginx/robonope.db"
+#define NGX_HTTP_ROBONOPE_LOG_QUEUE 1024
+#define NGX_HTTP_ROBONOPE_DB_BUSY_TIMEOUT 5000      /* SQLite lock wait on the thread pool, ms */
+#define NGX_HTTP_ROBONOPE_DB_BUSY_TIMEOUT_LOOP 100  /* and on the event loop */
+#define NGX_HTTP_ROBONOPE_LOG_FLUSH_ROWS 10000
+#define NGX_HTTP_ROBONOPE_LOG_FLUSH_INTERVAL 5000
+#define NGX_HTTP_ROBONOPE_LOG_PATH "/var/lib/nginx/robonope"
+
+/* Where the request log goes, robonope_log_format */
+#define NGX_HTTP_ROBONOPE_LOG_DATABASE  0
+#define NGX_HTTP_ROBONOPE_LOG_BINARY    1
+#define NGX_HTTP_ROBONOPE_LOG_AGGREGATE 2
+
+#define NGX_HTTP_ROBONOPE_LOG_BUCKET 3600000  /* Aggregation time bucket, ms */
+
+/* Responses to a client already in the offender cache */
+#define NGX_HTTP_ROBONOPE_OFFENDER_OFF       0
+#define NGX_HTTP_ROBONOPE_OFFENDER_HONEYPOT  1
+#define NGX_HTTP_ROBONOPE_OFFENDER_FORBIDDEN 2
+#define NGX_HTTP_ROBONOPE_OFFENDER_CLOSE     3
+
+/* Responses to a client fetching faster than its Crawl-delay */
+#define NGX_HTTP_ROBONOPE_CRAWL_DELAY_OFF       0
+#define NGX_HTTP_ROBONOPE_CRAWL_DELAY_429       1
+#define NGX_HTTP_ROBONOPE_CRAWL_DELAY_HONEYPOT  2
+
+#define NGX_HTTP_ROBONOPE_CRAWL_DELAY_MAX  86400000  /* Longest Crawl-delay kept, in milliseconds */
 
 /* Include NGINX headers */
 #include <ngx_config.h>
@@ -15,8 +43,10 @@
 #include <ngx_http.h>
 #include <ngx_md5.h>
 
+#include "ngx_http_robonope_binlog.h"
+
 #ifdef ROBONOPE_USE_DUCKDB
-typedef void* duckdb_connection;
+typedef struct _duckdb_connection *duckdb_connection;
 #else
 typedef struct sqlite3 sqlite3;
 #endif
@@ -33,18 +63,473 @@ typedef struct {
     ngx_str_t user_agent;  /* User agent pattern */
     ngx_array_t *disallow;  /* Array of disallow patterns */
     ngx_array_t *allow;     /* Array of allow patterns */
+    ngx_msec_t crawl_delay; /* Crawl-delay in milliseconds, 0 if none */
 } ngx_http_robonope_robot_entry_t;
 
+/*
+ * Compiled rule table.  The table is built once at configuration time and
+ * lives in a single contiguous block: the header below, followed by the
+ * groups, the user agent index, the rule array, the radix trees used for
+ * matching, and the pattern bytes.  All
+ * references inside the block are offsets from its start, so the request
+ * path only ever reads it.
+ */
+typedef struct {
+    uint32_t     pattern;   /* Offset of the pattern in the string pool */
+    uint32_t     len;       /* Pattern length */
+    u_char       allow;     /* Allow rule, Disallow otherwise */
+} ngx_http_robonope_rule_t;
+
+/* Radix tree node, see ngx_http_robonope_matcher.c */
+typedef struct {
+    uint32_t     label;     /* Offset of the edge label in the string pool */
+    uint32_t     len;       /* Edge label length */
+    uint32_t     child;     /* Index of the first child node */
+    uint32_t     rule;      /* Index + 1 of the rule ending here, 0 if none */
+    uint32_t     anchored;  /* Same, for a rule ending here with "$" */
+    uint32_t     star;      /* Index of the "*" child node, 0 if none */
+    uint16_t     nchildren; /* Number of literal child nodes */
+    u_char       key;       /* First byte of the edge label */
+} ngx_http_robonope_node_t;
+
+/* Rules that apply to one user agent product token */
+typedef struct {
+    uint32_t     root;      /* Index of the group's radix tree root */
+    uint32_t     rules;     /* Index of the group's first rule */
+    uint32_t     nrules;    /* Number of rules in the group */
+    uint32_t     crawl_delay; /* Crawl-delay in milliseconds, 0 if none */
+    uint32_t     name;      /* Offset of the product token in the string pool */
+    uint32_t     len;       /* Token length, 0 for the "*" group */
+} ngx_http_robonope_group_t;
+
+/* User agent index slot, open addressing with linear probing */
+typedef struct {
+    uint32_t     hash;      /* Hash of the lowercased product token */
+    uint32_t     name;      /* Offset of the token in the string pool */
+    uint32_t     len;       /* Token length, 0 for an empty slot */
+    uint32_t     group;     /* Index of the group */
+} ngx_http_robonope_agent_t;
+
+#define NGX_HTTP_ROBONOPE_NO_GROUP  0xffffffff
+
+typedef struct {
+    size_t       size;      /* Size of the whole block */
+    uint32_t     nrules;    /* Number of rules */
+    uint32_t     nnodes;    /* Number of radix tree nodes */
+    uint32_t     nstates;   /* Most positions active at once while matching */
+    uint32_t     nstars;    /* Most "*" nodes in one group */
+    uint32_t     ngroups;   /* Number of groups */
+    uint32_t     nagents;   /* Number of user agent index slots, a power of 2 */
+    uint32_t     agent_min; /* Shortest indexed token */
+    uint32_t     agent_max; /* Longest indexed token */
+    uint32_t     default_group; /* Group for "User-agent: *" */
+    uint32_t     groups;    /* Offset of the group array */
+    uint32_t     agents;    /* Offset of the user agent index */
+    uint32_t     rules;     /* Offset of the rule array */
+    uint32_t     nodes;     /* Offset of the radix tree */
+    uint32_t     strings;   /* Offset of the string pool */
+} ngx_http_robonope_ruleset_t;
+
+#define ngx_http_robonope_ruleset_ptr(rs, off)                                \
+    ((u_char *) (rs) + (off))
+
+#define ngx_http_robonope_ruleset_groups(rs)                                  \
+    ((ngx_http_robonope_group_t *) ngx_http_robonope_ruleset_ptr(rs, (rs)->groups))
+
+#define ngx_http_robonope_ruleset_agents(rs)                                  \
+    ((ngx_http_robonope_agent_t *) ngx_http_robonope_ruleset_ptr(rs, (rs)->agents))
+
+#define ngx_http_robonope_ruleset_rules(rs)                                   \
+    ((ngx_http_robonope_rule_t *) ngx_http_robonope_ruleset_ptr(rs, (rs)->rules))
+
+#define ngx_http_robonope_ruleset_nodes(rs)                                   \
+    ((ngx_http_robonope_node_t *) ngx_http_robonope_ruleset_ptr(rs, (rs)->nodes))
+
+#define ngx_http_robonope_rule_pattern(rs, rule)                              \
+    (ngx_http_robonope_ruleset_ptr(rs, (rs)->strings) + (rule)->pattern)
+
+#define ngx_http_robonope_group_name(rs, group)                               \
+    (ngx_http_robonope_ruleset_ptr(rs, (rs)->strings) + (group)->name)
+
+/* Match position: a node and the number of its label bytes matched */
+typedef struct {
+    uint32_t     node;
+    uint32_t     off;
+} ngx_http_robonope_state_t;
+
+/* Scratch needed by ngx_http_robonope_match(): active stars, two position sets */
+#define ngx_http_robonope_match_scratch_size(rs)                              \
+    ((rs)->nstars * sizeof(uint32_t)                                          \
+     + 2 * (rs)->nstates * sizeof(ngx_http_robonope_state_t))
+
+/*
+ * Request log record.  The fields are copied out of the request, truncated
+ * if needed, so the writer never touches request memory.
+ */
+#define NGX_HTTP_ROBONOPE_LOG_IP_LEN       64
+#define NGX_HTTP_ROBONOPE_LOG_UA_LEN       256
+#define NGX_HTTP_ROBONOPE_LOG_URL_LEN      512
+#define NGX_HTTP_ROBONOPE_LOG_PATTERN_LEN  128
+
+typedef struct {
+    uint64_t     time;           /* Unix time in milliseconds */
+    uint64_t     last;           /* Time of the last request counted */
+    uint32_t     hits;           /* Requests counted, 1 unless aggregating */
+    uint16_t     ip_len;
+    uint16_t     user_agent_len;
+    uint16_t     url_len;
+    uint16_t     pattern_len;
+    u_char       family;         /* Address family as in the binary log */
+    u_char       addr[16];
+    u_char       fingerprint[16];
+    u_char       ip[NGX_HTTP_ROBONOPE_LOG_IP_LEN];
+    u_char       user_agent[NGX_HTTP_ROBONOPE_LOG_UA_LEN];
+    u_char       url[NGX_HTTP_ROBONOPE_LOG_URL_LEN];
+    u_char       pattern[NGX_HTTP_ROBONOPE_LOG_PATTERN_LEN];
+} ngx_http_robonope_log_record_t;
+
+/*
+ * Binary log writer, "robonope_log_format binary".  Owned by the log writer
+ * like the prepared statement.  A batch is encoded into buf and written
+ * with as few writes as the buffer allows; the interned strings of the
+ * current segment are kept in an open addressing table over an arena, and
+ * the segment rotates when either fills up or it reaches max_size.
+ */
+#define NGX_HTTP_ROBONOPE_BINLOG_BUFFER   262144
+#define NGX_HTTP_ROBONOPE_BINLOG_STRINGS  16384    /* Strings per segment */
+#define NGX_HTTP_ROBONOPE_BINLOG_ARENA    2097152  /* Bytes of strings per segment */
+
+typedef struct {
+    uint32_t     hash;
+    uint32_t     id;            /* 0 for a free slot */
+    uint32_t     off;           /* In the arena */
+    uint32_t     len;
+} ngx_http_robonope_binlog_intern_t;
+
+typedef struct {
+    ngx_str_t    path;          /* Directory of the segment files */
+    size_t       max_size;      /* Rotate once a segment is this large */
+    ngx_fd_t     fd;            /* Current segment, NGX_INVALID_FILE if none */
+    size_t       size;          /* Bytes in the segment, buffered ones included */
+    ngx_uint_t   seq;           /* Segments opened by this worker */
+    u_char      *name;          /* Path of the current segment */
+    u_char      *buf;
+    size_t       used;
+    ngx_http_robonope_binlog_intern_t *strings;  /* 2 * BINLOG_STRINGS slots */
+    uint32_t     nstrings;
+    u_char      *arena;
+    size_t       arena_used;
+} ngx_http_robonope_binlog_t;
+
+/*
+ * Per-worker log queue.  Requests append to the pending buffer; when the
+ * writer is idle the buffers are swapped and the whole batch is written in
+ * one transaction, off the event loop when a thread pool is available.
+ * Records arriving while the pending buffer is full are dropped and counted.
+ */
+typedef struct {
+    ngx_http_robonope_log_record_t *pending;  /* Filled by the event loop */
+    ngx_http_robonope_log_record_t *writing;  /* Owned by the writer while busy */
+    ngx_uint_t   npending;
+    ngx_uint_t   nwriting;
+    ngx_uint_t   size;      /* Capacity of each buffer */
+    ngx_uint_t   busy;      /* A batch is being written */
+    ngx_int_t    rc;        /* Result of the last batch */
+    ngx_uint_t   written;   /* Records stored */
+    ngx_uint_t   failed;    /* Records lost to database errors */
+    ngx_uint_t   dropped;   /* Records dropped on a full queue */
+    ngx_uint_t   reported;  /* Dropped records already logged */
+    ngx_str_t    db_path;
+    void        *stmt;      /* Prepared INSERT */
+    void        *conn;      /* DuckDB connection, opened by the worker */
+    void        *appender;  /* DuckDB appender, buffers rows until flushed */
+    ngx_uint_t   appended;  /* Rows in the appender since it was flushed */
+    ngx_uint_t   held;      /* Of them, rows appended before the current batch */
+    ngx_msec_t   appended_at;     /* Hand-over time of the oldest of them */
+    ngx_uint_t   flush_rows;      /* Flush the appender at this many rows */
+    ngx_msec_t   flush_interval;  /* or once the oldest row is this old */
+    ngx_msec_t   now;       /* Time the batch was handed to the writer */
+    unsigned     closing:1; /* The worker is exiting, flush everything */
+    unsigned     aggregate:1;     /* One counting record per key and bucket */
+    ngx_msec_t   bucket;    /* Aggregation time bucket */
+    uint32_t    *index;     /* Aggregation key hash to pending record + 1 */
+    ngx_uint_t   index_mask;
+    ngx_http_robonope_binlog_t *binlog;  /* Binary log, NULL for the database */
+    ngx_event_t  flush;     /* Flush timer when no thread pool is used */
+#if (NGX_THREADS)
+    ngx_thread_pool_t *thread_pool;
+    ngx_thread_task_t *task;
+#endif
+} ngx_http_robonope_log_queue_t;
+
+/*
+ * Offender cache, shared by all workers.  Entries are keyed by the MD5
+ * fingerprint of client address and User-Agent, kept in an rbtree for
+ * lookup and in a queue ordered by last use for eviction.
+ */
+typedef struct {
+    ngx_rbtree_node_t node;     /* key is the first bytes of the fingerprint */
+    ngx_queue_t  queue;         /* LRU link, most recently used first */
+    time_t       expire;        /* Entry is stale after this time */
+    u_char       fingerprint[16];
+} ngx_http_robonope_cache_node_t;
+
+typedef struct {
+    ngx_rbtree_t      rbtree;
+    ngx_rbtree_node_t sentinel;
+    ngx_queue_t       lru;
+    ngx_uint_t        nentries;
+} ngx_http_robonope_cache_sh_t;
+
+typedef struct {
+    ngx_http_robonope_cache_sh_t *sh;
+    ngx_slab_pool_t *shpool;
+    time_t       ttl;           /* Seconds an entry stays valid */
+    ngx_uint_t   max;           /* Most entries kept */
+} ngx_http_robonope_cache_t;
+
+/* Random stream for deterministic pages, xoshiro256** */
+typedef struct {
+    uint64_t     s[4];
+} ngx_http_robonope_rng_t;
+
+/* Word Markov model, see ngx_http_robonope_compile_markov() */
+#define NGX_HTTP_ROBONOPE_MARKOV_WORD  48          /* Longest word kept */
+#define NGX_HTTP_ROBONOPE_MARKOV_END   0xffffffff  /* No next state */
+
+typedef struct {
+    uint32_t     off;       /* Offset of the word in the string pool */
+    uint32_t     len;
+} ngx_http_robonope_markov_word_t;
+
+/* Pair of consecutive words */
+typedef struct {
+    uint32_t     w1;
+    uint32_t     w2;
+    uint32_t     first;     /* Index of the first transition */
+    uint32_t     n;         /* Number of transitions */
+} ngx_http_robonope_markov_state_t;
+
+typedef struct {
+    uint32_t     word;      /* Next word */
+    uint32_t     cum;       /* Weight of this and the previous transitions of the state */
+    uint32_t     next;      /* State after the word, NGX_HTTP_ROBONOPE_MARKOV_END at the end of a text */
+} ngx_http_robonope_markov_trans_t;
+
+typedef struct {
+    size_t       size;      /* Size of the whole block */
+    uint32_t     nwords;    /* Number of distinct words */
+    uint32_t     nstates;   /* Number of states */
+    uint32_t     ntrans;    /* Number of transitions */
+    uint32_t     nstarts;   /* Number of start states */
+    uint32_t     max_word;  /* Longest word */
+    uint32_t     words;     /* Offset of the word table */
+    uint32_t     states;    /* Offset of the state array */
+    uint32_t     trans;     /* Offset of the transition array */
+    uint32_t     starts;    /* Offset of the start state indexes */
+    uint32_t     strings;   /* Offset of the string pool */
+} ngx_http_robonope_markov_t;
+
+#define ngx_http_robonope_markov_ptr(m, off)                                  \
+    ((u_char *) (m) + (off))
+
+#define ngx_http_robonope_markov_words(m)                                     \
+    ((ngx_http_robonope_markov_word_t *) ngx_http_robonope_markov_ptr(m, (m)->words))
+
+#define ngx_http_robonope_markov_states(m)                                    \
+    ((ngx_http_robonope_markov_state_t *) ngx_http_robonope_markov_ptr(m, (m)->states))
+
+#define ngx_http_robonope_markov_trans(m)                                     \
+    ((ngx_http_robonope_markov_trans_t *) ngx_http_robonope_markov_ptr(m, (m)->trans))
+
+#define ngx_http_robonope_markov_starts(m)                                    \
+    ((uint32_t *) ngx_http_robonope_markov_ptr(m, (m)->starts))
+
+/* Honeypot template segment, see ngx_http_robonope_load_template() */
+#define NGX_HTTP_ROBONOPE_SEGMENT_STATIC  0
+#define NGX_HTTP_ROBONOPE_SEGMENT_CLASS   1   /* {{class}} */
+#define NGX_HTTP_ROBONOPE_SEGMENT_TEXT    2   /* {{text}} */
+#define NGX_HTTP_ROBONOPE_SEGMENT_LINK    3   /* {{link}} */
+#define NGX_HTTP_ROBONOPE_SEGMENT_MAZE    4   /* {{maze}} */
+#define NGX_HTTP_ROBONOPE_SEGMENTS        5
+
+/* Room for one maze link besides its path prefix and class name */
+#define NGX_HTTP_ROBONOPE_MAZE_LINK       128
+
+typedef struct {
+    ngx_uint_t   type;      /* NGX_HTTP_ROBONOPE_SEGMENT_* */
+    ngx_str_t    text;      /* Text of a static segment */
+} ngx_http_robonope_segment_t;
+
+/* Pre-rendered honeypot page */
+typedef struct {
+    ngx_pool_t  *pool;      /* Holds the page, destroyed with it */
+    ngx_str_t    content;
+    ngx_uint_t   refs;      /* Responses still sending the page */
+    ngx_uint_t   retired;   /* Replaced, freed once refs drops to 0 */
+} ngx_http_robonope_page_t;
+
+struct ngx_http_robonope_main_conf_s;
+struct ngx_http_robonope_loc_conf_s;
+
+/* Per-worker set of pre-rendered pages */
+typedef struct {
+    ngx_http_robonope_page_t **pages;
+    ngx_uint_t   npages;
+    ngx_uint_t   next;      /* Next page to replace */
+    ngx_msec_t   refresh;   /* Time to replace every page, 0 to keep them */
+    ngx_event_t  timer;
+    struct ngx_http_robonope_main_conf_s *mcf;
+    struct ngx_http_robonope_loc_conf_s *lcf;  /* Configuration the pages are rendered for */
+} ngx_http_robonope_page_pool_t;
+
+/* Rules reloaded from a changed robots.txt, see ngx_http_robonope_reload_rules() */
+#define NGX_HTTP_ROBONOPE_RULES_RETIRED  4     /* Old rule sets kept at once */
+#define NGX_HTTP_ROBONOPE_RULES_GRACE    60    /* Seconds an old rule set is kept */
+
+typedef struct {
+    ngx_http_robonope_ruleset_t *volatile current;  /* Latest rules, NULL until robots.txt changes */
+    ngx_atomic_t generation;   /* Bumped with every new rule set */
+    time_t       mtime;        /* robots.txt the latest rules come from */
+    off_t        size;
+    ngx_http_robonope_ruleset_t *retired[NGX_HTTP_ROBONOPE_RULES_RETIRED];
+    time_t       retired_at[NGX_HTTP_ROBONOPE_RULES_RETIRED];
+} ngx_http_robonope_rules_sh_t;
+
+typedef struct {
+    ngx_http_robonope_rules_sh_t *sh;
+    ngx_slab_pool_t *shpool;
+    ngx_str_t    path;         /* robots.txt to watch */
+    ngx_msec_t   interval;     /* Time between checks */
+    time_t       mtime;        /* robots.txt the configuration was built from */
+    off_t        size;
+    ngx_atomic_uint_t generation;  /* Rule sets published before the configuration */
+    ngx_event_t  timer;
+} ngx_http_robonope_rules_zone_t;
+
+/*
+ * Crawl-delay buckets, shared by all workers.  Each slot is one atomic word
+ * holding a tag taken from the client fingerprint and the time the client
+ * may fetch again, see ngx_http_robonope_crawl_delay().
+ */
+#define NGX_HTTP_ROBONOPE_CRAWL_TIME_BITS  40
+#define NGX_HTTP_ROBONOPE_CRAWL_TIME_MASK  ((1ULL << NGX_HTTP_ROBONOPE_CRAWL_TIME_BITS) - 1)
+
 typedef struct {
-    ngx_array_t *cache;
-    ngx_uint_t   cache_index;
-    time_t       last_cleanup;
+    ngx_atomic_t *slots;
+    ngx_uint_t   mask;         /* Number of slots - 1, a power of 2 minus 1 */
+    ngx_slab_pool_t *shpool;
+} ngx_http_robonope_crawl_zone_t;
+
+/* Per-worker tarpit counters */
+typedef struct {
+    ngx_uint_t   max;       /* Most connections held at once */
+    ngx_uint_t   active;    /* Connections held now */
+    ngx_uint_t   started;
+    ngx_uint_t   finished;  /* Body sent to the end */
+    ngx_uint_t   aborted;   /* Client gone or write failed first */
+    ngx_uint_t   rejected;  /* Over the cap, answered at once */
+    off_t        sent;      /* Body bytes drip-fed */
+} ngx_http_robonope_tarpit_stats_t;
+
+/* Response being drip-fed, see ngx_http_robonope_tarpit() */
+typedef struct {
+    ngx_http_request_t *request;
+    ngx_chain_t *in;        /* Body not sent yet */
+    ngx_buf_t   *buf;       /* Chunk being sent */
+    ngx_chain_t  out;
+    ngx_event_t  timer;
+    ngx_msec_t   deadline;  /* Rest of the body is sent at once after this */
+    size_t       rate;      /* Bytes per tick */
+    ngx_msec_t   interval;  /* Time between ticks */
+    ngx_http_robonope_tarpit_stats_t *stats;
+    unsigned     done:1;
+} ngx_http_robonope_tarpit_t;
+
+/*
+ * Status counters, see ngx_http_robonope_status_render().  Every worker
+ * owns one slot in shared memory, padded to whole cache lines, and updates
+ * it with plain stores; slots are only summed when the status is scraped.
+ */
+#define NGX_HTTP_ROBONOPE_STATUS_GROUPS   64   /* Groups counted apart, later ones share the last counter */
+#define NGX_HTTP_ROBONOPE_STATUS_BUCKETS  12   /* Handler latency buckets, the last one is +Inf */
+
+typedef struct {
+    uint64_t     inspected;     /* Requests the access handler checked */
+    uint64_t     crawl_delayed; /* Requests refused for ignoring Crawl-delay */
+    uint64_t     cache_hits;    /* Known offenders answered at once */
+    uint64_t     cache_misses;
+    uint64_t     log_queued;    /* Records pending or being written now */
+    uint64_t     log_written;
+    uint64_t     log_failed;
+    uint64_t     log_dropped;
+    uint64_t     latency_sum;   /* Handler time in nanoseconds */
+    uint64_t     latency[NGX_HTTP_ROBONOPE_STATUS_BUCKETS];
+    uint64_t     blocked_group[NGX_HTTP_ROBONOPE_STATUS_GROUPS];  /* Requests matching a Disallow rule */
+    ngx_http_robonope_tarpit_stats_t tarpit;
+} ngx_http_robonope_status_slot_t;
+
+/*
+ * The zone holds two sets of slots.  Each configuration cycle takes the
+ * set the previous one did not use, so workers shutting down after a
+ * reload never write to the slots of their replacements.
+ */
+typedef struct {
+    u_char      *slots;         /* First slot of the whole table */
+    ngx_uint_t   nslots;        /* Slots in one set, one per worker */
+    ngx_uint_t   first;         /* First slot of this cycle's set */
+    size_t       slot_size;     /* Slot size rounded to cache lines */
+    ngx_uint_t   generation;    /* Configuration cycles since the zone was created */
+    ngx_slab_pool_t *shpool;
+} ngx_http_robonope_status_zone_t;
+
+#define ngx_http_robonope_status_slot(sz, n)                                  \
+    ((ngx_http_robonope_status_slot_t *) ((sz)->slots + (n) * (sz)->slot_size))
+
+/* What the module made of a request, see ngx_http_robonope_classify() */
+#define NGX_HTTP_ROBONOPE_VERDICT_NONE         0   /* Not classified yet */
+#define NGX_HTTP_ROBONOPE_VERDICT_ALLOWED      1
+#define NGX_HTTP_ROBONOPE_VERDICT_DISALLOWED   2   /* Matched a Disallow rule */
+#define NGX_HTTP_ROBONOPE_VERDICT_OFFENDER     3   /* Known offender, answered at once */
+#define NGX_HTTP_ROBONOPE_VERDICT_CRAWL_DELAY  4   /* Fetched faster than its Crawl-delay */
+
+/* Per-request state, shared by the access handler and the variables */
+typedef struct {
+    ngx_uint_t   verdict;       /* NGX_HTTP_ROBONOPE_VERDICT_* */
+    ngx_int_t    group_index;   /* Index of the matching group, NGX_DECLINED if none */
+    ngx_str_t    group;         /* User-agent of the matching group, "*" for the default */
+    ngx_str_t    pattern;       /* Pattern of the matching rule */
+    u_char       fingerprint[16];
+    unsigned     classified:1;  /* group and pattern are set */
+    unsigned     fingerprinted:1;
+} ngx_http_robonope_ctx_t;
+
+typedef struct ngx_http_robonope_main_conf_s {
+    ngx_http_robonope_cache_t *cache;    /* Offender cache, NULL if disabled */
     ngx_array_t *robot_entries;
+    ngx_http_robonope_ruleset_t *rules;  /* Rules compiled from robots.txt */
+    void        *match_scratch;          /* Per-worker matcher state */
+    size_t       match_scratch_size;
+    ngx_http_robonope_rules_zone_t *rules_zone;  /* Rules hot reload, NULL if disabled */
+    ngx_str_t    secret;                 /* Key for deterministic pages and the maze */
+    ngx_http_robonope_crawl_zone_t *crawl_zone;  /* Crawl-delay buckets, NULL if disabled */
+    ngx_flag_t   crawl_delay;            /* Some location enforces Crawl-delay */
+    ngx_http_robonope_log_queue_t *log_queue;  /* Request log, NULL if disabled */
+    ngx_str_t    offender_page;          /* Pre-built page for known offenders */
+    ngx_http_robonope_page_pool_t *page_pool;  /* Pre-rendered pages, NULL if disabled */
+    ngx_array_t *template;               /* Honeypot page segments */
+    ngx_md5_t    content_key;            /* Hash state keying deterministic pages */
+    ngx_http_robonope_markov_t *markov;  /* Text model in shared memory, NULL if disabled */
+    ngx_http_robonope_tarpit_stats_t *tarpit;  /* This worker's tarpit, in its status slot if there is one */
+    ngx_flag_t   status;                 /* Some location serves robonope_status */
+    ngx_http_robonope_status_zone_t *status_zone;  /* Status counters, NULL if disabled */
+    ngx_http_robonope_status_slot_t *status_slot;  /* This worker's counters, NULL if disabled */
+    size_t       maze_prefix;            /* Longest path prefix of a maze link */
     void        *db;
     ngx_pool_t  *cache_pool;
 } ngx_http_robonope_main_conf_t;
 
-typedef struct {
+typedef struct ngx_http_robonope_loc_conf_s {
     ngx_flag_t   enable;             /* Enable/disable the module */
     ngx_str_t    robots_path;        /* Path to robots.txt file */
     ngx_str_t    db_path;            /* Path to database file */
@@ -56,25 +541,75 @@ typedef struct {
     ngx_array_t *disallow_patterns;  /* Patterns to disallow */
     ngx_flag_t   use_lorem_ipsum;    /* Use Lorem Ipsum for content */
     ngx_str_t    instructions_url;   /* URL to redirect to for instructions about robots.txt */
+    ngx_uint_t   log_queue_size;     /* Records buffered per worker before dropping */
+    ngx_str_t    log_thread_pool;    /* Thread pool for the database writer */
+    ngx_uint_t   log_format;         /* Database or binary segment files */
+    ngx_str_t    log_path;           /* Directory of the binary log */
+    size_t       log_segment_size;   /* Binary log segment rotation size */
+    ngx_uint_t   log_flush_rows;     /* DuckDB appender flush threshold in rows */
+    ngx_msec_t   log_flush_interval; /* and in time */
+    ngx_msec_t   log_bucket;         /* Aggregation time bucket */
+    ngx_uint_t   offender_action;    /* Response to known offenders */
+    ngx_str_t    template_path;      /* Honeypot page template file */
+    ngx_flag_t   deterministic;      /* Same page for the same URI */
+    ngx_str_t    secret;             /* Key for deterministic pages */
+    ngx_uint_t   page_pool;          /* Number of pre-rendered pages per worker */
+    ngx_msec_t   page_refresh;       /* Time to re-render the whole page pool */
+    ngx_flag_t   markov;             /* Generate text from the static content */
+    ngx_flag_t   tarpit;             /* Drip-feed honeypot responses */
+    size_t       tarpit_rate;        /* Bytes sent per tarpit interval */
+    ngx_msec_t   tarpit_interval;    /* Time between tarpit writes */
+    ngx_msec_t   tarpit_duration;    /* Time a response is drip-fed for */
+    ngx_uint_t   tarpit_max;         /* Most tarpitted connections per worker */
+    ngx_uint_t   maze;               /* Hidden maze links per page */
+    ngx_msec_t   robots_check;       /* Time between robots.txt change checks */
+    ngx_uint_t   crawl_delay;        /* Response to clients ignoring Crawl-delay */
+    ngx_uint_t   crawl_delay_burst;  /* Fetches allowed ahead of the Crawl-delay */
+    size_t       crawl_delay_zone;   /* Size of the Crawl-delay bucket table */
 } ngx_http_robonope_loc_conf_t;
 
+/* Rule compiler and matcher (ngx_http_robonope_matcher.c) */
+ngx_http_robonope_ruleset_t *ngx_http_robonope_compile_rules(ngx_pool_t *pool, ngx_array_t *entries);
+ngx_int_t ngx_http_robonope_find_group(ngx_http_robonope_ruleset_t *rs, ngx_str_t *user_agent);
+ngx_http_robonope_rule_t *ngx_http_robonope_match(ngx_http_robonope_ruleset_t *rs, ngx_uint_t group, void *scratch, ngx_str_t *uri, ngx_str_t *args);
+ngx_http_robonope_rule_t *ngx_http_robonope_match_request(ngx_http_robonope_ruleset_t *rs, void *scratch, ngx_http_request_t *r, ngx_int_t *group);
+
+/* robots.txt parser (ngx_http_robonope_robots.c) */
+ngx_int_t ngx_http_robonope_parse_robots(ngx_pool_t *pool, ngx_array_t *entries, ngx_str_t *path);
+ngx_int_t ngx_http_robonope_read_robots(ngx_pool_t *pool, ngx_array_t *entries, ngx_str_t *path);
+ngx_int_t ngx_http_robonope_parse_robots_text(ngx_pool_t *pool, ngx_array_t *entries, u_char *p, size_t len);
+
+/* Random stream and text model (ngx_http_robonope_text.c) */
+void ngx_http_robonope_rng_seed(ngx_http_robonope_rng_t *rng, u_char *key);
+ngx_uint_t ngx_http_robonope_random(ngx_http_robonope_rng_t *rng);
+ngx_http_robonope_markov_t *ngx_http_robonope_compile_markov(ngx_pool_t *pool, ngx_array_t *texts);
+ngx_int_t ngx_http_robonope_markov_generate(ngx_http_robonope_markov_t *m, ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_uint_t words, ngx_str_t *text);
+
+/* Honeypot content (ngx_http_robonope_content.c) */
+u_char *ngx_http_robonope_generate_class_name(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng);
+ngx_int_t ngx_http_robonope_generate_random_text(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_uint_t words, ngx_str_t *text);
+ngx_str_t *ngx_http_robonope_generate_honeypot_link(ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_str_t *base_url, ngx_http_robonope_ruleset_t *rs, ngx_http_robonope_loc_conf_t *lcf);
+ngx_http_robonope_rule_t *ngx_http_robonope_pick_disallow(ngx_http_robonope_ruleset_t *rs, ngx_uint_t start);
+size_t ngx_http_robonope_rule_prefix(ngx_http_robonope_ruleset_t *rs, ngx_http_robonope_rule_t *rule);
+ngx_int_t ngx_http_robonope_generate_maze(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_rng_t *rng, ngx_uint_t links, ngx_str_t *uri, ngx_str_t *class_name, ngx_str_t *maze);
+ngx_int_t ngx_http_robonope_honeypot_values(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_http_robonope_rng_t *rng, ngx_str_t *uri, ngx_str_t *honeypot_link, ngx_str_t *values);
+ngx_int_t ngx_http_robonope_render_honeypot(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf, ngx_http_robonope_loc_conf_t *lcf, ngx_str_t *honeypot_link, ngx_str_t *page);
+
+/* Request log records (ngx_http_robonope_log.c) */
+void ngx_http_robonope_fingerprint(ngx_http_request_t *r, u_char *fingerprint);
+ngx_http_robonope_log_record_t *ngx_http_robonope_log_push(ngx_http_robonope_log_queue_t *q, ngx_http_request_t *r, ngx_str_t *matched_pattern, u_char *fingerprint);
+ngx_http_robonope_log_record_t *ngx_http_robonope_log_count(ngx_http_robonope_log_queue_t *q, ngx_http_request_t *r, ngx_str_t *matched_pattern, u_char *fingerprint);
+ngx_int_t ngx_http_robonope_binlog_init(ngx_http_robonope_binlog_t *bl, ngx_pool_t *pool);
+ngx_int_t ngx_http_robonope_binlog_write(ngx_http_robonope_binlog_t *bl, ngx_http_robonope_log_record_t *rec, ngx_uint_t n, ngx_log_t *log);
+void ngx_http_robonope_binlog_close(ngx_http_robonope_binlog_t *bl, ngx_log_t *log);
+
+/* Status counters (ngx_http_robonope_status.c) */
+uint64_t ngx_http_robonope_status_now(void);
+void ngx_http_robonope_status_latency(ngx_http_robonope_status_slot_t *slot, uint64_t ns);
+ngx_int_t ngx_http_robonope_status_render(ngx_pool_t *pool, ngx_http_robonope_status_zone_t *sz, ngx_http_robonope_ruleset_t *rs, ngx_chain_t *out, off_t *len);
+
 /* Function prototypes */
 #ifdef NGINX_BUILD
-static ngx_int_t ngx_http_robonope_load_robots(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *robots_path);
-static ngx_int_t ngx_http_robonope_init_db(ngx_http_robonope_main_conf_t *mcf, ngx_str_t *db_path);
-static ngx_int_t ngx_http_robonope_init_cache(ngx_http_robonope_main_conf_t *mcf);
-static ngx_int_t ngx_http_robonope_cache_lookup(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
-static void ngx_http_robonope_cache_insert(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
-static void ngx_http_robonope_cache_cleanup(ngx_http_robonope_main_conf_t *mcf);
-static ngx_int_t ngx_http_robonope_log_request(
-#ifdef ROBONOPE_USE_DUCKDB
-    duckdb_connection conn,
-#else
-    sqlite3 *db,
-#endif
-    ngx_http_request_t *r,
-    ngx_str_t *matched_pattern);
-
 /* Externals needed by the implementation */
 extern ngx_module_t ngx_http_module;
 
@@ -88,7 +623,7 @@ ngx_int_t ngx_http_robonope_log_request(duckdb_connection conn, ngx_http_request
 #else
 ngx_int_t ngx_http_robonope_log_request(sqlite3 *db, ngx_http_request_t *r, ngx_str_t *matched_pattern);
 #endif
-ngx_int_t ngx_http_robonope_init_cache(ngx_http_robonope_main_conf_t *mcf);
+ngx_int_t ngx_http_robonope_init_cache(ngx_conf_t *cf, ngx_http_robonope_main_conf_t *mcf);
 ngx_int_t ngx_http_robonope_cache_lookup(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
 void ngx_http_robonope_cache_insert(ngx_http_robonope_main_conf_t *mcf, u_char *fingerprint);
 #endif /* NGINX_BUILD */
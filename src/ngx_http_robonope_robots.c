@@ -0,0 +1,485 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * robots.txt parser.
+ *
+ * The file is mapped rather than read, and parsed in one pass by a small
+ * state machine.  Nothing is copied: user agents and patterns are recorded
+ * as slices of the mapping, which stays mapped for the life of the pool the
+ * entries are allocated from.  The only allocations are the entry array and
+ * one pair of pattern arrays per group.  A file watched for changes is read
+ * into the pool instead, see ngx_http_robonope_read_robots().
+ *
+ * Following RFC 9309, lines end with LF, CR LF or CR, "#" starts a comment
+ * anywhere on a line, and whitespace around keys and values is ignored.
+ * A group is one or more consecutive User-agent lines followed by their
+ * rules, so the next User-agent line after a rule starts a new group.  An
+ * empty Disallow adds no rule but still ends the list of user agents, and
+ * gives those agents a group of their own that allows everything.
+ * Crawl-delay, in seconds with an optional fraction, is kept per group in
+ * milliseconds.  Lines with other keys, such as Sitemap, are skipped
+ * without ending a group, and rules before the first User-agent line
+ * belong to no group.
+ */
+
+typedef struct {
+    ngx_pool_t                       *pool;
+    ngx_array_t                      *entries;
+    ngx_http_robonope_robot_entry_t  *group;   /* First entry of the group */
+    ngx_uint_t                        in_rules;
+} ngx_http_robonope_robots_ctx_t;
+
+typedef struct {
+    void     *addr;
+    size_t    size;
+} ngx_http_robonope_robots_map_t;
+
+static ngx_int_t ngx_http_robonope_robots_line(
+    ngx_http_robonope_robots_ctx_t *ctx, u_char *key, size_t key_len,
+    u_char *value, size_t value_len);
+static void ngx_http_robonope_robots_delay(ngx_http_robonope_robots_ctx_t *ctx,
+    u_char *value, size_t value_len);
+static void ngx_http_robonope_robots_unmap(void *data);
+
+
+ngx_int_t
+ngx_http_robonope_parse_robots(ngx_pool_t *pool, ngx_array_t *entries,
+    ngx_str_t *path)
+{
+    ngx_fd_t                         fd;
+    ngx_file_info_t                  fi;
+    ngx_pool_cleanup_t              *cln;
+    ngx_http_robonope_robots_map_t  *map;
+    size_t                           size;
+    void                            *addr;
+
+    fd = ngx_open_file(path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size == 0) {
+        ngx_close_file(fd);
+        return NGX_OK;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, sizeof(ngx_http_robonope_robots_map_t));
+    if (cln == NULL) {
+        ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    ngx_close_file(fd);
+
+    if (addr == MAP_FAILED) {
+        return NGX_ERROR;
+    }
+
+    map = cln->data;
+    map->addr = addr;
+    map->size = size;
+
+    cln->handler = ngx_http_robonope_robots_unmap;
+
+    return ngx_http_robonope_parse_robots_text(pool, entries, addr, size);
+}
+
+
+/*
+ * Same as ngx_http_robonope_parse_robots(), but the file is read into the
+ * pool with one read() and parsed there.  For a file that may be rewritten
+ * in place while it is parsed: a mapping of a file that is truncated under
+ * it raises SIGBUS, a read only comes up short.
+ */
+ngx_int_t
+ngx_http_robonope_read_robots(ngx_pool_t *pool, ngx_array_t *entries,
+    ngx_str_t *path)
+{
+    u_char           *buf;
+    ssize_t           n;
+    ngx_file_t        file;
+    ngx_file_info_t   fi;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = *path;
+    file.log = pool->log;
+
+    file.fd = ngx_open_file(path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_close_file(file.fd);
+        return NGX_ERROR;
+    }
+
+    if (ngx_file_size(&fi) == 0) {
+        ngx_close_file(file.fd);
+        return NGX_OK;
+    }
+
+    buf = ngx_pnalloc(pool, (size_t) ngx_file_size(&fi));
+    if (buf == NULL) {
+        ngx_close_file(file.fd);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_file(&file, buf, (size_t) ngx_file_size(&fi), 0);
+
+    ngx_close_file(file.fd);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_robonope_parse_robots_text(pool, entries, buf, (size_t) n);
+}
+
+
+ngx_int_t
+ngx_http_robonope_parse_robots_text(ngx_pool_t *pool, ngx_array_t *entries,
+    u_char *p, size_t len)
+{
+    u_char                          *last, *key, *key_end, *value, *value_end;
+    ngx_http_robonope_robots_ctx_t   ctx;
+    enum {
+        sw_line = 0,
+        sw_key,
+        sw_before_colon,
+        sw_before_value,
+        sw_value,
+        sw_skip
+    } state;
+
+    ctx.pool = pool;
+    ctx.entries = entries;
+    ctx.group = NULL;
+    ctx.in_rules = 0;
+
+    last = p + len;
+
+    /* UTF-8 byte order mark */
+    if (len >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf) {
+        p += 3;
+    }
+
+    key = NULL;
+    key_end = NULL;
+    value = NULL;
+    value_end = NULL;
+    state = sw_line;
+
+    for ( /* void */ ; p < last; p++) {
+
+        switch (state) {
+
+        case sw_line:
+            switch (*p) {
+            case ' ':
+            case '\t':
+            case CR:
+            case LF:
+                break;
+            case '#':
+                state = sw_skip;
+                break;
+            default:
+                key = p;
+                state = sw_key;
+                break;
+            }
+            break;
+
+        case sw_key:
+            switch (*p) {
+            case ':':
+                key_end = p;
+                state = sw_before_value;
+                break;
+            case ' ':
+            case '\t':
+                key_end = p;
+                state = sw_before_colon;
+                break;
+            case CR:
+            case LF:
+                state = sw_line;    /* no colon, not a rule */
+                break;
+            case '#':
+                state = sw_skip;
+                break;
+            }
+            break;
+
+        case sw_before_colon:
+            switch (*p) {
+            case ' ':
+            case '\t':
+                break;
+            case ':':
+                state = sw_before_value;
+                break;
+            case CR:
+            case LF:
+                state = sw_line;
+                break;
+            default:
+                state = sw_skip;
+                break;
+            }
+            break;
+
+        case sw_before_value:
+            switch (*p) {
+            case ' ':
+            case '\t':
+                break;
+            case CR:
+            case LF:
+            case '#':
+                if (ngx_http_robonope_robots_line(&ctx, key, key_end - key,
+                                                  p, 0)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                state = (*p == '#') ? sw_skip : sw_line;
+                break;
+            default:
+                value = p;
+                value_end = p + 1;
+                state = sw_value;
+                break;
+            }
+            break;
+
+        case sw_value:
+            switch (*p) {
+            case ' ':
+            case '\t':
+                break;
+            case CR:
+            case LF:
+            case '#':
+                if (ngx_http_robonope_robots_line(&ctx, key, key_end - key,
+                                                  value, value_end - value)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                state = (*p == '#') ? sw_skip : sw_line;
+                break;
+            default:
+                value_end = p + 1;
+                break;
+            }
+            break;
+
+        case sw_skip:
+            if (*p == CR || *p == LF) {
+                state = sw_line;
+            }
+            break;
+        }
+    }
+
+    /* last line without a line break */
+
+    if (state == sw_before_value) {
+        return ngx_http_robonope_robots_line(&ctx, key, key_end - key, p, 0);
+    }
+
+    if (state == sw_value) {
+        return ngx_http_robonope_robots_line(&ctx, key, key_end - key,
+                                             value, value_end - value);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_robonope_robots_line(ngx_http_robonope_robots_ctx_t *ctx,
+    u_char *key, size_t key_len, u_char *value, size_t value_len)
+{
+    ngx_uint_t                        group;
+    ngx_str_t                        *pattern;
+    ngx_array_t                      *list;
+    ngx_http_robonope_robot_entry_t  *entry;
+
+    if (key_len == sizeof("user-agent") - 1
+        && ngx_strncasecmp(key, (u_char *) "user-agent", key_len) == 0)
+    {
+        /*
+         * Consecutive User-agent lines share one group of rules.  The
+         * array may move as it grows, so the group is found again by
+         * index.
+         */
+
+        if (ctx->group != NULL && !ctx->in_rules) {
+            group = ctx->group - (ngx_http_robonope_robot_entry_t *)
+                                 ctx->entries->elts;
+
+            entry = ngx_array_push(ctx->entries);
+            if (entry == NULL) {
+                return NGX_ERROR;
+            }
+
+            ctx->group = (ngx_http_robonope_robot_entry_t *)
+                         ctx->entries->elts + group;
+
+            *entry = *ctx->group;
+
+        } else {
+            entry = ngx_array_push(ctx->entries);
+            if (entry == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(entry, sizeof(ngx_http_robonope_robot_entry_t));
+
+            entry->allow = ngx_array_create(ctx->pool, 4, sizeof(ngx_str_t));
+            entry->disallow = ngx_array_create(ctx->pool, 4,
+                                               sizeof(ngx_str_t));
+
+            if (entry->allow == NULL || entry->disallow == NULL) {
+                return NGX_ERROR;
+            }
+
+            ctx->group = entry;
+            ctx->in_rules = 0;
+        }
+
+        entry->user_agent.data = value;
+        entry->user_agent.len = value_len;
+
+        return NGX_OK;
+    }
+
+    if (key_len == sizeof("allow") - 1
+        && ngx_strncasecmp(key, (u_char *) "allow", key_len) == 0)
+    {
+        list = ctx->group ? ctx->group->allow : NULL;
+
+    } else if (key_len == sizeof("disallow") - 1
+               && ngx_strncasecmp(key, (u_char *) "disallow", key_len) == 0)
+    {
+        list = ctx->group ? ctx->group->disallow : NULL;
+
+    } else if (key_len == sizeof("crawl-delay") - 1
+               && ngx_strncasecmp(key, (u_char *) "crawl-delay", key_len) == 0)
+    {
+        if (ctx->group != NULL) {
+            ngx_http_robonope_robots_delay(ctx, value, value_len);
+            ctx->in_rules = 1;
+        }
+
+        return NGX_OK;
+
+    } else {
+        return NGX_OK;
+    }
+
+    if (list == NULL) {
+        return NGX_OK;
+    }
+
+    ctx->in_rules = 1;
+
+    if (value_len == 0) {
+        return NGX_OK;
+    }
+
+    pattern = ngx_array_push(list);
+    if (pattern == NULL) {
+        return NGX_ERROR;
+    }
+
+    pattern->data = value;
+    pattern->len = value_len;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Seconds with up to three decimals, "10" or "0.5".  Anything else leaves
+ * the group without a delay, and delays over a day are cut to a day.
+ */
+
+static void
+ngx_http_robonope_robots_delay(ngx_http_robonope_robots_ctx_t *ctx,
+    u_char *value, size_t value_len)
+{
+    u_char                           *p, *last;
+    ngx_msec_t                        delay, scale;
+    ngx_http_robonope_robot_entry_t  *entry, *end;
+
+    p = value;
+    last = value + value_len;
+    delay = 0;
+
+    while (p < last && *p >= '0' && *p <= '9') {
+        if (delay < NGX_HTTP_ROBONOPE_CRAWL_DELAY_MAX) {
+            delay = delay * 10 + (*p - '0') * 1000;
+        }
+
+        p++;
+    }
+
+    if (p == value) {
+        return;
+    }
+
+    if (p < last && *p == '.') {
+        p++;
+
+        for (scale = 100; p < last && *p >= '0' && *p <= '9'; p++) {
+            delay += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    if (p != last) {
+        return;
+    }
+
+    if (delay > NGX_HTTP_ROBONOPE_CRAWL_DELAY_MAX) {
+        delay = NGX_HTTP_ROBONOPE_CRAWL_DELAY_MAX;
+    }
+
+    /* every User-agent line of the group has an entry of its own */
+
+    end = (ngx_http_robonope_robot_entry_t *) ctx->entries->elts
+          + ctx->entries->nelts;
+
+    for (entry = ctx->group; entry < end; entry++) {
+        entry->crawl_delay = delay;
+    }
+}
+
+
+static void
+ngx_http_robonope_robots_unmap(void *data)
+{
+    ngx_http_robonope_robots_map_t  *map = data;
+
+    (void) munmap(map->addr, map->size);
+}
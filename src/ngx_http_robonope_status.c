@@ -0,0 +1,312 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * Status counters in the Prometheus text format.  Workers count into their
+ * own slot with plain stores; the slots of all workers, and of the workers
+ * of the previous configuration, are summed here when the status page is
+ * fetched.  A sum may be a few requests behind, but no request path ever
+ * waits for another worker.
+ */
+
+/* Upper bounds of the latency buckets in nanoseconds, the last bucket is +Inf */
+static uint64_t ngx_http_robonope_status_bounds[NGX_HTTP_ROBONOPE_STATUS_BUCKETS - 1] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000
+};
+
+static ngx_str_t ngx_http_robonope_status_le[NGX_HTTP_ROBONOPE_STATUS_BUCKETS] = {
+    ngx_string("0.000001"), ngx_string("0.0000025"), ngx_string("0.000005"),
+    ngx_string("0.00001"), ngx_string("0.000025"), ngx_string("0.00005"),
+    ngx_string("0.0001"), ngx_string("0.00025"), ngx_string("0.0005"),
+    ngx_string("0.001"), ngx_string("0.0025"), ngx_string("+Inf")
+};
+
+typedef struct {
+    ngx_str_t    name;
+    ngx_str_t    type;
+    ngx_str_t    help;
+    size_t       offset;    /* Offset of the counter in the summed slot */
+} ngx_http_robonope_status_metric_t;
+
+#define ngx_http_robonope_status_metric(name, type, help, field)              \
+    { ngx_string(name), ngx_string(type), ngx_string(help),                   \
+      offsetof(ngx_http_robonope_status_slot_t, field) }
+
+static ngx_http_robonope_status_metric_t ngx_http_robonope_status_metrics[] = {
+    ngx_http_robonope_status_metric("robonope_requests_inspected_total",
+        "counter", "Requests checked by the access handler.", inspected),
+    ngx_http_robonope_status_metric("robonope_crawl_delay_refused_total",
+        "counter", "Requests refused for ignoring Crawl-delay.", crawl_delayed),
+    ngx_http_robonope_status_metric("robonope_offender_cache_hits_total",
+        "counter", "Requests from known offenders.", cache_hits),
+    ngx_http_robonope_status_metric("robonope_offender_cache_misses_total",
+        "counter", "Requests looked up in the offender cache and not found.", cache_misses),
+    ngx_http_robonope_status_metric("robonope_log_queue_depth",
+        "gauge", "Request log records queued or being written.", log_queued),
+    ngx_http_robonope_status_metric("robonope_log_written_total",
+        "counter", "Request log records stored in the database.", log_written),
+    ngx_http_robonope_status_metric("robonope_log_failed_total",
+        "counter", "Request log records lost to database errors.", log_failed),
+    ngx_http_robonope_status_metric("robonope_log_dropped_total",
+        "counter", "Request log records dropped on a full queue.", log_dropped),
+};
+
+static ngx_str_t ngx_http_robonope_status_tarpit[] = {
+    ngx_string("# HELP robonope_tarpit_connections Connections held in the tarpit.\n"
+               "# TYPE robonope_tarpit_connections gauge\n"
+               "robonope_tarpit_connections "),
+    ngx_string("# HELP robonope_tarpit_started_total Responses drip-fed.\n"
+               "# TYPE robonope_tarpit_started_total counter\n"
+               "robonope_tarpit_started_total "),
+    ngx_string("# HELP robonope_tarpit_finished_total Drip-fed responses sent to the end.\n"
+               "# TYPE robonope_tarpit_finished_total counter\n"
+               "robonope_tarpit_finished_total "),
+    ngx_string("# HELP robonope_tarpit_aborted_total Drip-fed responses the client did not wait for.\n"
+               "# TYPE robonope_tarpit_aborted_total counter\n"
+               "robonope_tarpit_aborted_total "),
+    ngx_string("# HELP robonope_tarpit_rejected_total Responses sent at once with the tarpit full.\n"
+               "# TYPE robonope_tarpit_rejected_total counter\n"
+               "robonope_tarpit_rejected_total "),
+    ngx_string("# HELP robonope_tarpit_sent_bytes_total Body bytes drip-fed.\n"
+               "# TYPE robonope_tarpit_sent_bytes_total counter\n"
+               "robonope_tarpit_sent_bytes_total ")
+};
+
+static ngx_str_t ngx_http_robonope_status_blocked = ngx_string(
+    "# HELP robonope_requests_blocked_total Requests matching a Disallow rule, by robots.txt group.\n"
+    "# TYPE robonope_requests_blocked_total counter\n");
+
+static ngx_str_t ngx_http_robonope_status_latency_head = ngx_string(
+    "# HELP robonope_handler_duration_seconds Time spent in the access handler.\n"
+    "# TYPE robonope_handler_duration_seconds histogram\n");
+
+static u_char *ngx_http_robonope_status_escape(u_char *p, u_char *src, size_t len);
+
+/* Monotonic time in nanoseconds, for timing the handler */
+uint64_t
+ngx_http_robonope_status_now(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+/* Count one handler run that took "ns" nanoseconds */
+void
+ngx_http_robonope_status_latency(ngx_http_robonope_status_slot_t *slot, uint64_t ns)
+{
+    ngx_uint_t i;
+
+    for (i = 0; i < NGX_HTTP_ROBONOPE_STATUS_BUCKETS - 1; i++) {
+        if (ns <= ngx_http_robonope_status_bounds[i]) {
+            break;
+        }
+    }
+
+    slot->latency[i]++;
+    slot->latency_sum += ns;
+}
+
+/*
+ * Sum the slots and print them.  Blocked requests are labelled with the
+ * group index and its User-agent in the current rules; after robots.txt
+ * changes, counts made under the old rules stay with the same index.
+ */
+ngx_int_t
+ngx_http_robonope_status_render(ngx_pool_t *pool, ngx_http_robonope_status_zone_t *sz, ngx_http_robonope_ruleset_t *rs, ngx_chain_t *out, off_t *len)
+{
+    u_char *p;
+    size_t size;
+    uint64_t *sum, *src, total;
+    ngx_buf_t *b;
+    ngx_uint_t i, k, n, ngroups;
+    ngx_str_t name;
+    ngx_http_robonope_group_t *group;
+    ngx_http_robonope_status_slot_t all, *slot;
+    ngx_http_robonope_tarpit_stats_t *t;
+    ngx_uint_t tarpit[5];
+    off_t sent;
+
+    /*
+     * Everything before the tarpit counters is uint64_t, those are summed
+     * as one array.
+     */
+    ngx_memzero(&all, sizeof(ngx_http_robonope_status_slot_t));
+    ngx_memzero(tarpit, sizeof(tarpit));
+    sum = (uint64_t *) &all;
+    sent = 0;
+
+    for (n = 0; n < 2 * sz->nslots; n++) {
+        slot = ngx_http_robonope_status_slot(sz, n);
+        src = (uint64_t *) slot;
+
+        for (k = 0; k < offsetof(ngx_http_robonope_status_slot_t, tarpit) / sizeof(uint64_t); k++) {
+            sum[k] += src[k];
+        }
+
+        t = &slot->tarpit;
+        tarpit[0] += t->active;
+        tarpit[1] += t->started;
+        tarpit[2] += t->finished;
+        tarpit[3] += t->aborted;
+        tarpit[4] += t->rejected;
+        sent += t->sent;
+    }
+
+    // Groups named in the labels, the last counter also holds every group past it
+    ngroups = 0;
+    group = NULL;
+    size = 0;
+
+    if (rs != NULL) {
+        ngroups = rs->ngroups;
+        if (ngroups > NGX_HTTP_ROBONOPE_STATUS_GROUPS) {
+            ngroups = NGX_HTTP_ROBONOPE_STATUS_GROUPS - 1;
+        }
+
+        group = ngx_http_robonope_ruleset_groups(rs);
+
+        for (i = 0; i < ngroups; i++) {
+            size += 2 * ngx_max(group[i].len, 1);
+        }
+    }
+
+    for (i = 0; i < sizeof(ngx_http_robonope_status_metrics) / sizeof(ngx_http_robonope_status_metric_t); i++) {
+        size += sizeof("# HELP  \n# TYPE  \n \n") - 1
+                + 3 * ngx_http_robonope_status_metrics[i].name.len
+                + ngx_http_robonope_status_metrics[i].help.len
+                + ngx_http_robonope_status_metrics[i].type.len + NGX_INT64_LEN;
+    }
+
+    for (i = 0; i < sizeof(ngx_http_robonope_status_tarpit) / sizeof(ngx_str_t); i++) {
+        size += ngx_http_robonope_status_tarpit[i].len + NGX_OFF_T_LEN + 1;
+    }
+
+    size += ngx_http_robonope_status_blocked.len
+            + NGX_HTTP_ROBONOPE_STATUS_GROUPS
+              * (sizeof("robonope_requests_blocked_total{group=\"+\",user_agent=\"\"} \n") - 1
+                 + NGX_INT_T_LEN + NGX_INT64_LEN);
+
+    size += ngx_http_robonope_status_latency_head.len
+            + NGX_HTTP_ROBONOPE_STATUS_BUCKETS
+              * (sizeof("robonope_handler_duration_seconds_bucket{le=\"0.0000025\"} \n") - 1
+                 + NGX_INT64_LEN)
+            + sizeof("robonope_handler_duration_seconds_sum .\n") - 1 + 2 * NGX_INT64_LEN
+            + sizeof("robonope_handler_duration_seconds_count \n") - 1 + NGX_INT64_LEN;
+
+    b = ngx_create_temp_buf(pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = b->last;
+
+    for (i = 0; i < sizeof(ngx_http_robonope_status_metrics) / sizeof(ngx_http_robonope_status_metric_t); i++) {
+        p = ngx_sprintf(p, "# HELP %V %V\n# TYPE %V %V\n%V %uL\n",
+                        &ngx_http_robonope_status_metrics[i].name,
+                        &ngx_http_robonope_status_metrics[i].help,
+                        &ngx_http_robonope_status_metrics[i].name,
+                        &ngx_http_robonope_status_metrics[i].type,
+                        &ngx_http_robonope_status_metrics[i].name,
+                        *(uint64_t *) ((u_char *) &all + ngx_http_robonope_status_metrics[i].offset));
+    }
+
+    p = ngx_cpymem(p, ngx_http_robonope_status_blocked.data, ngx_http_robonope_status_blocked.len);
+
+    for (i = 0; i < NGX_HTTP_ROBONOPE_STATUS_GROUPS; i++) {
+        if (i >= ngroups && all.blocked_group[i] == 0
+            && (rs == NULL || rs->ngroups <= i))
+        {
+            continue;
+        }
+
+        ngx_str_null(&name);
+
+        if (i < ngroups) {
+            if (group[i].len == 0) {
+                ngx_str_set(&name, "*");
+
+            } else {
+                name.data = ngx_http_robonope_group_name(rs, &group[i]);
+                name.len = group[i].len;
+            }
+        }
+
+        p = ngx_sprintf(p, "robonope_requests_blocked_total{group=\"%ui%s\",user_agent=\"",
+                        i, (i == NGX_HTTP_ROBONOPE_STATUS_GROUPS - 1
+                            && rs != NULL && rs->ngroups > NGX_HTTP_ROBONOPE_STATUS_GROUPS)
+                           ? "+" : "");
+        p = ngx_http_robonope_status_escape(p, name.data, name.len);
+        p = ngx_sprintf(p, "\"} %uL\n", all.blocked_group[i]);
+    }
+
+    for (i = 0; i < sizeof(ngx_http_robonope_status_tarpit) / sizeof(ngx_str_t); i++) {
+        p = ngx_cpymem(p, ngx_http_robonope_status_tarpit[i].data,
+                       ngx_http_robonope_status_tarpit[i].len);
+        p = (i < 5) ? ngx_sprintf(p, "%ui\n", tarpit[i]) : ngx_sprintf(p, "%O\n", sent);
+    }
+
+    p = ngx_cpymem(p, ngx_http_robonope_status_latency_head.data,
+                   ngx_http_robonope_status_latency_head.len);
+
+    total = 0;
+
+    for (i = 0; i < NGX_HTTP_ROBONOPE_STATUS_BUCKETS; i++) {
+        total += all.latency[i];
+        p = ngx_sprintf(p, "robonope_handler_duration_seconds_bucket{le=\"%V\"} %uL\n",
+                        &ngx_http_robonope_status_le[i], total);
+    }
+
+    p = ngx_sprintf(p, "robonope_handler_duration_seconds_sum %uL.%09uL\n"
+                    "robonope_handler_duration_seconds_count %uL\n",
+                    all.latency_sum / 1000000000, all.latency_sum % 1000000000,
+                    total);
+
+    b->last = p;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    out->buf = b;
+    out->next = NULL;
+
+    *len = b->last - b->pos;
+
+    return NGX_OK;
+}
+
+/* Label values escape backslash, double quote and line feed */
+static u_char *
+ngx_http_robonope_status_escape(u_char *p, u_char *src, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (src[i] == '\\' || src[i] == '"') {
+            *p++ = '\\';
+            *p++ = src[i];
+
+        } else if (src[i] == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+
+        } else {
+            *p++ = src[i];
+        }
+    }
+
+    return p;
+}
@@ -0,0 +1,585 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+
+/*
+ * Text sources for honeypot pages: the random stream used by the content
+ * generators, and an order-2 word Markov model trained on the files under
+ * robonope_static_content_path.
+ *
+ * The model is compiled into one contiguous block:
+ *
+ *     model header | word table | states | transitions | start states | word bytes
+ *
+ * A state is a pair of consecutive words.  The transitions of a state are
+ * stored next to each other with cumulative weights, so picking the next
+ * word is a binary search, and each transition holds the index of the state
+ * it leads to, so generating text never looks anything up by word.  As with
+ * the compiled rules, references inside the block are offsets from its
+ * start, so the block can be copied into shared memory as is.
+ */
+
+/* Flag on a token id: the word starts a sentence */
+#define NGX_HTTP_ROBONOPE_MARKOV_START  0x80000000
+#define NGX_HTTP_ROBONOPE_MARKOV_BREAK  0xffffffff
+
+typedef struct {
+    u_char      *data;
+    uint32_t     len;
+    uint32_t     hash;
+} ngx_http_robonope_markov_word_src_t;
+
+typedef struct {
+    uint32_t     w1;
+    uint32_t     w2;
+    uint32_t     w3;
+    uint32_t     start;
+} ngx_http_robonope_trigram_t;
+
+typedef struct {
+    ngx_array_t *words;     /* ngx_http_robonope_markov_word_src_t */
+    ngx_array_t *tokens;    /* uint32_t word ids */
+    uint32_t    *slots;     /* Intern table, word id + 1, 0 if empty */
+    ngx_uint_t   nslots;
+    ngx_pool_t  *pool;
+} ngx_http_robonope_markov_build_t;
+
+#define ngx_http_robonope_rotl(x, k)  (((x) << (k)) | ((x) >> (64 - (k))))
+
+static uint64_t ngx_http_robonope_splitmix64(uint64_t *x);
+static uint64_t ngx_http_robonope_rng_next(ngx_http_robonope_rng_t *rng);
+static ngx_int_t ngx_http_robonope_markov_tokenize(
+    ngx_http_robonope_markov_build_t *b, ngx_str_t *text);
+static ngx_int_t ngx_http_robonope_markov_intern(
+    ngx_http_robonope_markov_build_t *b, u_char *data, size_t len,
+    uint32_t *id);
+static int ngx_libc_cdecl ngx_http_robonope_cmp_trigrams(const void *one,
+    const void *two);
+static uint32_t ngx_http_robonope_markov_find(
+    ngx_http_robonope_markov_state_t *states, uint32_t nstates,
+    uint32_t w1, uint32_t w2);
+
+
+/*
+ * Content generators draw from ngx_random(), or from an xoshiro256** stream
+ * when given one.  The stream is seeded from a keyed hash, so the same key
+ * always renders the same page.
+ */
+
+static uint64_t
+ngx_http_robonope_splitmix64(uint64_t *x)
+{
+    uint64_t z;
+
+    z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+void
+ngx_http_robonope_rng_seed(ngx_http_robonope_rng_t *rng, u_char *key)
+{
+    uint64_t x;
+
+    // Expand the 16 byte key into the 256 bit state
+    ngx_memcpy(&x, key, sizeof(uint64_t));
+    rng->s[0] = ngx_http_robonope_splitmix64(&x);
+    rng->s[1] = ngx_http_robonope_splitmix64(&x);
+
+    ngx_memcpy(&x, key + sizeof(uint64_t), sizeof(uint64_t));
+    rng->s[2] = ngx_http_robonope_splitmix64(&x);
+    rng->s[3] = ngx_http_robonope_splitmix64(&x);
+}
+
+static uint64_t
+ngx_http_robonope_rng_next(ngx_http_robonope_rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result, t;
+
+    result = ngx_http_robonope_rotl(s[1] * 5, 7) * 9;
+    t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = ngx_http_robonope_rotl(s[3], 45);
+
+    return result;
+}
+
+/* Same range as ngx_random(), 31 bits */
+ngx_uint_t
+ngx_http_robonope_random(ngx_http_robonope_rng_t *rng)
+{
+    if (rng == NULL) {
+        return ngx_random();
+    }
+
+    return (ngx_uint_t) (ngx_http_robonope_rng_next(rng) >> 33);
+}
+
+
+ngx_http_robonope_markov_t *
+ngx_http_robonope_compile_markov(ngx_pool_t *pool, ngx_array_t *texts)
+{
+    ngx_http_robonope_markov_build_t b;
+    ngx_http_robonope_markov_t *m;
+    ngx_http_robonope_markov_word_src_t *src;
+    ngx_http_robonope_markov_word_t *words;
+    ngx_http_robonope_markov_state_t *states, *st;
+    ngx_http_robonope_markov_trans_t *trans, *tr;
+    ngx_http_robonope_trigram_t *tri;
+    ngx_str_t *text;
+    uint32_t *tok, *starts, nstates, ntrans, nstarts, cum;
+    ngx_uint_t i, j, ntri, nchars, max_word;
+    u_char *p, *start_flags;
+    size_t size;
+
+    ngx_memzero(&b, sizeof(ngx_http_robonope_markov_build_t));
+    b.pool = pool;
+
+    b.words = ngx_array_create(pool, 1024, sizeof(ngx_http_robonope_markov_word_src_t));
+    b.tokens = ngx_array_create(pool, 4096, sizeof(uint32_t));
+    if (b.words == NULL || b.tokens == NULL) {
+        return NULL;
+    }
+
+    b.nslots = 4096;
+    b.slots = ngx_pcalloc(pool, b.nslots * sizeof(uint32_t));
+    if (b.slots == NULL) {
+        return NULL;
+    }
+
+    text = texts->elts;
+    for (i = 0; i < texts->nelts; i++) {
+        if (ngx_http_robonope_markov_tokenize(&b, &text[i]) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    // Every three consecutive words of a text make one trigram
+    tok = b.tokens->elts;
+    ntri = 0;
+
+    tri = ngx_palloc(pool, (b.tokens->nelts + 1) * sizeof(ngx_http_robonope_trigram_t));
+    if (tri == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i + 2 < b.tokens->nelts; i++) {
+        if (tok[i] == NGX_HTTP_ROBONOPE_MARKOV_BREAK
+            || tok[i + 1] == NGX_HTTP_ROBONOPE_MARKOV_BREAK
+            || tok[i + 2] == NGX_HTTP_ROBONOPE_MARKOV_BREAK)
+        {
+            continue;
+        }
+
+        tri[ntri].w1 = tok[i] & ~NGX_HTTP_ROBONOPE_MARKOV_START;
+        tri[ntri].w2 = tok[i + 1] & ~NGX_HTTP_ROBONOPE_MARKOV_START;
+        tri[ntri].w3 = tok[i + 2] & ~NGX_HTTP_ROBONOPE_MARKOV_START;
+        tri[ntri].start = (tok[i] & NGX_HTTP_ROBONOPE_MARKOV_START) ? 1 : 0;
+        ntri++;
+    }
+
+    ngx_qsort(tri, ntri, sizeof(ngx_http_robonope_trigram_t),
+              ngx_http_robonope_cmp_trigrams);
+
+    nstates = 0;
+    ntrans = 0;
+
+    for (i = 0; i < ntri; i++) {
+        if (i == 0 || tri[i].w1 != tri[i - 1].w1 || tri[i].w2 != tri[i - 1].w2) {
+            nstates++;
+            ntrans++;
+
+        } else if (tri[i].w3 != tri[i - 1].w3) {
+            ntrans++;
+        }
+    }
+
+    src = b.words->elts;
+    nchars = 0;
+    max_word = 0;
+
+    for (i = 0; i < b.words->nelts; i++) {
+        nchars += src[i].len;
+        max_word = ngx_max(max_word, src[i].len);
+    }
+
+    start_flags = ngx_pcalloc(pool, nstates + 1);
+    if (start_flags == NULL) {
+        return NULL;
+    }
+
+    size = sizeof(ngx_http_robonope_markov_t)
+           + b.words->nelts * sizeof(ngx_http_robonope_markov_word_t)
+           + nstates * sizeof(ngx_http_robonope_markov_state_t)
+           + ntrans * sizeof(ngx_http_robonope_markov_trans_t)
+           + nstates * sizeof(uint32_t)
+           + nchars;
+
+    m = ngx_pcalloc(pool, size);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    m->size = size;
+    m->nwords = b.words->nelts;
+    m->nstates = nstates;
+    m->ntrans = ntrans;
+    m->max_word = max_word;
+
+    m->words = sizeof(ngx_http_robonope_markov_t);
+    m->states = m->words + m->nwords * sizeof(ngx_http_robonope_markov_word_t);
+    m->trans = m->states + nstates * sizeof(ngx_http_robonope_markov_state_t);
+    m->starts = m->trans + ntrans * sizeof(ngx_http_robonope_markov_trans_t);
+    m->strings = m->starts + nstates * sizeof(uint32_t);
+
+    words = ngx_http_robonope_markov_words(m);
+    p = ngx_http_robonope_markov_ptr(m, m->strings);
+
+    for (i = 0; i < m->nwords; i++) {
+        words[i].off = p - ngx_http_robonope_markov_ptr(m, m->strings);
+        words[i].len = src[i].len;
+        p = ngx_cpymem(p, src[i].data, src[i].len);
+    }
+
+    // States and their weighted transitions, in trigram order
+    states = ngx_http_robonope_markov_states(m);
+    trans = ngx_http_robonope_markov_trans(m);
+    st = NULL;
+    tr = NULL;
+    cum = 0;
+
+    for (i = 0; i < ntri; i++) {
+        if (i == 0 || tri[i].w1 != tri[i - 1].w1 || tri[i].w2 != tri[i - 1].w2) {
+            st = (st == NULL) ? states : st + 1;
+            tr = (tr == NULL) ? trans : tr + 1;
+
+            st->w1 = tri[i].w1;
+            st->w2 = tri[i].w2;
+            st->first = tr - trans;
+            st->n = 1;
+
+            tr->word = tri[i].w3;
+            tr->cum = cum = 1;
+
+        } else if (tri[i].w3 != tri[i - 1].w3) {
+            tr++;
+            st->n++;
+
+            tr->word = tri[i].w3;
+            tr->cum = ++cum;
+
+        } else {
+            tr->cum = ++cum;
+        }
+
+        if (tri[i].start) {
+            start_flags[st - states] = 1;
+        }
+    }
+
+    for (i = 0; i < nstates; i++) {
+        for (j = states[i].first; j < states[i].first + states[i].n; j++) {
+            trans[j].next = ngx_http_robonope_markov_find(states, nstates,
+                                                          states[i].w2,
+                                                          trans[j].word);
+        }
+    }
+
+    // Generated text starts where a sentence started in the corpus
+    starts = ngx_http_robonope_markov_starts(m);
+    nstarts = 0;
+
+    for (i = 0; i < nstates; i++) {
+        if (start_flags[i]) {
+            starts[nstarts++] = i;
+        }
+    }
+
+    if (nstarts == 0) {
+        for (i = 0; i < nstates; i++) {
+            starts[nstarts++] = i;
+        }
+    }
+
+    m->nstarts = nstarts;
+
+    return m;
+}
+
+/*
+ * Split a text into words.  Markup between "<" and ">" is skipped, as are
+ * words that would need escaping in HTML or are unreasonably long.
+ */
+static ngx_int_t
+ngx_http_robonope_markov_tokenize(ngx_http_robonope_markov_build_t *b, ngx_str_t *text)
+{
+    u_char *p, *last, *start, c;
+    uint32_t *tok, id;
+    ngx_uint_t sentence, skip;
+
+    p = text->data;
+    last = text->data + text->len;
+    sentence = 1;
+
+    while (p < last) {
+        c = *p;
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            p++;
+            continue;
+        }
+
+        if (c == '<') {
+            while (p < last && *p != '>') {
+                p++;
+            }
+
+            if (p < last) {
+                p++;
+            }
+
+            continue;
+        }
+
+        start = p;
+        skip = 0;
+
+        while (p < last) {
+            c = *p;
+
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '<') {
+                break;
+            }
+
+            if (c == '>' || c == '&' || c == '"' || c < 0x20) {
+                skip = 1;
+            }
+
+            p++;
+        }
+
+        if (skip || p - start > NGX_HTTP_ROBONOPE_MARKOV_WORD) {
+            continue;
+        }
+
+        if (ngx_http_robonope_markov_intern(b, start, p - start, &id) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        tok = ngx_array_push(b->tokens);
+        if (tok == NULL) {
+            return NGX_ERROR;
+        }
+
+        *tok = sentence ? (id | NGX_HTTP_ROBONOPE_MARKOV_START) : id;
+
+        c = p[-1];
+        sentence = (c == '.' || c == '!' || c == '?');
+    }
+
+    // Trigrams never span two texts
+    tok = ngx_array_push(b->tokens);
+    if (tok == NULL) {
+        return NGX_ERROR;
+    }
+
+    *tok = NGX_HTTP_ROBONOPE_MARKOV_BREAK;
+
+    return NGX_OK;
+}
+
+/* Open addressing with linear probing, grown at half load */
+static ngx_int_t
+ngx_http_robonope_markov_intern(ngx_http_robonope_markov_build_t *b, u_char *data, size_t len, uint32_t *id)
+{
+    ngx_http_robonope_markov_word_src_t *words, *w;
+    uint32_t hash, *slots;
+    ngx_uint_t i, n;
+
+    hash = (uint32_t) ngx_hash_key(data, len);
+    words = b->words->elts;
+
+    for (i = hash & (b->nslots - 1); b->slots[i]; i = (i + 1) & (b->nslots - 1)) {
+        w = &words[b->slots[i] - 1];
+        if (w->hash == hash && w->len == len && ngx_memcmp(w->data, data, len) == 0) {
+            *id = b->slots[i] - 1;
+            return NGX_OK;
+        }
+    }
+
+    if (b->words->nelts >= NGX_HTTP_ROBONOPE_MARKOV_START - 1) {
+        return NGX_ERROR;
+    }
+
+    w = ngx_array_push(b->words);
+    if (w == NULL) {
+        return NGX_ERROR;
+    }
+
+    w->data = data;
+    w->len = len;
+    w->hash = hash;
+
+    *id = b->words->nelts - 1;
+    b->slots[i] = *id + 1;
+
+    if (b->words->nelts * 2 < b->nslots) {
+        return NGX_OK;
+    }
+
+    slots = ngx_pcalloc(b->pool, b->nslots * 2 * sizeof(uint32_t));
+    if (slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    words = b->words->elts;
+
+    for (n = 0; n < b->words->nelts; n++) {
+        for (i = words[n].hash & (b->nslots * 2 - 1); slots[i]; i = (i + 1) & (b->nslots * 2 - 1)) {
+            /* void */
+        }
+        slots[i] = n + 1;
+    }
+
+    b->slots = slots;
+    b->nslots *= 2;
+
+    return NGX_OK;
+}
+
+static int ngx_libc_cdecl
+ngx_http_robonope_cmp_trigrams(const void *one, const void *two)
+{
+    const ngx_http_robonope_trigram_t *a = one, *b = two;
+
+    if (a->w1 != b->w1) {
+        return (a->w1 < b->w1) ? -1 : 1;
+    }
+
+    if (a->w2 != b->w2) {
+        return (a->w2 < b->w2) ? -1 : 1;
+    }
+
+    if (a->w3 != b->w3) {
+        return (a->w3 < b->w3) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static uint32_t
+ngx_http_robonope_markov_find(ngx_http_robonope_markov_state_t *states, uint32_t nstates, uint32_t w1, uint32_t w2)
+{
+    uint32_t lo, hi, mid;
+
+    lo = 0;
+    hi = nstates;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (states[mid].w1 < w1 || (states[mid].w1 == w1 && states[mid].w2 < w2)) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < nstates && states[lo].w1 == w1 && states[lo].w2 == w2) {
+        return lo;
+    }
+
+    return NGX_HTTP_ROBONOPE_MARKOV_END;
+}
+
+
+/*
+ * Generate about "words" words by walking the model from a random start
+ * state.  When the walk reaches the end of a text it starts over.
+ */
+ngx_int_t
+ngx_http_robonope_markov_generate(ngx_http_robonope_markov_t *m, ngx_pool_t *pool, ngx_http_robonope_rng_t *rng, ngx_uint_t words, ngx_str_t *text)
+{
+    ngx_http_robonope_markov_word_t *w;
+    ngx_http_robonope_markov_state_t *states, *st;
+    ngx_http_robonope_markov_trans_t *trans;
+    uint32_t *starts, state, lo, hi, mid, r;
+    u_char *p, *strings;
+    ngx_uint_t n;
+
+    if (m->nstates == 0) {
+        ngx_str_null(text);
+        return NGX_OK;
+    }
+
+    // A restart emits two words and one more follows it
+    text->data = ngx_pnalloc(pool, (words + 2) * (m->max_word + 1));
+    if (text->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    w = ngx_http_robonope_markov_words(m);
+    states = ngx_http_robonope_markov_states(m);
+    trans = ngx_http_robonope_markov_trans(m);
+    starts = ngx_http_robonope_markov_starts(m);
+    strings = ngx_http_robonope_markov_ptr(m, m->strings);
+
+    p = text->data;
+    state = NGX_HTTP_ROBONOPE_MARKOV_END;
+
+    for (n = 0; n < words; n++) {
+
+        if (state == NGX_HTTP_ROBONOPE_MARKOV_END) {
+            state = starts[ngx_http_robonope_random(rng) % m->nstarts];
+            st = &states[state];
+
+            p = ngx_cpymem(p, strings + w[st->w1].off, w[st->w1].len);
+            *p++ = ' ';
+            p = ngx_cpymem(p, strings + w[st->w2].off, w[st->w2].len);
+            *p++ = ' ';
+            n += 2;
+        }
+
+        st = &states[state];
+
+        r = ngx_http_robonope_random(rng) % trans[st->first + st->n - 1].cum;
+
+        lo = st->first;
+        hi = st->first + st->n - 1;
+
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+
+            if (trans[mid].cum <= r) {
+                lo = mid + 1;
+
+            } else {
+                hi = mid;
+            }
+        }
+
+        p = ngx_cpymem(p, strings + w[trans[lo].word].off, w[trans[lo].word].len);
+        *p++ = ' ';
+
+        state = trans[lo].next;
+    }
+
+    text->len = p - text->data;
+
+    if (text->len > 0) {
+        text->len--; // No trailing space
+    }
+
+    return NGX_OK;
+}
@@ -0,0 +1,12 @@
+#ifndef _ROBONOPE_BENCH_H_INCLUDED_
+#define _ROBONOPE_BENCH_H_INCLUDED_
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+ngx_log_t *bench_init(void);
+uint64_t bench_now(void);
+uint64_t bench_start(void);
+void bench_report(const char *name, ngx_uint_t ops, uint64_t ns);
+
+#endif /* _ROBONOPE_BENCH_H_INCLUDED_ */
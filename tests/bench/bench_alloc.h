@@ -0,0 +1,14 @@
+#ifndef _ROBONOPE_BENCH_ALLOC_H_INCLUDED_
+#define _ROBONOPE_BENCH_ALLOC_H_INCLUDED_
+
+/*
+ * Included ahead of every benchmark and module source (-include), so pool
+ * allocations made by the code under test go through the counters in
+ * bench_core.c.  The nginx pool itself is the real one.
+ */
+
+#define ngx_palloc(pool, size)   bench_palloc(pool, size)
+#define ngx_pnalloc(pool, size)  bench_pnalloc(pool, size)
+#define ngx_pcalloc(pool, size)  bench_pcalloc(pool, size)
+
+#endif /* _ROBONOPE_BENCH_ALLOC_H_INCLUDED_ */
@@ -0,0 +1,295 @@
+/*
+ * Honeypot content benchmark.
+ *
+ * Measures the generators behind every honeypot page that is not served
+ * from the page pool: the class name, the body text from the word lists
+ * and from a Markov model, the honeypot link, the maze links and the whole
+ * page rendered from the default template.  The rules, the content key and
+ * the maze prefix are set up as the module does at startup.  Every run
+ * allocates from a pool that is reset as it fills, like a request pool.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+#include "bench.h"
+
+#define BENCH_RULES   200
+#define BENCH_MAZE    10
+#define BENCH_PAGES   200000
+#define BENCH_RESET   1024
+
+typedef enum {
+    bench_op_class = 0,
+    bench_op_text,
+    bench_op_markov,
+    bench_op_link,
+    bench_op_maze,
+    bench_op_page
+} bench_op_e;
+
+static const char *sections[] = {
+    "admin", "private", "cgi-bin", "search", "api", "wp-admin", "tmp",
+    "norobots", "internal", "cart", "user", "static"
+};
+
+static const char *words[] = {
+    "the", "crawler", "follows", "every", "link", "it", "finds", "and",
+    "reads", "pages", "that", "nobody", "else", "will", "ever", "see",
+    "while", "the", "server", "keeps", "writing", "more", "of", "them"
+};
+
+/* The default template, split the way the module splits it */
+static struct {
+    ngx_uint_t type;
+    char *text;
+} bench_template[] = {
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC,
+      "<html>\n<head>\n<style>\n." },
+    { NGX_HTTP_ROBONOPE_SEGMENT_CLASS, NULL },
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC,
+      " { opacity: 0; position: absolute; top: -9999px; }\n"
+      "</style>\n</head>\n<body>\n<div class=\"content\">\n" },
+    { NGX_HTTP_ROBONOPE_SEGMENT_TEXT, NULL },
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC, "\n</div>\n<a href=\"" },
+    { NGX_HTTP_ROBONOPE_SEGMENT_LINK, NULL },
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC, "\" class=\"" },
+    { NGX_HTTP_ROBONOPE_SEGMENT_CLASS, NULL },
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC, "\">Important Information</a>\n" },
+    { NGX_HTTP_ROBONOPE_SEGMENT_MAZE, NULL },
+    { NGX_HTTP_ROBONOPE_SEGMENT_STATIC, "</body>\n</html>" },
+    { 0, NULL }
+};
+
+static ngx_http_robonope_ruleset_t *
+bench_rules(ngx_pool_t *pool)
+{
+    u_char *p;
+    ngx_uint_t i;
+    ngx_str_t *pattern;
+    ngx_array_t *entries;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    entries = ngx_array_create(pool, 1,
+                               sizeof(ngx_http_robonope_robot_entry_t));
+    entry = ngx_array_push(entries);
+    ngx_memzero(entry, sizeof(ngx_http_robonope_robot_entry_t));
+    ngx_str_set(&entry->user_agent, "*");
+
+    entry->disallow = ngx_array_create(pool, BENCH_RULES, sizeof(ngx_str_t));
+    entry->allow = ngx_array_create(pool, 1, sizeof(ngx_str_t));
+
+    for (i = 0; i < BENCH_RULES; i++) {
+        p = ngx_pnalloc(pool, 64);
+
+        pattern = ngx_array_push(entry->disallow);
+        pattern->data = p;
+        pattern->len = snprintf((char *) p, 64, "/%s/%lx/%s",
+                                sections[i % 12],
+                                (unsigned long) (i * 2654435761u % 4096),
+                                (i % 10 == 0) ? "*.pdf$" : "");
+    }
+
+    return ngx_http_robonope_compile_rules(pool, entries);
+}
+
+static ngx_http_robonope_markov_t *
+bench_markov(ngx_pool_t *pool)
+{
+    u_char *p;
+    ngx_uint_t i, k;
+    ngx_str_t *text;
+    ngx_array_t *texts;
+
+    texts = ngx_array_create(pool, 4, sizeof(ngx_str_t));
+
+    for (i = 0; i < 4; i++) {
+        text = ngx_array_push(texts);
+        text->data = ngx_pnalloc(pool, 64 * 1024);
+        p = text->data;
+
+        for (k = 0; k < 8000; k++) {
+            p += sprintf((char *) p, "%s%s",
+                         words[(k * 7 + i * 3 + k / 5) % 24],
+                         (k % 11 == 10) ? ". " : " ");
+        }
+
+        text->len = p - text->data;
+    }
+
+    return ngx_http_robonope_compile_markov(pool, texts);
+}
+
+static ngx_int_t
+bench_setup(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf,
+    ngx_http_robonope_loc_conf_t *lcf)
+{
+    ngx_uint_t i;
+    ngx_http_robonope_rule_t *rule;
+    ngx_http_robonope_segment_t *seg;
+
+    ngx_memzero(mcf, sizeof(ngx_http_robonope_main_conf_t));
+    ngx_memzero(lcf, sizeof(ngx_http_robonope_loc_conf_t));
+
+    lcf->maze = BENCH_MAZE;
+
+    mcf->rules = bench_rules(pool);
+    mcf->markov = bench_markov(pool);
+    mcf->template = ngx_array_create(pool, 16,
+                                     sizeof(ngx_http_robonope_segment_t));
+
+    if (mcf->rules == NULL || mcf->markov == NULL || mcf->template == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; bench_template[i].type || bench_template[i].text; i++) {
+        seg = ngx_array_push(mcf->template);
+        seg->type = bench_template[i].type;
+        seg->text.data = (u_char *) bench_template[i].text;
+        seg->text.len = seg->text.data ? ngx_strlen(seg->text.data) : 0;
+    }
+
+    mcf->maze_prefix = sizeof("/admin") - 1;
+    rule = ngx_http_robonope_ruleset_rules(mcf->rules);
+
+    for (i = 0; i < mcf->rules->nrules; i++) {
+        if (!rule[i].allow) {
+            mcf->maze_prefix = ngx_max(mcf->maze_prefix,
+                                       ngx_http_robonope_rule_prefix(mcf->rules,
+                                                                     &rule[i]));
+        }
+    }
+
+    ngx_str_set(&mcf->secret, "bench secret");
+
+    ngx_md5_init(&mcf->content_key);
+    ngx_md5_update(&mcf->content_key, mcf->secret.data, mcf->secret.len);
+    ngx_md5_update(&mcf->content_key, mcf->rules, mcf->rules->size);
+
+    printf("%lu rules, %lu words, %lu states, maze of %lu links\n",
+           (unsigned long) mcf->rules->nrules,
+           (unsigned long) mcf->markov->nwords,
+           (unsigned long) mcf->markov->nstates, (unsigned long) lcf->maze);
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+bench_run(ngx_pool_t *pool, ngx_http_robonope_main_conf_t *mcf,
+    ngx_http_robonope_loc_conf_t *lcf, bench_op_e op, const char *name)
+{
+    u_char uri_buf[64], key[16];
+    uint64_t start;
+    size_t bytes;
+    ngx_uint_t i;
+    ngx_int_t rc;
+    ngx_str_t uri, text, class_name, *link;
+    ngx_http_robonope_rng_t rng;
+
+    ngx_memzero(key, sizeof(key));
+    ngx_http_robonope_rng_seed(&rng, key);
+
+    ngx_str_set(&class_name, "bench");
+
+    bytes = 0;
+    rc = NGX_OK;
+    start = bench_start();
+
+    for (i = 0; i < BENCH_PAGES && rc == NGX_OK; i++) {
+        if (i % BENCH_RESET == 0) {
+            ngx_reset_pool(pool);
+        }
+
+        uri.data = uri_buf;
+        uri.len = ngx_sprintf(uri_buf, "/%s/%ui/page.html",
+                              sections[i % 12], i) - uri_buf;
+
+        switch (op) {
+
+        case bench_op_class:
+            text.data = ngx_http_robonope_generate_class_name(pool, &rng);
+            rc = (text.data == NULL) ? NGX_ERROR : NGX_OK;
+            text.len = 12;
+            break;
+
+        case bench_op_text:
+            rc = ngx_http_robonope_generate_random_text(pool, &rng, 50, &text);
+            break;
+
+        case bench_op_markov:
+            rc = ngx_http_robonope_markov_generate(mcf->markov, pool, &rng, 50,
+                                                   &text);
+            break;
+
+        case bench_op_link:
+            link = ngx_http_robonope_generate_honeypot_link(pool, &rng, &uri,
+                                                            mcf->rules, lcf);
+            rc = (link == NULL) ? NGX_ERROR : NGX_OK;
+            text.len = link ? link->len : 0;
+            break;
+
+        case bench_op_maze:
+            rc = ngx_http_robonope_generate_maze(pool, mcf, &rng, lcf->maze,
+                                                 &uri, &class_name, &text);
+            break;
+
+        default: /* bench_op_page */
+            link = ngx_http_robonope_generate_honeypot_link(pool, &rng, &uri,
+                                                            mcf->rules, lcf);
+            rc = (link == NULL)
+                 ? NGX_ERROR
+                 : ngx_http_robonope_render_honeypot(pool, mcf, lcf, link,
+                                                     &text);
+            break;
+        }
+
+        bytes += text.len;
+    }
+
+    if (rc != NGX_OK) {
+        fprintf(stderr, "%s failed\n", name);
+        return NGX_ERROR;
+    }
+
+    bench_report(name, BENCH_PAGES, bench_now() - start);
+    printf("%-40s %10.1f bytes out/op\n", "", (double) bytes / BENCH_PAGES);
+
+    return NGX_OK;
+}
+
+int
+main(int argc, char **argv)
+{
+    ngx_log_t *log;
+    ngx_pool_t *conf_pool, *pool;
+    ngx_http_robonope_main_conf_t mcf;
+    ngx_http_robonope_loc_conf_t lcf;
+
+    log = bench_init();
+
+    conf_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+
+    if (conf_pool == NULL || pool == NULL
+        || bench_setup(conf_pool, &mcf, &lcf) != NGX_OK)
+    {
+        return 1;
+    }
+
+    if (bench_run(pool, &mcf, &lcf, bench_op_class, "  generate_class_name") != NGX_OK
+        || bench_run(pool, &mcf, &lcf, bench_op_text, "  generate_random_text (50 words)") != NGX_OK
+        || bench_run(pool, &mcf, &lcf, bench_op_markov, "  markov_generate (50 words)") != NGX_OK
+        || bench_run(pool, &mcf, &lcf, bench_op_link, "  generate_honeypot_link") != NGX_OK
+        || bench_run(pool, &mcf, &lcf, bench_op_maze, "  generate_maze (10 links)") != NGX_OK
+        || bench_run(pool, &mcf, &lcf, bench_op_page, "  honeypot page (link + render)") != NGX_OK)
+    {
+        return 1;
+    }
+
+    ngx_destroy_pool(pool);
+    ngx_destroy_pool(conf_pool);
+
+    return 0;
+}
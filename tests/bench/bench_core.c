@@ -0,0 +1,126 @@
+/*
+ * Minimal runtime for the RoboNope benchmarks.
+ *
+ * The benchmarks link the module sources against a handful of nginx core
+ * objects (pools, arrays, strings, MD5, MurmurHash, allocator) from the
+ * nginx build tree.  This file provides the few remaining symbols those
+ * objects and the module expect from a running nginx, so no cycle or event
+ * loop is needed.
+ *
+ * It also counts pool allocations.  bench_alloc.h routes ngx_palloc(),
+ * ngx_pnalloc() and ngx_pcalloc() calls here, and bench_report() prints
+ * the allocations and bytes per operation since the last bench_start().
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <time.h>
+
+#include "bench.h"
+
+#undef ngx_palloc
+#undef ngx_pnalloc
+#undef ngx_pcalloc
+
+void *ngx_palloc(ngx_pool_t *pool, size_t size);
+void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
+void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
+
+volatile ngx_cycle_t *ngx_cycle;
+volatile ngx_time_t *ngx_cached_time;
+ngx_pid_t ngx_pid;
+
+static ngx_time_t bench_time;
+
+static ngx_log_t bench_log;
+static ngx_uint_t bench_allocs;
+static size_t bench_bytes;
+
+void *
+bench_palloc(ngx_pool_t *pool, size_t size)
+{
+    bench_allocs++;
+    bench_bytes += size;
+
+    return ngx_palloc(pool, size);
+}
+
+void *
+bench_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    bench_allocs++;
+    bench_bytes += size;
+
+    return ngx_pnalloc(pool, size);
+}
+
+void *
+bench_pcalloc(ngx_pool_t *pool, size_t size)
+{
+    bench_allocs++;
+    bench_bytes += size;
+
+    return ngx_pcalloc(pool, size);
+}
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fprintf(stderr, "\n");
+}
+
+ngx_log_t *
+bench_init(void)
+{
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (ngx_pagesize_shift = 0; (ngx_pagesize >> ngx_pagesize_shift) > 1;
+         ngx_pagesize_shift++)
+    {
+        /* void */
+    }
+
+    bench_log.log_level = NGX_LOG_ERR;
+
+    bench_time.sec = time(NULL);
+    ngx_cached_time = &bench_time;
+    ngx_pid = getpid();
+
+    return &bench_log;
+}
+
+uint64_t
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start of a measured run, allocations are counted from here */
+uint64_t
+bench_start(void)
+{
+    bench_allocs = 0;
+    bench_bytes = 0;
+
+    return bench_now();
+}
+
+void
+bench_report(const char *name, ngx_uint_t ops, uint64_t ns)
+{
+    printf("%-40s %10lu ops %10.1f ns/op %8.2f allocs/op %10.1f B/op\n",
+           name, (unsigned long) ops, (double) ns / ops,
+           (double) bench_allocs / ops, (double) bench_bytes / ops);
+}
@@ -0,0 +1,485 @@
+/*
+ * robots.txt matcher benchmark.
+ *
+ * Compiles synthetic rule sets of different sizes, with and without RFC 9309
+ * wildcards, and measures lookups over a mixed stream of matching and
+ * non-matching URIs.  One rule in eight is an Allow carving an exception
+ * out of a Disallow.  Every rule set is also run through a per-pattern scan
+ * (the pre-compilation behaviour, extended with a backtracking "*" and "$")
+ * to check the compiled matcher picks the same rule and to show the
+ * difference.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+#include "bench.h"
+
+#define BENCH_URIS     4096
+#define BENCH_LOOKUPS  2000000
+
+typedef struct {
+    ngx_str_t full;    /* path and query string, as in robots.txt */
+    ngx_str_t uri;
+    ngx_str_t args;
+} bench_uri_t;
+
+static const char *sections[] = {
+    "admin", "private", "cgi-bin", "search", "api", "wp-admin", "tmp",
+    "norobots", "internal", "cart", "user", "static"
+};
+
+static const char *wildcards[] = {
+    "/*.pdf$", "/*?", "/*/print/", "/search*q=", "/*.php$", "/**/draft",
+    "/tmp/*$", "/*sessionid="
+};
+
+static ngx_array_t *
+bench_entries(ngx_pool_t *pool, ngx_uint_t n, ngx_uint_t wild)
+{
+    u_char *p;
+    ngx_uint_t i;
+    ngx_str_t *pattern;
+    ngx_array_t *entries;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    entries = ngx_array_create(pool, 1,
+                               sizeof(ngx_http_robonope_robot_entry_t));
+    entry = ngx_array_push(entries);
+    ngx_memzero(entry, sizeof(ngx_http_robonope_robot_entry_t));
+    ngx_str_set(&entry->user_agent, "*");
+
+    entry->disallow = ngx_array_create(pool, n, sizeof(ngx_str_t));
+    entry->allow = ngx_array_create(pool, n / 8 + 1, sizeof(ngx_str_t));
+
+    for (i = 0; i < n; i++) {
+        p = ngx_pnalloc(pool, 64);
+
+        if (i % 8 == 7) {
+            /* the previous path, or a subtree of it, allowed again */
+            pattern = ngx_array_push(entry->allow);
+            pattern->data = p;
+            pattern->len = snprintf((char *) p, 64, "/%s/%lx/%lu/%s",
+                                    sections[(i - 1) % 12],
+                                    (unsigned long) ((i - 1) * 2654435761u
+                                                     % 4096),
+                                    (unsigned long) (i - 1),
+                                    (i % 16 == 7) ? "public/" : "");
+            continue;
+        }
+
+        pattern = ngx_array_push(entry->disallow);
+        pattern->data = p;
+
+        if (wild && i % 10 == 0) {
+            /* one rule in ten uses wildcards */
+            pattern->len = snprintf((char *) p, 64, "/%s%s", sections[i % 12],
+                                    wildcards[i / 10 % 8]);
+            continue;
+        }
+
+        pattern->len = snprintf((char *) p, 64, "/%s/%lx/%lu/",
+                                sections[i % 12],
+                                (unsigned long) (i * 2654435761u % 4096),
+                                (unsigned long) i);
+    }
+
+    return entries;
+}
+
+static bench_uri_t *
+bench_uris(ngx_pool_t *pool, ngx_array_t *entries)
+{
+    u_char *p, *q;
+    ngx_uint_t i, n;
+    ngx_str_t *patterns, *allows, *rule;
+    bench_uri_t *uris;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    entry = entries->elts;
+    patterns = entry->disallow->elts;
+    n = entry->disallow->nelts;
+    allows = entry->allow->elts;
+
+    uris = ngx_palloc(pool, BENCH_URIS * sizeof(bench_uri_t));
+
+    for (i = 0; i < BENCH_URIS; i++) {
+        p = ngx_pnalloc(pool, 128);
+        uris[i].full.data = p;
+
+        switch (i % 6) {
+
+        case 0:  /* below a rule, wildcards taken literally */
+            rule = (i % 12 == 6 && entry->allow->nelts)
+                   ? &allows[i % entry->allow->nelts] : &patterns[i % n];
+            p = ngx_cpymem(p, rule->data, rule->len);
+            p += sprintf((char *) p, "page%lu.html", (unsigned long) i);
+            break;
+
+        case 1:  /* shares a prefix, diverges late */
+            p = ngx_cpymem(p, patterns[i % n].data, patterns[i % n].len - 1);
+            p += sprintf((char *) p, "x/page%lu.html", (unsigned long) i);
+            break;
+
+        case 2:  /* known section, unknown path */
+            p += sprintf((char *) p, "/%s/index.html", sections[i % 12]);
+            break;
+
+        case 3:  /* documents */
+            p += sprintf((char *) p, "/%s/files/report%lu.pdf",
+                         sections[i % 12], (unsigned long) i);
+            break;
+
+        case 4:  /* query strings */
+            p += sprintf((char *) p, "/%s/list?q=%lu&sessionid=%lx",
+                         sections[i % 12], (unsigned long) i,
+                         (unsigned long) i * 7919);
+            break;
+
+        default: /* public content */
+            p += sprintf((char *) p, "/blog/2024/%lu/post.html",
+                         (unsigned long) i);
+            break;
+        }
+
+        uris[i].full.len = p - uris[i].full.data;
+
+        uris[i].uri = uris[i].full;
+        uris[i].args.len = 0;
+        uris[i].args.data = NULL;
+
+        q = memchr(uris[i].full.data, '?', uris[i].full.len);
+        if (q) {
+            uris[i].uri.len = q - uris[i].full.data;
+            uris[i].args.data = q + 1;
+            uris[i].args.len = p - (q + 1);
+        }
+    }
+
+    return uris;
+}
+
+static ngx_uint_t
+bench_wildcard(u_char *pat, size_t plen, u_char *s, size_t slen)
+{
+    size_t k;
+
+    for ( ;; ) {
+        if (plen == 0) {
+            return 1;
+        }
+
+        if (pat[0] == '$' && plen == 1) {
+            return slen == 0;
+        }
+
+        if (pat[0] == '*') {
+            for (k = 0; k <= slen; k++) {
+                if (bench_wildcard(pat + 1, plen - 1, s + k, slen - k)) {
+                    return 1;
+                }
+            }
+
+            return 0;
+        }
+
+        if (slen == 0 || pat[0] != s[0]) {
+            return 0;
+        }
+
+        pat++;
+        plen--;
+        s++;
+        slen--;
+    }
+}
+
+/*
+ * Allow rules are scanned first and only replaced by strictly longer
+ * Disallow rules, so Allow wins ties.
+ */
+
+static ngx_str_t *
+bench_linear(ngx_array_t *entries, ngx_str_t *uri, ngx_uint_t *allow)
+{
+    ngx_uint_t i, a;
+    ngx_str_t *patterns, *best;
+    ngx_array_t *list;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    entry = entries->elts;
+    best = NULL;
+
+    for (a = 0; a < 2; a++) {
+        list = (a == 0) ? entry->allow : entry->disallow;
+        patterns = list->elts;
+
+        for (i = 0; i < list->nelts; i++) {
+            if ((best == NULL || patterns[i].len > best->len)
+                && bench_wildcard(patterns[i].data, patterns[i].len,
+                                  uri->data, uri->len))
+            {
+                best = &patterns[i];
+                *allow = (a == 0);
+            }
+        }
+    }
+
+    return best;
+}
+
+static ngx_int_t
+bench_size(ngx_log_t *log, ngx_uint_t n, ngx_uint_t wild)
+{
+    char name[64];
+    void *scratch;
+    uint64_t start;
+    ngx_int_t group;
+    ngx_uint_t i, lookups, hits, allow;
+    ngx_str_t *linear;
+    ngx_pool_t *pool;
+    bench_uri_t *uris, *u;
+    ngx_array_t *entries;
+    ngx_http_robonope_rule_t *rule;
+    ngx_http_robonope_ruleset_t *rs;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    entries = bench_entries(pool, n, wild);
+    uris = bench_uris(pool, entries);
+
+    start = bench_now();
+    rs = ngx_http_robonope_compile_rules(pool, entries);
+
+    if (rs == NULL) {
+        fprintf(stderr, "compile failed for %lu rules\n", (unsigned long) n);
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    printf("%lu rules%s: compiled in %.2f ms, %lu nodes, %lu bytes, "
+           "%lu bytes scratch\n",
+           (unsigned long) n, wild ? " (10% wildcards)" : "",
+           (bench_now() - start) / 1e6,
+           (unsigned long) rs->nnodes, (unsigned long) rs->size,
+           (unsigned long) ngx_http_robonope_match_scratch_size(rs));
+
+    scratch = ngx_palloc(pool, ngx_http_robonope_match_scratch_size(rs));
+    group = ngx_http_robonope_find_group(rs, NULL);
+
+    if (scratch == NULL || group == NGX_DECLINED) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    /* both matchers must agree on every URI */
+
+    for (i = 0; i < BENCH_URIS; i++) {
+        rule = ngx_http_robonope_match(rs, group, scratch, &uris[i].uri,
+                                       &uris[i].args);
+        linear = bench_linear(entries, &uris[i].full, &allow);
+
+        if ((rule == NULL) != (linear == NULL)
+            || (rule && (rule->len != linear->len || rule->allow != allow
+                         || ngx_memcmp(ngx_http_robonope_rule_pattern(rs, rule),
+                                       linear->data, rule->len) != 0)))
+        {
+            fprintf(stderr, "mismatch on \"%.*s\": \"%.*s\" vs \"%.*s\"\n",
+                    (int) uris[i].full.len, uris[i].full.data,
+                    rule ? (int) rule->len : 0,
+                    rule ? (char *) ngx_http_robonope_rule_pattern(rs, rule)
+                         : "",
+                    linear ? (int) linear->len : 0,
+                    linear ? (char *) linear->data : "");
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+    }
+
+    hits = 0;
+    start = bench_start();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        u = &uris[i % BENCH_URIS];
+        rule = ngx_http_robonope_match(rs, group, scratch, &u->uri, &u->args);
+        hits += (rule != NULL);
+    }
+
+    snprintf(name, sizeof(name), "  compiled (%lu rules)", (unsigned long) n);
+    bench_report(name, BENCH_LOOKUPS, bench_now() - start);
+
+    /* keep the linear scan to roughly the same amount of work */
+
+    lookups = ngx_max(BENCH_URIS, BENCH_LOOKUPS / n);
+    start = bench_start();
+
+    for (i = 0; i < lookups; i++) {
+        linear = bench_linear(entries, &uris[i % BENCH_URIS].full, &allow);
+        hits += (linear != NULL);
+    }
+
+    snprintf(name, sizeof(name), "  linear scan (%lu rules)", (unsigned long) n);
+    bench_report(name, lookups, bench_now() - start);
+
+    ngx_destroy_pool(pool);
+
+    return hits ? NGX_OK : NGX_ERROR;
+}
+
+/*
+ * User-Agent group selection: one group per crawler token plus "*", looked
+ * up with real-world User-Agent headers.
+ */
+
+static const char *bench_bots[] = {
+    "Googlebot", "Googlebot-Image", "Bingbot", "Slurp", "DuckDuckBot",
+    "Baiduspider", "YandexBot", "Sogou", "Exabot", "facebot",
+    "ia_archiver", "AhrefsBot", "SemrushBot", "MJ12bot", "DotBot",
+    "PetalBot", "GPTBot", "CCBot", "ClaudeBot", "Bytespider",
+    "Applebot", "Amazonbot", "anthropic-ai", "Google-Extended", "BadBot",
+    NULL
+};
+
+static struct {
+    const char *user_agent;
+    const char *group;
+} bench_agents[] = {
+    { "Mozilla/5.0 (compatible; Googlebot/2.1; "
+      "+http://www.google.com/bot.html)", "googlebot" },
+    { "Googlebot-Image/1.0", "googlebot-image" },
+    { "Mozilla/5.0 (compatible; bingbot/2.0; "
+      "+http://www.bing.com/bingbot.htm)", "bingbot" },
+    { "Mozilla/5.0 AppleWebKit/537.36 (KHTML, like Gecko; compatible; "
+      "GPTBot/1.2; +https://openai.com/gptbot)", "gptbot" },
+    { "Mozilla/5.0 (compatible; AhrefsBot/7.0; +http://ahrefs.com/robot/)",
+      "ahrefsbot" },
+    { "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36", "*" },
+    { "curl/8.5.0", "*" },
+    { NULL, NULL }
+};
+
+static ngx_int_t
+bench_user_agents(ngx_log_t *log)
+{
+    size_t len;
+    uint64_t start;
+    ngx_int_t group;
+    ngx_uint_t i, hits;
+    ngx_str_t ua, *pattern;
+    ngx_pool_t *pool;
+    ngx_array_t *entries;
+    ngx_http_robonope_rule_t *rule;
+    ngx_http_robonope_group_t *groups;
+    ngx_http_robonope_ruleset_t *rs;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    entries = ngx_array_create(pool, 32,
+                               sizeof(ngx_http_robonope_robot_entry_t));
+
+    /* every group disallows "/" followed by its own name */
+
+    for (i = 0; i == 0 || bench_bots[i - 1]; i++) {
+        entry = ngx_array_push(entries);
+        ngx_memzero(entry, sizeof(ngx_http_robonope_robot_entry_t));
+
+        entry->user_agent.data = (u_char *) (i ? bench_bots[i - 1] : "*");
+        entry->user_agent.len = ngx_strlen(entry->user_agent.data);
+
+        entry->disallow = ngx_array_create(pool, 1, sizeof(ngx_str_t));
+        pattern = ngx_array_push(entry->disallow);
+
+        pattern->len = entry->user_agent.len + 1;
+        pattern->data = ngx_pnalloc(pool, pattern->len);
+        pattern->data[0] = '/';
+        ngx_memcpy(pattern->data + 1, entry->user_agent.data,
+                   entry->user_agent.len);
+    }
+
+    rs = ngx_http_robonope_compile_rules(pool, entries);
+    if (rs == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    printf("%lu user agent groups: %lu index slots\n",
+           (unsigned long) rs->ngroups, (unsigned long) rs->nagents);
+
+    groups = ngx_http_robonope_ruleset_groups(rs);
+
+    for (i = 0; bench_agents[i].user_agent; i++) {
+        ua.data = (u_char *) bench_agents[i].user_agent;
+        ua.len = ngx_strlen(ua.data);
+
+        group = ngx_http_robonope_find_group(rs, &ua);
+        if (group == NGX_DECLINED) {
+            break;
+        }
+
+        rule = &ngx_http_robonope_ruleset_rules(rs)[groups[group].rules];
+        len = ngx_strlen(bench_agents[i].group);
+
+        if (rule->len != len + 1
+            || strncasecmp((char *) ngx_http_robonope_rule_pattern(rs, rule) + 1,
+                           bench_agents[i].group, len) != 0)
+        {
+            break;
+        }
+    }
+
+    if (bench_agents[i].user_agent) {
+        fprintf(stderr, "wrong group for \"%s\"\n", bench_agents[i].user_agent);
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    hits = 0;
+    start = bench_start();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        ua.data = (u_char *) bench_agents[i % 7].user_agent;
+        ua.len = ngx_strlen(ua.data);
+
+        hits += ngx_http_robonope_find_group(rs, &ua);
+    }
+
+    bench_report("  user agent lookup", BENCH_LOOKUPS, bench_now() - start);
+
+    ngx_destroy_pool(pool);
+
+    return hits ? NGX_OK : NGX_ERROR;
+}
+
+int
+main(int argc, char **argv)
+{
+    ngx_uint_t wild;
+    ngx_log_t *log;
+
+    log = bench_init();
+
+    if (bench_user_agents(log) != NGX_OK) {
+        return 1;
+    }
+
+    for (wild = 0; wild < 2; wild++) {
+        if (bench_size(log, 10, wild) != NGX_OK
+            || bench_size(log, 1000, wild) != NGX_OK
+            || bench_size(log, 100000, wild) != NGX_OK)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Request path benchmark.
+ *
+ * Runs the per-request work of a blocked crawler on fake requests with a
+ * client address, a User-Agent and a URI, through the module's own
+ * functions: the rule lookup and client fingerprint of is_disallowed()
+ * (ngx_http_robonope_match_request() and ngx_http_robonope_fingerprint())
+ * and the record copy of log_request() (ngx_http_robonope_log_push()).
+ * The rules have a few named groups besides "*", half of the requests come
+ * from crawlers named by one of them and half of the URIs are disallowed.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+#include "bench.h"
+
+#define BENCH_RULES     200
+#define BENCH_REQUESTS  1024
+#define BENCH_LOOKUPS   2000000
+#define BENCH_QUEUE     1024
+
+typedef struct {
+    ngx_http_request_t  r;
+    ngx_connection_t    c;
+    ngx_table_elt_t     user_agent;
+} bench_request_t;
+
+static const char *sections[] = {
+    "admin", "private", "cgi-bin", "search", "api", "wp-admin", "tmp",
+    "norobots", "internal", "cart", "user", "static"
+};
+
+static const char *agents[] = {
+    "GPTBot", "CCBot", "Bytespider", "ClaudeBot", "*"
+};
+
+static const char *user_agents[] = {
+    "Mozilla/5.0 AppleWebKit/537.36 (KHTML, like Gecko; compatible; "
+    "GPTBot/1.2; +https://openai.com/gptbot)",
+    "CCBot/2.0 (https://commoncrawl.org/faq/)",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0"
+};
+
+static ngx_http_robonope_ruleset_t *
+bench_rules(ngx_pool_t *pool)
+{
+    u_char *p;
+    ngx_uint_t i, g;
+    ngx_str_t *pattern;
+    ngx_array_t *entries;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    entries = ngx_array_create(pool, 5,
+                               sizeof(ngx_http_robonope_robot_entry_t));
+
+    for (g = 0; g < 5; g++) {
+        entry = ngx_array_push(entries);
+        ngx_memzero(entry, sizeof(ngx_http_robonope_robot_entry_t));
+        entry->user_agent.data = (u_char *) agents[g];
+        entry->user_agent.len = ngx_strlen(agents[g]);
+
+        entry->disallow = ngx_array_create(pool, BENCH_RULES,
+                                           sizeof(ngx_str_t));
+        entry->allow = ngx_array_create(pool, 1, sizeof(ngx_str_t));
+
+        for (i = 0; i < BENCH_RULES; i++) {
+            p = ngx_pnalloc(pool, 64);
+
+            pattern = ngx_array_push(entry->disallow);
+            pattern->data = p;
+            pattern->len = snprintf((char *) p, 64, "/%s/%lx/",
+                                    sections[i % 12],
+                                    (unsigned long) (i * 2654435761u % 4096));
+        }
+    }
+
+    return ngx_http_robonope_compile_rules(pool, entries);
+}
+
+static bench_request_t *
+bench_requests(ngx_pool_t *pool)
+{
+    u_char *p;
+    ngx_uint_t i;
+    bench_request_t *br;
+
+    br = ngx_pcalloc(pool, BENCH_REQUESTS * sizeof(bench_request_t));
+    if (br == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < BENCH_REQUESTS; i++) {
+        br[i].r.connection = &br[i].c;
+        br[i].r.headers_in.user_agent = &br[i].user_agent;
+
+        p = ngx_pnalloc(pool, sizeof("255.255.255.255"));
+        br[i].c.addr_text.data = p;
+        br[i].c.addr_text.len = ngx_sprintf(p, "203.0.%ui.%ui", i / 256,
+                                            i % 256) - p;
+
+        br[i].user_agent.value.data = (u_char *) user_agents[i % 4];
+        br[i].user_agent.value.len = ngx_strlen(user_agents[i % 4]);
+
+        p = ngx_pnalloc(pool, 128);
+        br[i].r.uri.data = p;
+
+        if (i % 2) {
+            /* below a Disallow rule */
+            p = ngx_sprintf(p, "/%s/%xi/page%ui.html",
+                            sections[i % BENCH_RULES % 12],
+                            (ngx_uint_t) (i % BENCH_RULES * 2654435761u % 4096),
+                            i);
+        } else {
+            p = ngx_sprintf(p, "/blog/2024/%ui/post.html", i);
+        }
+
+        br[i].r.uri.len = p - br[i].r.uri.data;
+
+        if (i % 8 == 0) {
+            ngx_str_set(&br[i].r.args, "utm_source=feed");
+        }
+    }
+
+    return br;
+}
+
+static ngx_int_t
+bench_disallowed(ngx_pool_t *pool, ngx_http_robonope_ruleset_t *rs,
+    bench_request_t *br)
+{
+    void *scratch;
+    u_char fingerprint[16];
+    uint64_t start;
+    ngx_int_t group;
+    ngx_uint_t i, blocked;
+    ngx_http_request_t *r;
+    ngx_http_robonope_rule_t *rule;
+
+    scratch = ngx_palloc(pool, ngx_http_robonope_match_scratch_size(rs));
+    if (scratch == NULL) {
+        return NGX_ERROR;
+    }
+
+    blocked = 0;
+    start = bench_start();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        r = &br[i % BENCH_REQUESTS].r;
+
+        rule = ngx_http_robonope_match_request(rs, scratch, r, &group);
+        if (rule == NULL) {
+            continue;
+        }
+
+        ngx_http_robonope_fingerprint(r, fingerprint);
+        blocked += fingerprint[0] | 1;
+    }
+
+    bench_report("  match_request + fingerprint", BENCH_LOOKUPS,
+                 bench_now() - start);
+
+    return blocked ? NGX_OK : NGX_ERROR;
+}
+
+static ngx_int_t
+bench_log(ngx_pool_t *pool, bench_request_t *br)
+{
+    u_char fingerprint[16];
+    uint64_t start;
+    ngx_uint_t i;
+    ngx_str_t pattern;
+    ngx_http_robonope_log_queue_t q;
+
+    ngx_memzero(&q, sizeof(ngx_http_robonope_log_queue_t));
+
+    q.size = BENCH_QUEUE;
+    q.pending = ngx_palloc(pool, BENCH_QUEUE
+                                 * sizeof(ngx_http_robonope_log_record_t));
+    if (q.pending == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_str_set(&pattern, "/private/");
+    ngx_memset(fingerprint, 0xa5, sizeof(fingerprint));
+
+    start = bench_start();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        if (ngx_http_robonope_log_push(&q, &br[i % BENCH_REQUESTS].r,
+                                       &pattern, fingerprint)
+            == NULL)
+        {
+            q.npending = 0;     /* the batch went to the writer */
+        }
+    }
+
+    bench_report("  log_push (record copy)", BENCH_LOOKUPS,
+                 bench_now() - start);
+
+    return NGX_OK;
+}
+
+int
+main(int argc, char **argv)
+{
+    ngx_log_t *log;
+    ngx_pool_t *pool;
+    bench_request_t *br;
+    ngx_http_robonope_ruleset_t *rs;
+
+    log = bench_init();
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    rs = bench_rules(pool);
+    br = bench_requests(pool);
+
+    if (rs == NULL || br == NULL) {
+        return 1;
+    }
+
+    printf("%lu groups, %lu rules, %lu requests\n",
+           (unsigned long) rs->ngroups, (unsigned long) rs->nrules,
+           (unsigned long) BENCH_REQUESTS);
+
+    if (bench_disallowed(pool, rs, br) != NGX_OK
+        || bench_log(pool, br) != NGX_OK)
+    {
+        return 1;
+    }
+
+    ngx_destroy_pool(pool);
+
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * robots.txt parser benchmark.
+ *
+ * Parses a small file full of the things real robots.txt files get wrong
+ * and checks every group and pattern, then measures throughput on a large
+ * synthetic file with CRLF line endings, comments, multi-agent groups,
+ * empty Disallow lines and Sitemap lines.  The large file is parsed both
+ * from memory and through the mmap path from a temporary file.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include "ngx_http_robonope_module.h"
+#include "bench.h"
+
+#define BENCH_GROUPS  20000
+#define BENCH_PASSES  20
+
+static const char bench_tricky[] =
+    "\xef\xbb\xbf# robots.txt for www.example.com\r\n"
+    "Disallow: /orphan/\r\n"
+    "\r\n"
+    "User-agent: Googlebot   \r\n"
+    "user-agent:Bingbot # search engines\r\n"
+    "Disallow: /private/\t\r\n"
+    "Crawl-delay: 0.5 \r\n"
+    "Sitemap: https://www.example.com/sitemap.xml\r\n"
+    "  Allow : /private/public/ # carve out\r\n"
+    "\r\n"
+    "User-agent: GPTBot\n"
+    "Disallow:\n"
+    "User-agent: *\r"
+    "Disallow: /cgi-bin/\r"
+    "Crawl-delay: 10\r"
+    "Disallow: /tmp/*$";
+
+static struct {
+    const char *user_agent;
+    const char *disallow;
+    const char *allow;
+    ngx_msec_t crawl_delay;
+} bench_expect[] = {
+    { "Googlebot", "/private/", "/private/public/", 500 },
+    { "Bingbot", "/private/", "/private/public/", 500 },
+    { "GPTBot", "", "", 0 },
+    { "*", "/cgi-bin/ /tmp/*$", "", 10000 },
+    { NULL, NULL, NULL, 0 }
+};
+
+static ngx_uint_t
+bench_same(ngx_array_t *list, const char *expect)
+{
+    u_char *p;
+    size_t len;
+    ngx_uint_t i;
+    ngx_str_t *pattern;
+
+    pattern = list->elts;
+    p = (u_char *) expect;
+
+    for (i = 0; i < list->nelts; i++) {
+        len = strcspn((char *) p, " ");
+
+        if (pattern[i].len != len || ngx_memcmp(pattern[i].data, p, len) != 0) {
+            return 0;
+        }
+
+        p += len;
+        p += (*p == ' ');
+    }
+
+    return *p == '\0';
+}
+
+static ngx_int_t
+bench_check(ngx_log_t *log)
+{
+    ngx_uint_t i;
+    ngx_pool_t *pool;
+    ngx_array_t *entries;
+    ngx_http_robonope_robot_entry_t *entry;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    entries = ngx_array_create(pool, 1,
+                               sizeof(ngx_http_robonope_robot_entry_t));
+
+    if (entries == NULL
+        || ngx_http_robonope_parse_robots_text(pool, entries,
+                                               (u_char *) bench_tricky,
+                                               sizeof(bench_tricky) - 1)
+           != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    entry = entries->elts;
+
+    for (i = 0; bench_expect[i].user_agent; i++) {
+        if (i == entries->nelts
+            || entry[i].user_agent.len != ngx_strlen(bench_expect[i].user_agent)
+            || ngx_memcmp(entry[i].user_agent.data, bench_expect[i].user_agent,
+                          entry[i].user_agent.len) != 0
+            || !bench_same(entry[i].disallow, bench_expect[i].disallow)
+            || !bench_same(entry[i].allow, bench_expect[i].allow)
+            || entry[i].crawl_delay != bench_expect[i].crawl_delay)
+        {
+            fprintf(stderr, "wrong entry %lu for \"%s\"\n", (unsigned long) i,
+                    bench_expect[i].user_agent);
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+    }
+
+    if (entries->nelts != i || entry[0].disallow != entry[1].disallow) {
+        fprintf(stderr, "wrong grouping, %lu entries\n",
+                (unsigned long) entries->nelts);
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    printf("parser check: %lu entries ok\n", (unsigned long) entries->nelts);
+
+    ngx_destroy_pool(pool);
+
+    return NGX_OK;
+}
+
+static u_char *
+bench_file(ngx_uint_t groups, size_t *len)
+{
+    u_char *buf, *p;
+    size_t size;
+    ngx_uint_t i, k;
+
+    size = groups * 512;
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    p = buf;
+
+    for (i = 0; i < groups; i++) {
+        p += sprintf((char *) p, "# section %lu\r\n", (unsigned long) i);
+        p += sprintf((char *) p, "User-agent: crawler%lu\r\n",
+                     (unsigned long) i);
+
+        if (i % 4 == 0) {
+            p += sprintf((char *) p, "User-agent: crawler%lu-news  \r\n",
+                         (unsigned long) i);
+        }
+
+        if (i % 16 == 0) {
+            p += sprintf((char *) p, "Disallow:\r\n\r\n");
+            continue;
+        }
+
+        for (k = 0; k < 4; k++) {
+            p += sprintf((char *) p, "Disallow: /%lu/%lx/private%lu/ "
+                         "# internal\r\n", (unsigned long) i,
+                         (unsigned long) (i * 2654435761u % 4096),
+                         (unsigned long) k);
+        }
+
+        p += sprintf((char *) p, "Allow: /%lu/public/*.html$\r\n",
+                     (unsigned long) i);
+
+        if (i % 8 == 0) {
+            p += sprintf((char *) p,
+                         "Sitemap: https://www.example.com/sitemap%lu.xml\r\n",
+                         (unsigned long) i);
+        }
+
+        p += sprintf((char *) p, "\r\n");
+    }
+
+    *len = p - buf;
+
+    return buf;
+}
+
+static ngx_int_t
+bench_throughput(ngx_log_t *log)
+{
+    int fd;
+    char path[] = "/tmp/bench_robots.XXXXXX";
+    u_char *buf;
+    size_t len;
+    uint64_t start, ns;
+    ngx_str_t name;
+    ngx_uint_t i, n;
+    ngx_pool_t *pool;
+    ngx_array_t *entries;
+    ngx_int_t rc;
+
+    buf = bench_file(BENCH_GROUPS, &len);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    fd = mkstemp(path);
+    if (fd == -1 || write(fd, buf, len) != (ssize_t) len) {
+        free(buf);
+        return NGX_ERROR;
+    }
+
+    close(fd);
+
+    printf("%lu groups: %.2f MB\n", (unsigned long) BENCH_GROUPS,
+           len / 1048576.0);
+
+    name.data = (u_char *) path;
+    name.len = ngx_strlen(path);
+
+    rc = NGX_OK;
+
+    for (i = 0; i < 2 && rc == NGX_OK; i++) {
+        ns = 0;
+        bench_start();
+
+        for (n = 0; n < BENCH_PASSES; n++) {
+            pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+            if (pool == NULL) {
+                rc = NGX_ERROR;
+                break;
+            }
+
+            entries = ngx_array_create(pool, 64,
+                                       sizeof(ngx_http_robonope_robot_entry_t));
+
+            start = bench_now();
+
+            rc = (i == 0)
+                 ? ngx_http_robonope_parse_robots_text(pool, entries, buf, len)
+                 : ngx_http_robonope_parse_robots(pool, entries, &name);
+
+            ns += bench_now() - start;
+
+            if (rc == NGX_OK
+                && entries->nelts != BENCH_GROUPS + (BENCH_GROUPS + 3) / 4)
+            {
+                fprintf(stderr, "parsed %lu entries\n",
+                        (unsigned long) entries->nelts);
+                rc = NGX_ERROR;
+            }
+
+            ngx_destroy_pool(pool);
+
+            if (rc != NGX_OK) {
+                break;
+            }
+        }
+
+        if (rc == NGX_OK) {
+            bench_report(i ? "  parse file (mmap)" : "  parse buffer",
+                         BENCH_PASSES, ns);
+            printf("%-40s %10.1f MB/s\n", "",
+                   (double) len * BENCH_PASSES / 1048576.0 / (ns / 1e9));
+        }
+    }
+
+    unlink(path);
+    free(buf);
+
+    return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+    ngx_log_t *log;
+
+    log = bench_init();
+
+    if (bench_check(log) != NGX_OK || bench_throughput(log) != NGX_OK) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1153 @@
+/*
+ * RoboNope load generator.
+ *
+ * Drives a running nginx over a fixed number of keep-alive connections,
+ * each sending its next request as soon as the previous response is
+ * complete.  Requests are drawn from a weighted mix of three kinds:
+ *
+ *   passthrough  allowed URLs from browser User-Agents, served by nginx
+ *   honeypot     disallowed URLs, each from a User-Agent never seen before,
+ *                so every one takes the whole path: rule match, page
+ *                generation, offender cache insert and request log
+ *   offender     allowed URLs from User-Agents flagged before the run,
+ *                answered as robonope_offender_action says
+ *
+ * Latency runs from the moment a request is ready to the last byte of its
+ * response, including the connect when a connection had to be reopened.
+ * Requests started during the warm-up are not counted.  Results are printed
+ * per kind and written as JSON for comparing builds.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LG_BUF_SIZE    16384
+#define LG_REQ_SIZE    1024
+#define LG_MAX_PATHS   4096
+#define LG_TIMEOUT     10000000000ULL    /* ns before a request fails */
+
+enum {
+    LG_PASSTHROUGH = 0,
+    LG_HONEYPOT,
+    LG_OFFENDER,
+    LG_KINDS
+};
+
+static const char *lg_kind_names[LG_KINDS] = {
+    "passthrough", "honeypot", "offender"
+};
+
+typedef struct {
+    uint32_t   *samples;      /* Latencies in microseconds */
+    size_t      nsamples;
+    size_t      nalloc;
+    uint64_t    errors;
+    uint64_t    bytes;        /* Response bytes, headers included */
+    uint64_t    status[6];    /* By first digit, [0] for anything else */
+} lg_stats_t;
+
+typedef enum {
+    lg_idle = 0,
+    lg_connecting,
+    lg_writing,
+    lg_reading_header,
+    lg_reading_body
+} lg_state_e;
+
+typedef enum {
+    lg_body_none = 0,
+    lg_body_length,
+    lg_body_chunked,
+    lg_body_close
+} lg_body_e;
+
+typedef enum {
+    lg_chunk_size = 0,
+    lg_chunk_ext,
+    lg_chunk_size_lf,
+    lg_chunk_data,
+    lg_chunk_data_cr,
+    lg_chunk_data_lf,
+    lg_chunk_trailer,
+    lg_chunk_trailer_lf
+} lg_chunk_e;
+
+typedef struct {
+    int         fd;
+    lg_state_e  state;
+    int         kind;
+    uint64_t    start;
+    char        req[LG_REQ_SIZE];
+    size_t      req_len;
+    size_t      sent;
+    char        buf[LG_BUF_SIZE];
+    size_t      len;          /* Header bytes read so far */
+    int         status;
+    int         keepalive;
+    lg_body_e   body;
+    uint64_t    remaining;    /* Body or chunk bytes still to come */
+    lg_chunk_e  chunk;
+    int         line_empty;   /* Trailer line has no bytes yet */
+    uint64_t    bytes;
+} lg_conn_t;
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *label;
+    const char *output;
+    unsigned    connections;
+    double      duration;
+    double      warmup;
+    unsigned    mix[LG_KINDS];
+    unsigned    offenders;
+    char       *allowed[LG_MAX_PATHS];
+    unsigned    nallowed;
+    char       *disallowed[LG_MAX_PATHS];
+    unsigned    ndisallowed;
+    struct sockaddr_storage addr;
+    socklen_t   addrlen;
+} lg_conf_t;
+
+static lg_conf_t lg_conf;
+static lg_stats_t lg_stats[LG_KINDS];
+static uint64_t lg_rng_state;
+static uint64_t lg_bot_seq;
+static uint64_t lg_measure_start;
+static uint64_t lg_measure_end;
+
+/* Paths and agents matching demo/ and examples/robots.txt */
+static char *lg_default_allowed[] = {
+    "/", "/index.html", "/styles.css", "/secret.html"
+};
+
+static char *lg_default_disallowed[] = {
+    "/norobots/", "/private/", "/admin/", "/secret-data/", "/internal/"
+};
+
+static const char *lg_browsers[] = {
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 14_4) AppleWebKit/605.1.15 "
+    "(KHTML, like Gecko) Version/17.4 Safari/605.1.15",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0"
+};
+
+
+static uint64_t
+lg_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint64_t
+lg_random(void)
+{
+    uint64_t x = lg_rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    lg_rng_state = x;
+
+    return x;
+}
+
+
+static int
+lg_pick_kind(void)
+{
+    unsigned i, total, n;
+
+    total = lg_conf.mix[0] + lg_conf.mix[1] + lg_conf.mix[2];
+    n = lg_random() % total;
+
+    for (i = 0; i < LG_KINDS - 1; i++) {
+        if (n < lg_conf.mix[i]) {
+            break;
+        }
+
+        n -= lg_conf.mix[i];
+    }
+
+    return i;
+}
+
+
+static size_t
+lg_request(char *buf, size_t size, int kind)
+{
+    char ua[128], path[512];
+    const char *agent, *p;
+
+    switch (kind) {
+
+    case LG_PASSTHROUGH:
+        p = lg_conf.allowed[lg_random() % lg_conf.nallowed];
+        snprintf(path, sizeof(path), "%s", p);
+        agent = lg_browsers[lg_random() % 3];
+        break;
+
+    case LG_HONEYPOT:
+        p = lg_conf.disallowed[lg_random() % lg_conf.ndisallowed];
+        snprintf(path, sizeof(path), "%s%spage%u.html", p,
+                 p[strlen(p) - 1] == '/' ? "" : "/",
+                 (unsigned) (lg_random() % 100000));
+        snprintf(ua, sizeof(ua), "Mozilla/5.0 (compatible; LoadBot/%llx)",
+                 (unsigned long long) lg_bot_seq++);
+        agent = ua;
+        break;
+
+    default: /* LG_OFFENDER */
+        p = lg_conf.allowed[lg_random() % lg_conf.nallowed];
+        snprintf(path, sizeof(path), "%s", p);
+        snprintf(ua, sizeof(ua), "Mozilla/5.0 (compatible; RepeatBot/%u)",
+                 (unsigned) (lg_random() % lg_conf.offenders));
+        agent = ua;
+        break;
+    }
+
+    return snprintf(buf, size,
+                    "GET %s HTTP/1.1\r\n"
+                    "Host: %s\r\n"
+                    "User-Agent: %s\r\n"
+                    "Accept: */*\r\n"
+                    "\r\n",
+                    path, lg_conf.host, agent);
+}
+
+
+static void
+lg_close(lg_conn_t *c)
+{
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    c->state = lg_idle;
+}
+
+
+static int
+lg_connect(lg_conn_t *c)
+{
+    int one = 1;
+
+    c->fd = socket(lg_conf.addr.ss_family, SOCK_STREAM, 0);
+    if (c->fd == -1) {
+        return -1;
+    }
+
+    if (fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK) == -1) {
+        lg_close(c);
+        return -1;
+    }
+
+    (void) setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr *) &lg_conf.addr, lg_conf.addrlen)
+        == 0)
+    {
+        c->state = lg_writing;
+        return 0;
+    }
+
+    if (errno != EINPROGRESS) {
+        lg_close(c);
+        return -1;
+    }
+
+    c->state = lg_connecting;
+
+    return 0;
+}
+
+
+static void
+lg_record(lg_conn_t *c, int ok)
+{
+    lg_stats_t *st;
+    uint32_t *samples;
+    uint64_t now;
+
+    now = lg_now();
+
+    /* only requests started and finished within the measured run count */
+    if (c->start < lg_measure_start || now > lg_measure_end) {
+        return;
+    }
+
+    st = &lg_stats[c->kind];
+
+    if (!ok) {
+        st->errors++;
+        return;
+    }
+
+    if (st->nsamples == st->nalloc) {
+        st->nalloc = st->nalloc ? st->nalloc * 2 : 65536;
+        samples = realloc(st->samples, st->nalloc * sizeof(uint32_t));
+        if (samples == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        st->samples = samples;
+    }
+
+    st->samples[st->nsamples++] = (uint32_t) ((now - c->start) / 1000);
+    st->bytes += c->bytes;
+    st->status[(c->status >= 100 && c->status < 600) ? c->status / 100 : 0]++;
+}
+
+
+static void
+lg_fail(lg_conn_t *c)
+{
+    lg_record(c, 0);
+    lg_close(c);
+}
+
+
+static void
+lg_finish(lg_conn_t *c)
+{
+    lg_record(c, 1);
+
+    if (!c->keepalive) {
+        lg_close(c);
+        return;
+    }
+
+    c->state = lg_idle;
+}
+
+
+static void
+lg_start(lg_conn_t *c)
+{
+    c->kind = lg_pick_kind();
+    c->req_len = lg_request(c->req, sizeof(c->req), c->kind);
+    c->sent = 0;
+    c->len = 0;
+    c->bytes = 0;
+    c->start = lg_now();
+
+    if (c->fd != -1) {
+        c->state = lg_writing;
+        return;
+    }
+
+    if (lg_connect(c) == -1) {
+        lg_fail(c);
+    }
+}
+
+
+/* Consume body bytes, 1 once the response is complete */
+static int
+lg_body(lg_conn_t *c, char *p, size_t n)
+{
+    char *last;
+    int d;
+
+    switch (c->body) {
+
+    case lg_body_none:
+        return 1;
+
+    case lg_body_close:
+        return 0;
+
+    case lg_body_length:
+        if (n > c->remaining) {
+            n = c->remaining;    /* a pipelined byte would be a server bug */
+        }
+
+        c->remaining -= n;
+        return c->remaining == 0;
+
+    default: /* lg_body_chunked */
+        break;
+    }
+
+    for (last = p + n; p < last; p++) {
+
+        switch (c->chunk) {
+
+        case lg_chunk_size:
+            if (*p == ';') {
+                c->chunk = lg_chunk_ext;
+                break;
+            }
+
+            if (*p == '\r') {
+                c->chunk = lg_chunk_size_lf;
+                break;
+            }
+
+            d = (*p >= '0' && *p <= '9') ? *p - '0'
+                : ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+                  ? (*p | 0x20) - 'a' + 10 : -1;
+
+            if (d == -1) {
+                return -1;
+            }
+
+            c->remaining = c->remaining * 16 + d;
+            break;
+
+        case lg_chunk_ext:
+            if (*p == '\r') {
+                c->chunk = lg_chunk_size_lf;
+            }
+            break;
+
+        case lg_chunk_size_lf:
+            if (*p != '\n') {
+                return -1;
+            }
+
+            if (c->remaining == 0) {
+                c->chunk = lg_chunk_trailer;
+                c->line_empty = 1;
+                break;
+            }
+
+            c->chunk = lg_chunk_data;
+            break;
+
+        case lg_chunk_data:
+            n = last - p;
+            if (n > c->remaining) {
+                n = c->remaining;
+            }
+
+            c->remaining -= n;
+            p += n - 1;
+
+            if (c->remaining == 0) {
+                c->chunk = lg_chunk_data_cr;
+            }
+            break;
+
+        case lg_chunk_data_cr:
+            if (*p != '\r') {
+                return -1;
+            }
+            c->chunk = lg_chunk_data_lf;
+            break;
+
+        case lg_chunk_data_lf:
+            if (*p != '\n') {
+                return -1;
+            }
+            c->chunk = lg_chunk_size;
+            break;
+
+        case lg_chunk_trailer:
+            if (*p == '\r') {
+                c->chunk = lg_chunk_trailer_lf;
+                break;
+            }
+            c->line_empty = 0;
+            break;
+
+        case lg_chunk_trailer_lf:
+            if (*p != '\n') {
+                return -1;
+            }
+
+            if (c->line_empty) {
+                return 1;
+            }
+
+            c->chunk = lg_chunk_trailer;
+            c->line_empty = 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Parse the status line and the headers that frame the body */
+static int
+lg_header(lg_conn_t *c, char *end)
+{
+    char *p, *line, *eol;
+    size_t len;
+    uint64_t length;
+    int has_length;
+
+    if (c->len < 12 || strncmp(c->buf, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+
+    c->status = atoi(c->buf + 9);
+    c->keepalive = (c->buf[7] == '1');
+    c->body = lg_body_close;
+    has_length = 0;
+    length = 0;
+
+    for (line = strstr(c->buf, "\r\n") + 2; line < end; line = eol + 2) {
+        eol = strstr(line, "\r\n");
+        len = eol - line;
+
+        if (len > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = strtoull(line + 15, NULL, 10);
+            has_length = 1;
+
+        } else if (len > 18
+                   && strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            for (p = line + 18; p + 7 <= eol; p++) {
+                if (strncasecmp(p, "chunked", 7) == 0) {
+                    c->body = lg_body_chunked;
+                    c->chunk = lg_chunk_size;
+                    c->remaining = 0;
+                    break;
+                }
+            }
+
+        } else if (len > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+            for (p = line + 11; p + 5 <= eol; p++) {
+                if (strncasecmp(p, "close", 5) == 0) {
+                    c->keepalive = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (c->status < 200 || c->status == 204 || c->status == 304) {
+        c->body = lg_body_none;
+
+    } else if (c->body != lg_body_chunked && has_length) {
+        c->body = length ? lg_body_length : lg_body_none;
+        c->remaining = length;
+    }
+
+    if (c->body == lg_body_close) {
+        c->keepalive = 0;
+    }
+
+    return 0;
+}
+
+
+static void
+lg_read(lg_conn_t *c)
+{
+    char *end, *body;
+    ssize_t n;
+    int rc;
+
+    for ( ;; ) {
+        if (c->state == lg_reading_header) {
+            n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+        } else {
+            n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+        }
+
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                lg_fail(c);
+            }
+            return;
+        }
+
+        if (n == 0) {
+            if (c->state == lg_reading_body && c->body == lg_body_close) {
+                lg_finish(c);
+            } else {
+                lg_fail(c);
+            }
+            return;
+        }
+
+        c->bytes += n;
+
+        if (c->state == lg_reading_body) {
+            rc = lg_body(c, c->buf, n);
+            goto body_done;
+        }
+
+        c->len += n;
+        c->buf[c->len] = '\0';
+
+        end = strstr(c->buf, "\r\n\r\n");
+        if (end == NULL) {
+            if (c->len == sizeof(c->buf) - 1) {
+                lg_fail(c);        /* headers too large */
+                return;
+            }
+            continue;
+        }
+
+        if (lg_header(c, end + 2) != 0) {
+            lg_fail(c);
+            return;
+        }
+
+        body = end + 4;
+        c->state = lg_reading_body;
+        rc = lg_body(c, body, c->buf + c->len - body);
+
+    body_done:
+
+        if (rc == -1) {
+            lg_fail(c);
+            return;
+        }
+
+        if (rc == 1) {
+            lg_finish(c);
+            return;
+        }
+    }
+}
+
+
+static void
+lg_write(lg_conn_t *c)
+{
+    ssize_t n;
+    int err;
+    socklen_t len;
+
+    if (c->state == lg_connecting) {
+        len = sizeof(err);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1
+            || err != 0)
+        {
+            lg_fail(c);
+            return;
+        }
+
+        c->state = lg_writing;
+    }
+
+    while (c->sent < c->req_len) {
+        n = send(c->fd, c->req + c->sent, c->req_len - c->sent, 0);
+
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                lg_fail(c);
+            }
+            return;
+        }
+
+        c->sent += n;
+    }
+
+    c->state = lg_reading_header;
+}
+
+
+static int
+lg_run(void)
+{
+    unsigned i;
+    uint64_t now;
+    lg_conn_t *conns, *c;
+    struct pollfd *pfd;
+
+    conns = calloc(lg_conf.connections, sizeof(lg_conn_t));
+    pfd = calloc(lg_conf.connections, sizeof(struct pollfd));
+    if (conns == NULL || pfd == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < lg_conf.connections; i++) {
+        conns[i].fd = -1;
+    }
+
+    now = lg_now();
+    lg_measure_start = now + (uint64_t) (lg_conf.warmup * 1e9);
+    lg_measure_end = lg_measure_start + (uint64_t) (lg_conf.duration * 1e9);
+
+    while (now < lg_measure_end) {
+
+        for (i = 0; i < lg_conf.connections; i++) {
+            c = &conns[i];
+
+            if (c->state == lg_idle) {
+                lg_start(c);
+
+            } else if (now - c->start > LG_TIMEOUT) {
+                lg_fail(c);
+                lg_start(c);
+            }
+
+            pfd[i].fd = c->fd;
+            pfd[i].events = (c->state == lg_connecting
+                             || c->state == lg_writing) ? POLLOUT : POLLIN;
+            pfd[i].revents = 0;
+        }
+
+        if (poll(pfd, lg_conf.connections, 100) == -1 && errno != EINTR) {
+            perror("poll");
+            return -1;
+        }
+
+        for (i = 0; i < lg_conf.connections; i++) {
+            c = &conns[i];
+
+            if (pfd[i].revents == 0 || c->fd != pfd[i].fd) {
+                continue;
+            }
+
+            if (c->state == lg_connecting || c->state == lg_writing) {
+                lg_write(c);
+
+            } else {
+                lg_read(c);
+            }
+        }
+
+        now = lg_now();
+    }
+
+    for (i = 0; i < lg_conf.connections; i++) {
+        lg_close(&conns[i]);
+    }
+
+    free(conns);
+    free(pfd);
+
+    return 0;
+}
+
+
+/*
+ * Flag the offender User-Agents before the run: each one fetches a
+ * disallowed URL once, over a connection of its own.
+ */
+static int
+lg_prime(void)
+{
+    unsigned i;
+    ssize_t n;
+    char buf[LG_BUF_SIZE], path[512];
+    int fd, status;
+    struct timeval tv;
+
+    for (i = 0; i < lg_conf.offenders; i++) {
+        fd = socket(lg_conf.addr.ss_family, SOCK_STREAM, 0);
+        if (fd == -1) {
+            return -1;
+        }
+
+        tv.tv_sec = 10;
+        tv.tv_usec = 0;
+        (void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        if (connect(fd, (struct sockaddr *) &lg_conf.addr, lg_conf.addrlen)
+            == -1)
+        {
+            perror("connect");
+            close(fd);
+            return -1;
+        }
+
+        snprintf(path, sizeof(path), "%s", lg_conf.disallowed[0]);
+
+        n = snprintf(buf, sizeof(buf),
+                     "GET %spage.html HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "User-Agent: Mozilla/5.0 (compatible; RepeatBot/%u)\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     path, lg_conf.host, i);
+
+        if (send(fd, buf, n, 0) != n) {
+            close(fd);
+            return -1;
+        }
+
+        status = 0;
+
+        while ((n = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+            if (status == 0) {
+                buf[n] = '\0';
+                status = (n > 12) ? atoi(buf + 9) : -1;
+            }
+        }
+
+        close(fd);
+
+        if (status != 200) {
+            fprintf(stderr, "flagging RepeatBot/%u: status %d\n", i, status);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+lg_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Nearest-rank percentile of sorted samples */
+static uint32_t
+lg_percentile(lg_stats_t *st, double q)
+{
+    size_t k;
+
+    if (st->nsamples == 0) {
+        return 0;
+    }
+
+    k = (size_t) (q * st->nsamples + 0.999999);
+    if (k == 0) {
+        k = 1;
+    }
+
+    return st->samples[(k > st->nsamples ? st->nsamples : k) - 1];
+}
+
+
+static void
+lg_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+
+    for ( /* void */ ; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+
+        if ((unsigned char) *s >= 0x20) {
+            fputc(*s, f);
+        }
+    }
+
+    fputc('"', f);
+}
+
+
+static void
+lg_report(FILE *out, FILE *json)
+{
+    int k;
+    double secs, sum;
+    size_t i;
+    uint64_t total, errors;
+    lg_stats_t *st;
+
+    secs = lg_conf.duration;
+    total = 0;
+    errors = 0;
+
+    for (k = 0; k < LG_KINDS; k++) {
+        st = &lg_stats[k];
+        qsort(st->samples, st->nsamples, sizeof(uint32_t), lg_cmp);
+        total += st->nsamples;
+        errors += st->errors;
+    }
+
+    fprintf(out, "%-12s %10s %8s %10s %8s %8s %8s %8s %8s\n",
+            "path", "requests", "errors", "req/s", "mean", "p50", "p99",
+            "p999", "max");
+
+    for (k = 0; k < LG_KINDS; k++) {
+        st = &lg_stats[k];
+
+        for (sum = 0, i = 0; i < st->nsamples; i++) {
+            sum += st->samples[i];
+        }
+
+        fprintf(out, "%-12s %10zu %8llu %10.1f %6.0fus %6uus %6uus %6uus "
+                "%6uus\n",
+                lg_kind_names[k], st->nsamples,
+                (unsigned long long) st->errors, st->nsamples / secs,
+                st->nsamples ? sum / st->nsamples : 0.0,
+                lg_percentile(st, 0.50), lg_percentile(st, 0.99),
+                lg_percentile(st, 0.999),
+                st->nsamples ? st->samples[st->nsamples - 1] : 0);
+    }
+
+    fprintf(out, "%-12s %10llu %8llu %10.1f\n", "total",
+            (unsigned long long) total, (unsigned long long) errors,
+            total / secs);
+
+    if (json == NULL) {
+        return;
+    }
+
+    fprintf(json, "{\n  \"label\": ");
+    lg_json_string(json, lg_conf.label ? lg_conf.label : "");
+    fprintf(json, ",\n  \"target\": ");
+    lg_json_string(json, lg_conf.host);
+    fprintf(json, ",\n  \"port\": %s,\n", lg_conf.port);
+    fprintf(json, "  \"connections\": %u,\n", lg_conf.connections);
+    fprintf(json, "  \"duration\": %.3f,\n", lg_conf.duration);
+    fprintf(json, "  \"warmup\": %.3f,\n", lg_conf.warmup);
+    fprintf(json, "  \"mix\": {\"passthrough\": %u, \"honeypot\": %u, "
+            "\"offender\": %u},\n",
+            lg_conf.mix[0], lg_conf.mix[1], lg_conf.mix[2]);
+    fprintf(json, "  \"offenders\": %u,\n", lg_conf.offenders);
+    fprintf(json, "  \"requests\": %llu,\n", (unsigned long long) total);
+    fprintf(json, "  \"errors\": %llu,\n", (unsigned long long) errors);
+    fprintf(json, "  \"throughput\": %.1f,\n", total / secs);
+    fprintf(json, "  \"paths\": {\n");
+
+    for (k = 0; k < LG_KINDS; k++) {
+        st = &lg_stats[k];
+
+        for (sum = 0, i = 0; i < st->nsamples; i++) {
+            sum += st->samples[i];
+        }
+
+        fprintf(json, "    \"%s\": {\n", lg_kind_names[k]);
+        fprintf(json, "      \"requests\": %zu,\n", st->nsamples);
+        fprintf(json, "      \"errors\": %llu,\n",
+                (unsigned long long) st->errors);
+        fprintf(json, "      \"throughput\": %.1f,\n", st->nsamples / secs);
+        fprintf(json, "      \"bytes\": %llu,\n",
+                (unsigned long long) st->bytes);
+        fprintf(json, "      \"status\": {\"2xx\": %llu, \"3xx\": %llu, "
+                "\"4xx\": %llu, \"5xx\": %llu, \"other\": %llu},\n",
+                (unsigned long long) st->status[2],
+                (unsigned long long) st->status[3],
+                (unsigned long long) st->status[4],
+                (unsigned long long) st->status[5],
+                (unsigned long long) (st->status[0] + st->status[1]));
+        fprintf(json, "      \"latency_us\": {\"mean\": %.1f, \"p50\": %u, "
+                "\"p99\": %u, \"p999\": %u, \"max\": %u}\n",
+                st->nsamples ? sum / st->nsamples : 0.0,
+                lg_percentile(st, 0.50), lg_percentile(st, 0.99),
+                lg_percentile(st, 0.999),
+                st->nsamples ? st->samples[st->nsamples - 1] : 0);
+        fprintf(json, "    }%s\n", k < LG_KINDS - 1 ? "," : "");
+    }
+
+    fprintf(json, "  }\n}\n");
+}
+
+
+static int
+lg_load_paths(const char *name, char **paths, unsigned *n)
+{
+    FILE *f;
+    char line[512];
+    size_t len;
+
+    f = fopen(name, "r");
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+
+    *n = 0;
+
+    while (*n < LG_MAX_PATHS && fgets(line, sizeof(line), f) != NULL) {
+        len = strcspn(line, "\r\n");
+        line[len] = '\0';
+
+        if (len == 0 || line[0] != '/') {
+            continue;    /* blank lines and comments */
+        }
+
+        paths[(*n)++] = strdup(line);
+    }
+
+    fclose(f);
+
+    if (*n == 0) {
+        fprintf(stderr, "no paths in %s\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+lg_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -h host        server address (127.0.0.1)\n"
+            "  -p port        server port (8080)\n"
+            "  -c n           concurrent connections (64)\n"
+            "  -d seconds     measured duration (10)\n"
+            "  -w seconds     warm-up before measuring (2)\n"
+            "  -m p,h,o       passthrough, honeypot and offender weights "
+            "(70,20,10)\n"
+            "  -n n           offender User-Agents flagged before the run "
+            "(16)\n"
+            "  -a file        allowed paths, one per line\n"
+            "  -x file        disallowed path prefixes, one per line\n"
+            "  -l label       label stored with the results\n"
+            "  -o file        write the results as JSON\n",
+            name);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int ch, rc;
+    FILE *json;
+    struct addrinfo hints, *res;
+
+    lg_conf.host = "127.0.0.1";
+    lg_conf.port = "8080";
+    lg_conf.connections = 64;
+    lg_conf.duration = 10;
+    lg_conf.warmup = 2;
+    lg_conf.mix[LG_PASSTHROUGH] = 70;
+    lg_conf.mix[LG_HONEYPOT] = 20;
+    lg_conf.mix[LG_OFFENDER] = 10;
+    lg_conf.offenders = 16;
+
+    memcpy(lg_conf.allowed, lg_default_allowed, sizeof(lg_default_allowed));
+    lg_conf.nallowed = sizeof(lg_default_allowed) / sizeof(char *);
+    memcpy(lg_conf.disallowed, lg_default_disallowed,
+           sizeof(lg_default_disallowed));
+    lg_conf.ndisallowed = sizeof(lg_default_disallowed) / sizeof(char *);
+
+    while ((ch = getopt(argc, argv, "h:p:c:d:w:m:n:a:x:l:o:")) != -1) {
+        switch (ch) {
+        case 'h':
+            lg_conf.host = optarg;
+            break;
+        case 'p':
+            lg_conf.port = optarg;
+            break;
+        case 'c':
+            lg_conf.connections = atoi(optarg);
+            break;
+        case 'd':
+            lg_conf.duration = atof(optarg);
+            break;
+        case 'w':
+            lg_conf.warmup = atof(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%u,%u,%u", &lg_conf.mix[0], &lg_conf.mix[1],
+                       &lg_conf.mix[2]) != 3)
+            {
+                lg_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'n':
+            lg_conf.offenders = atoi(optarg);
+            break;
+        case 'a':
+            if (lg_load_paths(optarg, lg_conf.allowed, &lg_conf.nallowed)) {
+                return 2;
+            }
+            break;
+        case 'x':
+            if (lg_load_paths(optarg, lg_conf.disallowed,
+                              &lg_conf.ndisallowed))
+            {
+                return 2;
+            }
+            break;
+        case 'l':
+            lg_conf.label = optarg;
+            break;
+        case 'o':
+            lg_conf.output = optarg;
+            break;
+        default:
+            lg_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (lg_conf.connections == 0 || lg_conf.duration <= 0
+        || lg_conf.mix[0] + lg_conf.mix[1] + lg_conf.mix[2] == 0
+        || (lg_conf.mix[LG_OFFENDER] && lg_conf.offenders == 0))
+    {
+        lg_usage(argv[0]);
+        return 2;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    rc = getaddrinfo(lg_conf.host, lg_conf.port, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", lg_conf.host, gai_strerror(rc));
+        return 1;
+    }
+
+    memcpy(&lg_conf.addr, res->ai_addr, res->ai_addrlen);
+    lg_conf.addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* a new seed every run, so honeypot User-Agents are never reused */
+    lg_rng_state = (lg_now() ^ ((uint64_t) getpid() << 32)) | 1;
+    lg_bot_seq = lg_random();
+
+    if (lg_conf.mix[LG_OFFENDER] && lg_prime() != 0) {
+        fprintf(stderr, "could not flag the offender User-Agents, "
+                "is the server running?\n");
+        return 1;
+    }
+
+    printf("%u connections to %s:%s, %.0fs warm-up, %.0fs measured, "
+           "mix %u/%u/%u\n",
+           lg_conf.connections, lg_conf.host, lg_conf.port, lg_conf.warmup,
+           lg_conf.duration, lg_conf.mix[0], lg_conf.mix[1], lg_conf.mix[2]);
+
+    if (lg_run() != 0) {
+        return 1;
+    }
+
+    json = NULL;
+
+    if (lg_conf.output != NULL) {
+        json = fopen(lg_conf.output, "w");
+        if (json == NULL) {
+            perror(lg_conf.output);
+            return 1;
+        }
+    }
+
+    lg_report(stdout, json);
+
+    if (json != NULL) {
+        fclose(json);
+        printf("results written to %s\n", lg_conf.output);
+    }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#!/bin/bash
+# Load test for RoboNope: starts nginx with the module on its own port and
+# drives it with tests/load/loadgen, see "make loadtest".
+
+# Set up colors for output
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+NC='\033[0m' # No Color
+
+# Ensure we're in the project root
+cd "$(dirname "$0")/../.." || exit 1
+
+NGINX_BIN=${NGINX_BIN:-build/nginx-1.24.0/objs/nginx}
+MODULE_SO=${MODULE_SO:-build/nginx-1.24.0/objs/ngx_http_robonope_module.so}
+LOADGEN=${LOADGEN:-build/loadtest/loadgen}
+LOADTEST_DIR=build/loadtest
+LOADTEST_PORT=${LOADTEST_PORT:-8090}
+LOADTEST_WORKERS=${LOADTEST_WORKERS:-auto}
+LOADTEST_CONNECTIONS=${LOADTEST_CONNECTIONS:-256}
+LOADTEST_DURATION=${LOADTEST_DURATION:-30}
+LOADTEST_WARMUP=${LOADTEST_WARMUP:-5}
+LOADTEST_MIX=${LOADTEST_MIX:-70,20,10}
+LOADTEST_OFFENDERS=${LOADTEST_OFFENDERS:-64}
+LOADTEST_LABEL=${LOADTEST_LABEL:-$(git describe --always --dirty 2>/dev/null || echo unknown)}
+LOADTEST_OUTPUT=${LOADTEST_OUTPUT:-$LOADTEST_DIR/results-$(date +%Y%m%d-%H%M%S).json}
+
+for f in "$NGINX_BIN" "$MODULE_SO" "$LOADGEN"; do
+    if [ ! -f "$f" ]; then
+        echo -e "${RED}✗ $f not found, run 'make build' first${NC}"
+        exit 1
+    fi
+done
+
+mkdir -p $LOADTEST_DIR/conf $LOADTEST_DIR/html $LOADTEST_DIR/logs
+cp examples/static/* $LOADTEST_DIR/html/
+cp examples/robots.txt $LOADTEST_DIR/html/
+
+# No rate limiting and no access log, so only the module and nginx itself
+# are measured.  Set LOADTEST_DB to include the request log.
+cat > $LOADTEST_DIR/conf/nginx.conf <<EOF
+load_module $PWD/$MODULE_SO;
+worker_processes $LOADTEST_WORKERS;
+worker_rlimit_nofile 65536;
+error_log logs/error.log warn;
+pid logs/nginx.pid;
+events { worker_connections 16384; }
+http {
+    default_type text/html;
+    access_log off;
+    keepalive_requests 1000000;
+    robonope_enable on;
+    robonope_robots_path $PWD/$LOADTEST_DIR/html/robots.txt;
+    robonope_offender_action honeypot;
+    robonope_db_path ${LOADTEST_DB:-off};
+    server {
+        listen 127.0.0.1:$LOADTEST_PORT;
+        root html;
+    }
+}
+EOF
+
+stop_nginx() {
+    "$NGINX_BIN" -p $LOADTEST_DIR -c conf/nginx.conf -s stop 2>/dev/null || true
+}
+
+stop_nginx
+sleep 1
+
+if ! "$NGINX_BIN" -p $LOADTEST_DIR -c conf/nginx.conf; then
+    echo -e "${RED}✗ Failed to start nginx, see $LOADTEST_DIR/logs/error.log${NC}"
+    exit 1
+fi
+
+trap stop_nginx EXIT
+sleep 1
+
+# Load generator sockets need file descriptors too
+ulimit -n 65536 2>/dev/null || true
+
+echo -e "${GREEN}✓ Started nginx on 127.0.0.1:$LOADTEST_PORT ($LOADTEST_WORKERS workers)${NC}"
+
+"$LOADGEN" -h 127.0.0.1 -p "$LOADTEST_PORT" \
+    -c "$LOADTEST_CONNECTIONS" -d "$LOADTEST_DURATION" -w "$LOADTEST_WARMUP" \
+    -m "$LOADTEST_MIX" -n "$LOADTEST_OFFENDERS" \
+    ${LOADTEST_ALLOWED:+-a "$LOADTEST_ALLOWED"} \
+    ${LOADTEST_DISALLOWED:+-x "$LOADTEST_DISALLOWED"} \
+    -l "$LOADTEST_LABEL" -o "$LOADTEST_OUTPUT"
+rc=$?
+
+if grep -q '\[\(alert\|crit\|emerg\)\]' $LOADTEST_DIR/logs/error.log 2>/dev/null; then
+    echo -e "${RED}✗ nginx logged errors during the run:${NC}"
+    grep '\[\(alert\|crit\|emerg\)\]' $LOADTEST_DIR/logs/error.log | tail -5
+    rc=1
+fi
+
+exit $rc
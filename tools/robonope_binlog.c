@@ -0,0 +1,411 @@
+/*
+ * RoboNope binary log converter.
+ *
+ * Reads the segment files written with "robonope_log_format binary" and
+ * prints their hits for bulk loading, so the request path never waits on
+ * a database and the database work happens offline:
+ *
+ *   sql   one transaction of multi-row INSERTs, for sqlite3.  By default
+ *         into the requests table the module writes to, created if
+ *         missing; with -s demo into bot_requests from demo/schema.sql,
+ *         which keeps the first hit of each client as its fingerprint
+ *         column is UNIQUE, and has no method, status or size to fill in
+ *   csv   every field of a hit with a header line, for DuckDB's read_csv()
+ *         or sqlite3 .import
+ *
+ * Segments are mapped read-only.  A segment still being written is read up
+ * to its last whole record.  Each segment names its strings on its own, so
+ * segments can be converted in any order and in parallel.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ngx_http_robonope_binlog.h"
+
+#define BL_OUT_BUFFER  (1024 * 1024)
+
+enum {
+    BL_SQL = 0,
+    BL_CSV
+};
+
+enum {
+    BL_REQUESTS = 0,
+    BL_DEMO
+};
+
+typedef struct {
+    const uint8_t  *data;
+    uint16_t        len;
+} bl_string_t;
+
+static struct {
+    int             format;
+    int             schema;
+    unsigned        rows;       /* Rows per INSERT */
+} bl_conf;
+
+static bl_string_t *bl_strings;
+static size_t bl_nalloc;
+static unsigned long long bl_hits;
+static unsigned bl_batch;       /* Rows in the current INSERT */
+
+
+static void
+bl_quote(const bl_string_t *s, char quote)
+{
+    size_t i;
+
+    putchar(quote);
+
+    for (i = 0; s != NULL && i < s->len; i++) {
+        if (s->data[i] == (uint8_t) quote) {
+            putchar(quote);
+        }
+        putchar(s->data[i]);
+    }
+
+    putchar(quote);
+}
+
+
+static void
+bl_hit(const ngx_http_robonope_binlog_hit_t *hit)
+{
+    int i;
+    char ip[INET6_ADDRSTRLEN], ts[sizeof("1970-01-01 00:00:00")];
+    time_t sec;
+    struct tm tm;
+    const bl_string_t *ua, *url, *pattern;
+
+    sec = (time_t) (hit->time / 1000);
+    gmtime_r(&sec, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+
+    ip[0] = '\0';
+    if (hit->family == 4) {
+        inet_ntop(AF_INET, hit->addr, ip, sizeof(ip));
+    } else if (hit->family == 6) {
+        inet_ntop(AF_INET6, hit->addr, ip, sizeof(ip));
+    }
+
+    ua = hit->user_agent ? &bl_strings[hit->user_agent] : NULL;
+    url = hit->url ? &bl_strings[hit->url] : NULL;
+    pattern = hit->pattern ? &bl_strings[hit->pattern] : NULL;
+
+    if (bl_conf.format == BL_CSV) {
+        printf("%s.%03u,%s,", ts, (unsigned) (hit->time % 1000), ip);
+        for (i = 0; i < 16; i++) {
+            printf("%02x", hit->fingerprint[i]);
+        }
+        putchar(',');
+        bl_quote(ua, '"');
+        putchar(',');
+        bl_quote(url, '"');
+        putchar(',');
+        bl_quote(pattern, '"');
+        putchar('\n');
+        return;
+    }
+
+    if (bl_batch == 0) {
+        if (bl_conf.schema == BL_DEMO) {
+            fputs("INSERT OR IGNORE INTO bot_requests (timestamp, user_agent, "
+                  "ip_address, request_url, request_method, status_code, "
+                  "response_size, matched_pattern, fingerprint) VALUES\n",
+                  stdout);
+        } else {
+            fputs("INSERT INTO requests (timestamp, ip, user_agent, url, "
+                  "matched_pattern) VALUES\n", stdout);
+        }
+
+    } else {
+        fputs(",\n", stdout);
+    }
+
+    printf("('%s.%03u', ", ts, (unsigned) (hit->time % 1000));
+
+    if (bl_conf.schema == BL_DEMO) {
+        bl_quote(ua, '\'');
+        printf(", '%s', ", ip);
+        bl_quote(url, '\'');
+        fputs(", '', 0, 0, ", stdout);
+        bl_quote(pattern, '\'');
+        fputs(", '", stdout);
+        for (i = 0; i < 16; i++) {
+            printf("%02x", hit->fingerprint[i]);
+        }
+        fputs("')", stdout);
+
+    } else {
+        printf("'%s', ", ip);
+        bl_quote(ua, '\'');
+        fputs(", ", stdout);
+        bl_quote(url, '\'');
+        fputs(", ", stdout);
+        bl_quote(pattern, '\'');
+        putchar(')');
+    }
+
+    if (++bl_batch == bl_conf.rows) {
+        fputs(";\n", stdout);
+        bl_batch = 0;
+    }
+}
+
+
+/* Convert one segment, returns 0 if it was read to its end */
+static int
+bl_segment(const char *path)
+{
+    int fd, rc;
+    size_t size, len, nstrings;
+    uint8_t *map;
+    const uint8_t *p, *end;
+    struct stat st;
+    const ngx_http_robonope_binlog_header_t *header;
+    const ngx_http_robonope_binlog_string_t *str;
+    const ngx_http_robonope_binlog_hit_t *hit;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    size = (size_t) st.st_size;
+    if (size < sizeof(ngx_http_robonope_binlog_header_t)) {
+        fprintf(stderr, "%s: not a robonope binary log\n", path);
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    header = (const ngx_http_robonope_binlog_header_t *) map;
+
+    if (memcmp(header->magic, NGX_HTTP_ROBONOPE_BINLOG_MAGIC,
+               sizeof(header->magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a robonope binary log\n", path);
+        munmap(map, size);
+        return 1;
+    }
+
+    if (header->version != NGX_HTTP_ROBONOPE_BINLOG_VERSION) {
+        fprintf(stderr, "%s: unsupported version %u, or written on a host "
+                "of another byte order\n", path, (unsigned) header->version);
+        munmap(map, size);
+        return 1;
+    }
+
+    rc = 0;
+    nstrings = 0;
+    p = map + sizeof(ngx_http_robonope_binlog_header_t);
+    end = map + size;
+
+    while (p < end) {
+
+        if (*p == NGX_HTTP_ROBONOPE_BINLOG_STRING) {
+            if ((size_t) (end - p) < sizeof(ngx_http_robonope_binlog_string_t)) {
+                break;
+            }
+
+            str = (const ngx_http_robonope_binlog_string_t *) p;
+            len = sizeof(ngx_http_robonope_binlog_string_t)
+                  + ngx_http_robonope_binlog_align(str->len);
+
+            if ((size_t) (end - p) < len) {
+                break;
+            }
+
+            /* ids are handed out in order, anything else is corruption */
+            if (str->id != nstrings + 1) {
+                rc = 1;
+                break;
+            }
+
+            if (str->id >= bl_nalloc) {
+                bl_nalloc = bl_nalloc ? 2 * bl_nalloc : 4096;
+                bl_strings = realloc(bl_strings,
+                                     bl_nalloc * sizeof(bl_string_t));
+                if (bl_strings == NULL) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+
+            bl_strings[str->id].data = (const uint8_t *) (str + 1);
+            bl_strings[str->id].len = str->len;
+            nstrings++;
+
+            p += len;
+            continue;
+        }
+
+        if (*p == NGX_HTTP_ROBONOPE_BINLOG_HIT) {
+            if ((size_t) (end - p) < sizeof(ngx_http_robonope_binlog_hit_t)) {
+                break;
+            }
+
+            hit = (const ngx_http_robonope_binlog_hit_t *) p;
+
+            if (hit->user_agent > nstrings || hit->url > nstrings
+                || hit->pattern > nstrings)
+            {
+                rc = 1;
+                break;
+            }
+
+            bl_hit(hit);
+            bl_hits++;
+
+            p += sizeof(ngx_http_robonope_binlog_hit_t);
+            continue;
+        }
+
+        rc = 1;
+        break;
+    }
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: corrupt record at offset %lu\n", path,
+                (unsigned long) (p - map));
+    }
+
+    munmap(map, size);
+
+    return rc;
+}
+
+
+static void
+bl_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] segment...\n"
+            "  -f sql|csv     output format (sql)\n"
+            "  -s schema      SQL table: requests, the module's own, or\n"
+            "                 demo, bot_requests from demo/schema.sql "
+            "(requests)\n"
+            "  -n rows        rows per INSERT (500)\n",
+            name);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int ch, i, rc;
+
+    bl_conf.format = BL_SQL;
+    bl_conf.schema = BL_REQUESTS;
+    bl_conf.rows = 500;
+
+    while ((ch = getopt(argc, argv, "f:s:n:")) != -1) {
+        switch (ch) {
+        case 'f':
+            if (strcmp(optarg, "sql") == 0) {
+                bl_conf.format = BL_SQL;
+            } else if (strcmp(optarg, "csv") == 0) {
+                bl_conf.format = BL_CSV;
+            } else {
+                bl_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "requests") == 0) {
+                bl_conf.schema = BL_REQUESTS;
+            } else if (strcmp(optarg, "demo") == 0) {
+                bl_conf.schema = BL_DEMO;
+            } else {
+                bl_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'n':
+            bl_conf.rows = (unsigned) atoi(optarg);
+            break;
+        default:
+            bl_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind == argc || bl_conf.rows == 0) {
+        bl_usage(argv[0]);
+        return 2;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, BL_OUT_BUFFER);
+
+    if (bl_conf.format == BL_CSV) {
+        puts("timestamp,ip,fingerprint,user_agent,url,matched_pattern");
+
+    } else {
+        puts("BEGIN;");
+
+        if (bl_conf.schema == BL_REQUESTS) {
+            /* The module's own table, as ngx_http_robonope_init_db() creates it */
+            puts("CREATE TABLE IF NOT EXISTS requests ("
+                 "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                 "timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                 "ip TEXT,"
+                 "user_agent TEXT,"
+                 "url TEXT,"
+                 "matched_pattern TEXT"
+                 ");");
+        }
+    }
+
+    rc = 0;
+
+    for (i = optind; i < argc; i++) {
+        if (bl_segment(argv[i]) != 0) {
+            rc = 1;
+        }
+    }
+
+    if (bl_conf.format == BL_SQL) {
+        if (bl_batch > 0) {
+            fputs(";\n", stdout);
+        }
+
+        puts("COMMIT;");
+    }
+
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "%llu hits from %d segments\n", bl_hits, argc - optind);
+
+    return rc;
+}